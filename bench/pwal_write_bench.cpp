@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// measures the throughput of log_channel::add_entry() for each persistent format version,
+// e.g. pwal-write-bench --versions=1,2 --entries=2000000 --repeat=5
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>  // NOLINT(*-deprecated-headers): <cstdlib> does not provide std::mkdtemp
+#include <boost/filesystem.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <limestone/api/configuration.h>
+#include <limestone/api/datastore.h>
+
+DEFINE_string(versions, "1,2", "comma separated persistent format versions to compare");
+DEFINE_uint64(entries, 2000000, "number of entries written per run");
+DEFINE_uint64(entries_per_session, 10000, "number of entries written between begin_session() and end_session()");
+DEFINE_uint64(key_size, 16, "key size in bytes");
+DEFINE_uint64(value_size, 100, "value size in bytes");
+DEFINE_int32(repeat, 5, "number of runs per version, the median is reported");
+DEFINE_string(dir, "/tmp", "parent directory of the temporary log directories");
+
+namespace {
+
+struct result {
+    double add_entry_seconds;  // time spent in add_entry() only
+    double total_seconds;      // including begin_session() and end_session(), that is, fflush and fsync
+};
+
+result run(int version) {
+    std::string tmpl = FLAGS_dir + "/pwal_write_bench_XXXXXX";
+    if (mkdtemp(tmpl.data()) == nullptr) {
+        std::perror("mkdtemp");
+        std::exit(1);
+    }
+    boost::filesystem::path location{tmpl};
+
+    result r{};
+    {
+        limestone::api::configuration conf({location}, location);
+        conf.set_persistent_format_version(version);
+        limestone::api::datastore ds{conf};
+        limestone::api::log_channel& channel = ds.create_channel(location);
+        ds.ready();
+
+        std::string key(FLAGS_key_size, 'k');
+        std::string value(FLAGS_value_size, 'v');
+        std::chrono::steady_clock::duration in_add_entry{};
+        limestone::api::epoch_id_type epoch = 1;
+        ds.switch_epoch(epoch);
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t written = 0; written < FLAGS_entries; epoch++) {
+            channel.begin_session();
+            auto n = std::min(FLAGS_entries_per_session, FLAGS_entries - written);
+            auto session_start = std::chrono::steady_clock::now();
+            for (std::uint64_t i = 0; i < n; i++, written++) {
+                // vary the key so that the entries are not identical
+                std::snprintf(key.data(), key.size(), "%015lu", written);  // NOLINT(*-vararg)
+                channel.add_entry(1, key, value, {epoch, written});
+            }
+            in_add_entry += std::chrono::steady_clock::now() - session_start;
+            channel.end_session();
+            ds.switch_epoch(epoch + 1);
+        }
+        auto end = std::chrono::steady_clock::now();
+        r.add_entry_seconds = std::chrono::duration<double>(in_add_entry).count();
+        r.total_seconds = std::chrono::duration<double>(end - start).count();
+        ds.shutdown();
+    }
+    boost::filesystem::remove_all(location);
+    return r;
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.at(v.size() / 2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    gflags::SetUsageMessage("measures the pwal write throughput of each persistent format version");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    std::vector<int> versions{};
+    std::istringstream vs{FLAGS_versions};
+    for (std::string v; std::getline(vs, v, ',');) {
+        versions.emplace_back(std::stoi(v));
+    }
+    if (versions.empty() || FLAGS_repeat <= 0 || FLAGS_entries_per_session == 0) {
+        std::cerr << "invalid options" << std::endl;
+        return 1;
+    }
+
+    double bytes_per_entry = static_cast<double>(FLAGS_key_size + FLAGS_value_size);
+    std::cout << "entries: " << FLAGS_entries << ", key: " << FLAGS_key_size << "B, value: " << FLAGS_value_size
+              << "B, entries/session: " << FLAGS_entries_per_session << ", repeat: " << FLAGS_repeat << std::endl;
+    std::cout << "version\tadd_entry[Mentries/s]\tadd_entry[MB/s]\ttotal[Mentries/s]\tratio_to_first" << std::endl;
+    double first{};
+    for (int version : versions) {
+        std::vector<double> add_entry{};
+        std::vector<double> total{};
+        run(version);  // warm up
+        for (int i = 0; i < FLAGS_repeat; i++) {
+            auto r = run(version);
+            add_entry.emplace_back(r.add_entry_seconds);
+            total.emplace_back(r.total_seconds);
+        }
+        double rate = static_cast<double>(FLAGS_entries) / median(add_entry);
+        if (first == 0) {
+            first = rate;
+        }
+        std::printf("%d\t%.3f\t\t\t%.1f\t\t%.3f\t\t\t%.3f\n",  // NOLINT(*-vararg)
+                    version, rate / 1e6, rate * bytes_per_entry / 1e6,
+                    static_cast<double>(FLAGS_entries) / median(total) / 1e6, rate / first);
+    }
+    return 0;
+}
@@ -15,11 +15,14 @@
  */
 #pragma once
 
+#include <functional>
+#include <future>
 #include <vector>
 #include <set>
 
 #include <boost/filesystem.hpp>
 
+#include <limestone/api/epoch_id_type.h>
 #include <limestone/api/log_channel.h>
 
 namespace limestone::api {
@@ -49,7 +52,7 @@ public:
 
     /**
      * @brief wait until backup operation is available
-     * @param duration the maximum time to wait
+     * @param duration the maximum time to wait in milliseconds
      * @return true if the current backup operation is available, false otherwise
      */
     [[nodiscard]] bool wait_for_ready(std::size_t duration) const noexcept;
@@ -57,14 +60,21 @@ public:
     /**
      * @brief returns a list of files to be backed up
      * @returns a list of files to be backed up
-     * @note this operation requires that a backup is available
+     * @note this operation requires that a backup is available, waits for it otherwise
      */
     std::vector<boost::filesystem::path>& files() noexcept;
 
 private:
     std::vector<boost::filesystem::path> files_;
 
-    explicit backup(std::set<boost::filesystem::path>& files) noexcept;
+    // the rotation of log files in progress when the backup started, invalid if none
+    std::shared_future<epoch_id_type> ready_;
+
+    std::function<std::set<boost::filesystem::path>()> list_files_;
+
+    bool listed_{};
+
+    backup(std::shared_future<epoch_id_type> ready, std::function<std::set<boost::filesystem::path>()> list_files) noexcept;
 
     friend class datastore;
 };
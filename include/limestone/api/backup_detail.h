@@ -15,9 +15,14 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -48,15 +53,35 @@ public:
         entry(boost::filesystem::path source_path, boost::filesystem::path destination_path, bool is_mutable, bool is_detached)
         : source_path_(std::move(source_path)), destination_path_(std::move(destination_path)), is_mutable_(is_mutable), is_detached_(is_detached) {}
 
+        entry(boost::filesystem::path source_path, boost::filesystem::path destination_path, bool is_mutable, bool is_detached, std::uintmax_t size)
+        : source_path_(std::move(source_path)), destination_path_(std::move(destination_path)), is_mutable_(is_mutable), is_detached_(is_detached), size_(size) {}
+
+        entry(boost::filesystem::path source_path, boost::filesystem::path destination_path, bool is_mutable, bool is_detached, std::uintmax_t size, std::optional<std::uint32_t> crc32c)
+        : source_path_(std::move(source_path)), destination_path_(std::move(destination_path)), is_mutable_(is_mutable), is_detached_(is_detached), size_(size), crc32c_(crc32c) {}
+
         [[nodiscard]] boost::filesystem::path source_path() const { return source_path_; }
         [[nodiscard]] boost::filesystem::path destination_path() const { return destination_path_; }
         [[nodiscard]] bool is_mutable() const { return is_mutable_; }
         [[nodiscard]] bool is_detached() const { return is_detached_; }
+        /**
+         * @brief returns the size of the file in bytes at the time the backup started
+         * @note the size of mutable files may change after that
+         */
+        [[nodiscard]] std::uintmax_t size() const { return size_; }
+        /**
+         * @brief returns the CRC32C checksum of the file, computed while the file was written
+         * @details the copy of the file can be verified with this, without reading the source file again.
+         * pass it to file_set_entry to verify the file on restore.
+         * @note nullopt for mutable files, and for the files not rotated by the current process
+         */
+        [[nodiscard]] std::optional<std::uint32_t> crc32c() const { return crc32c_; }
     private:
         boost::filesystem::path source_path_ {};
         boost::filesystem::path destination_path_ {};
         bool is_mutable_ {};
         bool is_detached_ {};
+        std::uintmax_t size_ {};
+        std::optional<std::uint32_t> crc32c_ {};
     };
 
     std::string_view configuration_id() {
@@ -65,10 +90,12 @@ public:
 
     /**
      * @brief returns minimum epoch of log files
-     * @note for LOG-0, always returns 0
+     * @note for LOG-0, returns 0 for the backup containing all log files,
+     * and the next epoch of log_finish() of the previous backup for the incremental backup (backup_type::transaction)
      */
     [[nodiscard]] epoch_id_type log_start() const {
-        return 0;
+        prepare();
+        return log_start_;
     }
 
     /**
@@ -84,24 +111,83 @@ public:
         return std::nullopt;
     }
 
+    /**
+     * @brief returns the files to be backed up
+     * @note waits until the backup is ready
+     * @throws std::runtime_error if failed to prepare the backup files
+     */
     const std::vector<backup_detail::entry>& entries() {
+        prepare();
         return entries_;
     }
 
+    /**
+     * @brief returns the total size of the files in entries() in bytes
+     */
+    [[nodiscard]] std::uintmax_t total_size() const;
+
+    /**
+     * @brief returns whether the log files to be backed up are ready, i.e. rotated
+     * @note the log channels in session rotate their files at the end of the sessions
+     */
     [[nodiscard]] bool is_ready () const;
 
+    /**
+     * @brief wait until the log files to be backed up are ready
+     * @param duration the maximum time to wait in milliseconds
+     * @return true if ready, false otherwise
+     */
+    [[nodiscard]] bool wait_for_ready(std::size_t duration) const;
+
+    /**
+     * @brief notifies that the files in entries() have been backed up successfully
+     * @details the next incremental backup (backup_type::transaction) selects the log files made after this backup.
+     * if not called, e.g. the backup failed, the next one selects the log files made after the previous completed backup.
+     * @note calling this more than once has no effect
+     */
+    void end_backup();
+
 private:
     std::string_view configuration_id_;
 
-    epoch_id_type log_finish_;
+    mutable epoch_id_type log_start_{};
+
+    mutable epoch_id_type log_finish_{};
 
     backup_detail(std::vector<backup_detail::entry>&, epoch_id_type log_finish);
 
-    std::vector<backup_detail::entry> entries_;
+    backup_detail(std::vector<backup_detail::entry>&, epoch_id_type log_start, epoch_id_type log_finish);
+
+    using prepare_function = std::function<std::pair<epoch_id_type, std::vector<backup_detail::entry>>(epoch_id_type log_finish)>;
+
+    // the entries are listed by prepare after the rotation of the log files
+    backup_detail(std::shared_future<epoch_id_type> rotated, prepare_function prepare);
+
+    // wait for the rotation, and list the entries if not yet
+    void prepare() const;
+
+    using complete_function = std::function<void(epoch_id_type log_finish, const std::vector<backup_detail::entry>& entries)>;
+
+    mutable std::vector<backup_detail::entry> entries_;
+
+    std::shared_future<epoch_id_type> rotated_{};
+
+    prepare_function prepare_{};
+
+    mutable std::once_flag prepared_{};
+
+    // records what the backup covers into the datastore, see end_backup()
+    complete_function complete_{};
+
+    std::once_flag completed_{};
 
     friend class datastore;
 };
 
+/**
+ * @brief type of backup
+ * @details standard: all log files, transaction: log files made after the previous backup (incremental backup)
+ */
 enum class backup_type { standard, transaction };
 
 } // namespace limestone::api
@@ -32,6 +32,11 @@ class configuration {
      */
     static constexpr int default_recover_max_parallelism = 8;
 
+    /**
+     * @brief default value of persistent_format_version, the original format readable by any version of this library
+     */
+    static constexpr int default_persistent_format_version = 1;
+
 public:
     /**
      * @brief create empty object
@@ -60,6 +65,29 @@ public:
         recover_max_parallelism_ = recover_max_parallelism;
     }
 
+    /**
+     * @brief setter for pwal_compression
+     * @param pwal_compression  compress the entries of each epoch snippet written into the pwal files
+     * @details the compression trades CPU time at the end of each session for the size of the pwal files and their backups.
+     * it is effective only in the log directory of persistent format version 5 or later,
+     * which cannot be read by older versions of this library.
+     */
+    void set_pwal_compression(bool pwal_compression) {
+        pwal_compression_ = pwal_compression;
+    }
+
+    /**
+     * @brief setter for persistent_format_version
+     * @param persistent_format_version  the persistent format version of a log directory newly made by the datastore
+     * @details the log directories made by the newer versions have the checksums of the entries (version 2),
+     * the sized epoch snippets (version 3), the compact entries (version 4) and the compressed epoch snippets (version 5),
+     * but cannot be read by older versions of this library.
+     * the existing log directories keep their versions.
+     */
+    void set_persistent_format_version(int persistent_format_version) {
+        persistent_format_version_ = persistent_format_version;
+    }
+
 private:
     std::vector<boost::filesystem::path> data_locations_{};
 
@@ -67,6 +95,10 @@ private:
 
     int recover_max_parallelism_{default_recover_max_parallelism};
 
+    bool pwal_compression_{};
+
+    int persistent_format_version_{default_persistent_format_version};
+
     friend class datastore;
 };
 
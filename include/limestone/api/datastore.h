@@ -20,8 +20,11 @@
 #include <atomic>
 #include <chrono>
 #include <vector>
+#include <map>
 #include <set>
 #include <mutex>
+#include <exception>
+#include <optional>
 
 #include <boost/filesystem.hpp>
 
@@ -32,10 +35,16 @@
 #include <limestone/api/configuration.h>
 #include <limestone/api/file_set_entry.h>
 #include <limestone/api/snapshot.h>
+#include <limestone/api/storage_id_type.h>
 #include <limestone/api/epoch_id_type.h>
 #include <limestone/api/write_version_type.h>
 #include <limestone/api/tag_repository.h>
 #include <limestone/api/restore_progress.h>
+#include <limestone/api/storage_stats.h>
+
+namespace limestone::internal {
+class task_pool;
+}
 
 namespace limestone::api {
 
@@ -51,6 +60,16 @@ class datastore {
      */
     static constexpr const std::string_view epoch_file_name = "epoch";
 
+    /**
+     * @brief name of a temporary file used to rewrite the epoch file
+     */
+    static constexpr const std::string_view epoch_tmp_file_name = "epoch.tmp";
+
+    /**
+     * @brief size of the epoch file at which it is rewritten to have the last durable epoch only
+     */
+    static constexpr const std::size_t epoch_file_compaction_threshold = 9 * 1024;
+
     enum class state : std::int64_t {
         not_ready = 0,
         ready = 1,
@@ -103,7 +122,7 @@ public:
 
     /**
      * @brief returns the status of the restore process that is currently in progress or that has finished immediately before
-     * @attention this function is not thread-safe.
+     * @details this function can be called from other threads while restore() is running.
      * @return the status of the restore process
      */
     restore_progress restore_status() const noexcept;
@@ -129,15 +148,38 @@ public:
      */
     std::shared_ptr<snapshot> shared_snapshot() const;
 
+    /**
+     * @brief provides the statistics of each storage in the snapshot
+     * @details the statistics are collected while the snapshot is created from the log files by ready(),
+     * so that the caller can prepare its data structures for the entries before reading the snapshot.
+     * @return the statistics keyed by the storage ID, which has the storages appeared in the log files
+     * @attention this function should be called after the ready() is called.
+     */
+    const std::map<storage_id_type, storage_stats>& storage_statistics() const noexcept;
+
     /**
      * @brief create a log_channel to write logs to a file
-     * @details logs are written to separate files created for each channel
+     * @details logs are written to separate files created for each channel.
+     * if the configuration has more than one data locations and location is the first one, the channel is placed
+     * on the data location with the fewest channels, so that the log files are striped across the data locations.
      * @param location specifies the directory of the log files
      * @return the reference of the log_channel
      * @attention this function should be called before the ready() is called.
      */
     log_channel& create_channel(const boost::filesystem::path& location);
 
+    /**
+     * @brief create a log_channel to write logs to a file, on the NUMA node
+     * @details the log_channel object and its write buffer are allocated on the NUMA node.
+     * if the log files are striped across the data locations, the data location on the device attached to the node is preferred.
+     * create_channel(location) infers the node from the CPU running the calling thread.
+     * @param location specifies the directory of the log files
+     * @param numa_node the NUMA node of the thread which uses the channel, or -1 for no preference
+     * @return the reference of the log_channel
+     * @attention this function should be called before the ready() is called.
+     */
+    log_channel& create_channel(const boost::filesystem::path& location, int numa_node);
+
     /**
      * @brief provide the largest epoch ID
      * @return the largest epoch ID that has been successfully persisted
@@ -189,6 +231,7 @@ public:
     /**
      * @brief start backup operation
      * @detail a backup object is created, which contains a list of log files.
+     * if the log files are being rotated for another backup, the backup object becomes ready after that.
      * @return a reference to the backup object.
      */
     backup& begin_backup();
@@ -197,10 +240,28 @@ public:
     /**
      * @brief start backup operation
      * @detail a backup_detail object is created, which contains a list of log entry.
+     * for backup_type::transaction, the list contains only the log files made after the previous backup
+     * (and the mutable files), if any backup has been completed by backup_detail::end_backup().
+     * this does not wait for the log channels in session; their log files are rotated at the end of the sessions,
+     * and the backup_detail becomes ready after that (see backup_detail::wait_for_ready()).
+     * @param btype the type of backup
      * @return a reference to the backup_detail object.
      */
     std::unique_ptr<backup_detail> begin_backup(backup_type btype);
 
+    /**
+     * @brief start backup operation, staging the backup files into the directory
+     * @detail the immutable log files are hard-linked into staging_dir (copied if hard links are not available),
+     * and the mutable files are copied, so that the files in the returned backup_detail are not renamed, removed
+     * or modified by this object or by compaction afterwards, and can be copied to the backup storage later.
+     * staging_dir should be on the same filesystem as the log directory, and is created if not exist.
+     * @param btype the type of backup
+     * @param staging_dir the directory to place the backup files
+     * @return a reference to the backup_detail object, whose entries have the source paths in staging_dir.
+     * @throws std::runtime_error if failed to stage the files
+     */
+    std::unique_ptr<backup_detail> begin_backup(backup_type btype, const boost::filesystem::path& staging_dir);
+
     /**
      * @brief provide epoch tag repository
      * @return a reference to the epoch tag repository
@@ -226,6 +287,23 @@ private:
 
     boost::filesystem::path location_{};
 
+    // the directory of the epoch files and the manifest file, location_ unless metadata_location is configured
+    boost::filesystem::path metadata_location_{};
+
+    // all of the data locations, the first one is location_;
+    // the pwal files of the channels are striped across them, see create_channel()
+    std::vector<boost::filesystem::path> data_locations_{};
+
+    // NUMA nodes of the devices of data_locations_, -1 if unknown
+    std::vector<int> data_location_nodes_{};
+
+    // persistent format version of the log directory, read from the manifest file by ready();
+    // the log channels write the entries in the form of this version
+    int persistent_format_version_{1};
+
+    // compress the epoch snippets written by the log channels, if persistent_format_version_ allows
+    bool pwal_compression_{};
+
     std::atomic_uint64_t epoch_id_switched_{};
 
     std::atomic_uint64_t epoch_id_informed_{};
@@ -240,6 +318,9 @@ private:
 
     boost::filesystem::path epoch_file_path_{};
 
+    // statistics of the storages in the snapshot, collected by create_snapshot()
+    std::map<storage_id_type, storage_stats> storage_stats_{};
+
     tag_repository tag_repository_{};
 
     std::atomic_uint64_t log_channel_id_{};
@@ -249,17 +330,56 @@ private:
     //   (new/prusik) backup : target is rotated files, i.e. <files_> minus active log files
     std::set<boost::filesystem::path> files_{};
 
+    // CRC32C checksums of the files in files_, known for the files rotated by this process
+    std::map<boost::filesystem::path, std::uint32_t> file_checksums_{};
+
     std::mutex mtx_channel_{};
 
     std::mutex mtx_files_{};
 
+    // used for incremental backup, the immutable files and the epoch covered by the previous completed backup
+    std::set<boost::filesystem::path> backed_up_files_{};
+
+    std::optional<epoch_id_type> backed_up_epoch_{};
+
+    std::mutex mtx_backup_{};
+
+    // asynchronous rotation of the log files, see rotate_log_files()
+    std::mutex mtx_rotation_{};
+
+    std::size_t rotation_pending_{};
+
+    epoch_id_type rotation_epoch_{};
+
+    std::exception_ptr rotation_error_{};
+
+    std::promise<epoch_id_type> rotation_promise_{};
+
+    std::shared_future<epoch_id_type> rotation_done_{};
+
+    // state of the restore process, reported by restore_status()
+    mutable std::mutex mtx_restore_{};
+
+    mutable restore_progress::status_kind restore_kind_{restore_progress::status_kind::prepareing};
+
+    mutable status restore_result_{status::ok};
+
+    mutable std::string restore_source_{};
+
+    mutable std::atomic_uintmax_t restore_bytes_done_{};
+
+    mutable std::uintmax_t restore_bytes_total_{};
+
     int recover_max_parallelism_{};
 
+    // the threads shared by the recovery (scan and sort) and the restore, recover_max_parallelism_ of them at most
+    std::unique_ptr<internal::task_pool> task_pool_{};
+
     std::mutex mtx_epoch_file_{};
 
     state state_{};
 
-    void add_file(const boost::filesystem::path& file) noexcept;
+    void add_file(const boost::filesystem::path& file, std::optional<std::uint32_t> crc32c = std::nullopt) noexcept;
 
     // opposite of add_file
     void subtract_file(const boost::filesystem::path& file);
@@ -272,6 +392,24 @@ private:
 
     void check_before_ready(std::string_view func) const noexcept;
 
+    /**
+     * @brief copy the files to the log directory by the threads, updating the state of the restore process
+     * @param files the source files (absolute path) and the destination file names,
+     * the files with the checksum are verified while copied
+     */
+    status restore_files(const std::vector<file_set_entry>& files) const noexcept;
+
+    void start_restore(std::string_view from) const noexcept;
+
+    // remove the files in all of the data locations and the metadata location before restore
+    status purge_data_locations() const noexcept;
+
+    // the directory to restore the file, metadata_location_ for the epoch files and the manifest file,
+    // data_locations_[channel id % the number of data locations] for the pwal files of the channels
+    boost::filesystem::path restore_location_of(const boost::filesystem::path& file) const;
+
+    status finish_restore(status rc) const noexcept;
+
     /**
      * @brief create snapshot from log files stored in the location directory
      * @details file name of snapshot to be created is snapshot::file_name_ which is stored in location_ / snapshot::subdirectory_name_.
@@ -284,14 +422,42 @@ private:
 
     /**
      * @brief requests the data store to rotate log files
+     * @details the channels not in session are rotated immediately, and the others at the end of their current sessions.
+     * the epoch file is rotated after all of the channels are rotated. if a rotation is in progress, joins it.
+     * @returns the future of the rotation, which gives the epoch of it
+     */
+    std::shared_future<epoch_id_type> rotate_log_files();
+
+    /**
+     * @brief called by the channel which has done the deferred rotation
+     * @param error the exception thrown by the rotation, if failed
+     */
+    void channel_rotated(std::exception_ptr error = nullptr);
+
+    // finish the rotation if no channel remains, mtx_rotation_ must be held
+    void finish_rotation_if_done();
+
+    /**
+     * @brief list the files for the backup, after the rotation of log files
+     * @returns log_start and the entries
+     */
+    std::pair<epoch_id_type, std::vector<backup_detail::entry>> list_backup_entries(backup_type btype);
+
+    /**
+     * @brief record the files and the epoch covered by the completed backup, for the next incremental backup
      */
-    epoch_id_type rotate_log_files();
+    void complete_backup(epoch_id_type log_finish, const std::vector<backup_detail::entry>& entries);
 
     /**
      * @brief rotate epoch file
      */
     void rotate_epoch_file();
 
+    /**
+     * @brief replace the epoch file with the one which has the given durable epoch only, mtx_epoch_file_ must be held
+     */
+    void compact_epoch_file(epoch_id_type epoch);
+
     int64_t current_unix_epoch_in_millis();
 };
 
@@ -15,6 +15,8 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string_view>
 
 #include <boost/filesystem.hpp>
@@ -37,14 +39,22 @@ public:
     file_set_entry(boost::filesystem::path source_path, boost::filesystem::path destination_path, bool is_detached)
     : source_path_(std::move(source_path)), destination_path_(std::move(destination_path)), is_detached_(is_detached) {}
 
+    /**
+     * @param crc32c the checksum of the file reported by backup_detail::entry::crc32c(), verified on restore
+     */
+    file_set_entry(boost::filesystem::path source_path, boost::filesystem::path destination_path, bool is_detached, std::optional<std::uint32_t> crc32c)
+    : source_path_(std::move(source_path)), destination_path_(std::move(destination_path)), is_detached_(is_detached), crc32c_(crc32c) {}
+
     [[nodiscard]] boost::filesystem::path source_path() const { return source_path_; }
     [[nodiscard]] boost::filesystem::path destination_path() const { return destination_path_; }
     [[nodiscard]] bool is_detached() const { return is_detached_; }
+    [[nodiscard]] std::optional<std::uint32_t> crc32c() const { return crc32c_; }
 
 private:
     boost::filesystem::path source_path_ {};
     boost::filesystem::path destination_path_ {};
     bool is_detached_ {};
+    std::optional<std::uint32_t> crc32c_ {};
 };
 
 } // namespace limestone::api
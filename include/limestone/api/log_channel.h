@@ -15,11 +15,13 @@
  */
 #pragma once
 
+#include <sys/types.h>
 #include <cstdio>
 #include <string>
 #include <string_view>
 #include <cstdint>
 #include <atomic>
+#include <mutex>
 
 #include <boost/filesystem.hpp>
 
@@ -130,6 +132,20 @@ public:
      */
     [[nodiscard]] boost::filesystem::path file_path() const noexcept;
 
+    /**
+     * @returns the NUMA node which this channel is allocated on, or -1 if not specified
+     */
+    [[nodiscard]] int numa_node() const noexcept { return numa_node_; }
+
+    ~log_channel() noexcept;
+
+    log_channel(const log_channel&) = delete;
+    log_channel& operator=(const log_channel&) = delete;
+    log_channel(log_channel&&) = delete;
+    log_channel& operator=(log_channel&&) = delete;
+
+    static void operator delete(void* p, std::size_t size) noexcept;
+
 private:
     datastore& envelope_;
 
@@ -141,20 +157,107 @@ private:
 
     FILE* strm_{};
 
+    int fd_{-1};
+
+    int numa_node_{-1};
+
+    // stdio buffer of strm_, allocated on numa_node_ at the first session
+    char* buffer_{};
+
+    static constexpr std::size_t buffer_size = 128UL * 1024UL;
+
     bool registered_{};
 
+    // write the entries with checksums, by the persistent format version of the datastore
+    bool with_checksum_{};
+
+    // write the header of the epoch snippet with the length, by the persistent format version of the datastore
+    bool sized_snippet_{};
+
+    // write the entries in the compact form, by the persistent format version of the datastore
+    bool packed_entries_{};
+
+    // storage_id of the previous entry in the epoch snippet of the current session, for the compact form
+    storage_id_type previous_storage_id_{};
+
+    // compress the epoch snippet, by the configuration and the persistent format version of the datastore
+    bool compressed_snippet_{};
+
+    // the entries of the current session are written into this memory stream to be compressed at the end of the session,
+    // or into strm_ if not compressed
+    FILE* entry_strm_{};
+
+    // memory stream, and its buffer, for the entries to be compressed; reused across the sessions
+    FILE* session_strm_{};
+
+    char* session_buf_{};
+
+    std::size_t session_size_{};
+
+    std::string compressed_buf_{};
+
+    // position of the header of the epoch snippet of the current session in the file
+    off_t snippet_pos_{};
+
+    // number of the entries in the epoch snippet of the current session
+    std::uint64_t snippet_entries_{};
+
+    // guards in_session_, registered_ and the rotation request against the rotation requested by other threads
+    std::mutex mtx_rotate_{};
+
+    bool in_session_{};
+
+    // rotation requested while in session, done at the end of the session
+    bool rotate_requested_{};
+
+    epoch_id_type rotate_epoch_{};
+
+    // CRC32C checksum of the content of the current pwal file, updated as the data is written into the file
+    std::uint32_t crc32c_{};
+
+    // false until crc32c_ is computed for the file made before this process
+    bool crc32c_valid_{};
+
     write_version_type write_version_{};
 
     std::atomic_uint64_t current_epoch_id_{UINT64_MAX};
 
     std::atomic_uint64_t finished_epoch_id_{0};
 
-    log_channel(boost::filesystem::path location, std::size_t id, datastore& envelope) noexcept;
+    log_channel(boost::filesystem::path location, std::size_t id, datastore& envelope, int numa_node = -1) noexcept;
 
-    void request_rotate();
+    // channels are allocated on their NUMA nodes by datastore::create_channel(),
+    // each in its own pages so that the epoch slots read by the datastore do not share cache lines
+    static void* operator new(std::size_t size, int numa_node);
+
+    static void operator delete(void* p, int numa_node) noexcept;
+
+    /**
+     * @brief rotate the pwal file now if not in session, or at the end of the current session
+     * @returns true if rotated (or nothing to rotate) now, false if deferred;
+     * the deferred rotation is notified by datastore::channel_rotated()
+     */
+    bool request_rotate(epoch_id_type epoch);
+
+    // rotate the pwal file if it has any data
+    void rotate_file_if_not_empty(epoch_id_type epoch);
 
     void do_rotate_file(epoch_id_type epoch = 0);
 
+    // open the file and write the header of the epoch snippet, in session
+    void open_session();
+
+    // write out the epoch snippet and close the file, in session
+    void close_session();
+
+    void abandon_session() noexcept;
+
+    void leave_session(bool failed);
+
+    void write_snippet_length();
+
+    void write_compressed_snippet();
+
     friend class datastore;
 };
 
@@ -15,6 +15,10 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+
 #include <limestone/status.h>
 
 namespace limestone::api {
@@ -22,7 +26,7 @@ namespace limestone::api {
 class datastore;
 
 /**
- * @brief a tag associated with a specific epoch
+ * @brief progress of the restore process
  */
 class restore_progress {
 public:
@@ -39,6 +43,27 @@ public:
 
     restore_progress() = delete;
 
+    /**
+     * @brief returns the result of the restore process, status::ok while it is running
+     */
+    [[nodiscard]] status result() const noexcept { return status_; }
+
+    [[nodiscard]] status_kind kind() const noexcept { return comments_; }
+
+    /**
+     * @brief returns the location of the backup being restored
+     */
+    [[nodiscard]] std::string_view source() const noexcept { return source_; }
+
+    /**
+     * @brief returns the ratio of the bytes copied, from 0.0 to 1.0
+     */
+    [[nodiscard]] float progress() const noexcept { return progress_; }
+
+    [[nodiscard]] std::uintmax_t bytes_done() const noexcept { return bytes_done_; }
+
+    [[nodiscard]] std::uintmax_t bytes_total() const noexcept { return bytes_total_; }
+
 private:
     const status status_;
 
@@ -48,6 +73,15 @@ private:
 
     const float progress_;
 
+    const std::uintmax_t bytes_done_;
+
+    const std::uintmax_t bytes_total_;
+
+    restore_progress(status st, status_kind kind, std::string source, std::uintmax_t bytes_done, std::uintmax_t bytes_total) noexcept
+        : status_(st), comments_(kind), source_(std::move(source)),
+          progress_(bytes_total == 0 ? (kind == status_kind::completed ? 1.0F : 0.0F) : static_cast<float>(bytes_done) / static_cast<float>(bytes_total)),
+          bytes_done_(bytes_done), bytes_total_(bytes_total) {}
+
     friend class datastore;
 };
     
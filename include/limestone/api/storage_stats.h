@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace limestone::api {
+
+class datastore;
+
+/**
+ * @brief statistics of a storage, collected while the snapshot is created from the log files
+ */
+class storage_stats {
+public:
+    /**
+     * @brief returns the number of the entries in the snapshot (live rows)
+     */
+    [[nodiscard]] std::uint64_t entries() const noexcept { return entries_; }
+
+    /**
+     * @brief returns the total size of the keys of the entries in the snapshot
+     */
+    [[nodiscard]] std::uint64_t key_bytes() const noexcept { return key_bytes_; }
+
+    /**
+     * @brief returns the total size of the values of the entries in the snapshot
+     */
+    [[nodiscard]] std::uint64_t value_bytes() const noexcept { return value_bytes_; }
+
+    /**
+     * @brief returns the number of the keys removed at last, which are not in the snapshot
+     */
+    [[nodiscard]] std::uint64_t tombstones() const noexcept { return tombstones_; }
+
+    /**
+     * @brief returns the number of the entries in the log files overwritten or removed by the newer ones
+     */
+    [[nodiscard]] std::uint64_t superseded_versions() const noexcept { return superseded_versions_; }
+
+private:
+    std::uint64_t entries_{};
+
+    std::uint64_t key_bytes_{};
+
+    std::uint64_t value_bytes_{};
+
+    std::uint64_t tombstones_{};
+
+    std::uint64_t superseded_versions_{};
+
+    friend class datastore;
+};
+
+} // namespace limestone::api
@@ -17,23 +17,30 @@
 
 namespace limestone::api {
 
-backup::backup(std::set<boost::filesystem::path>& files) noexcept {
-    for(auto& e : files) {
-        files_.emplace_back(e);
-    }
+backup::backup(std::shared_future<epoch_id_type> ready, std::function<std::set<boost::filesystem::path>()> list_files) noexcept
+    : ready_(std::move(ready)), list_files_(std::move(list_files)) {
 }
 
 backup::~backup() noexcept = default;
 
 bool backup::is_ready() const noexcept {
-    return true;  // FIXME
+    return !ready_.valid() || ready_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
 }
 
-bool backup::wait_for_ready([[maybe_unused]] std::size_t duration) const noexcept {
-    return true;  // FIXME
+bool backup::wait_for_ready(std::size_t duration) const noexcept {
+    return !ready_.valid() || ready_.wait_for(std::chrono::milliseconds(duration)) == std::future_status::ready;
 }
 
 std::vector<boost::filesystem::path>& backup::files() noexcept {
+    if (!listed_) {
+        if (ready_.valid()) {
+            ready_.wait();
+        }
+        for (auto& e : list_files_()) {
+            files_.emplace_back(e);
+        }
+        listed_ = true;
+    }
     return files_;
 }
 
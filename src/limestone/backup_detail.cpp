@@ -21,13 +21,38 @@ namespace limestone::api {
 
 // for LOG-0
 epoch_id_type backup_detail::log_finish() const {
+    prepare();
     return log_finish_;
 }
 
-// restriction of current implementation:
-// blocks and wait for ready in construct phase; so this object returns true for is_ready
 bool backup_detail::is_ready() const {
-    return true;
+    return !rotated_.valid() || rotated_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool backup_detail::wait_for_ready(std::size_t duration) const {
+    return !rotated_.valid() || rotated_.wait_for(std::chrono::milliseconds(duration)) == std::future_status::ready;
+}
+
+void backup_detail::prepare() const {
+    if (!prepare_) {
+        return;  // made with the entries
+    }
+    std::call_once(prepared_, [this]() {
+        log_finish_ = rotated_.get();  // rethrows the error of the rotation
+        auto [log_start, entries] = prepare_(log_finish_);
+        log_start_ = log_start;
+        entries_ = std::move(entries);
+    });
+}
+
+void backup_detail::end_backup() {
+    if (!complete_) {
+        return;
+    }
+    prepare();
+    std::call_once(completed_, [this]() {
+        complete_(log_finish_, entries_);
+    });
 }
 
 backup_detail::backup_detail(std::vector<backup_detail::entry>& entries, epoch_id_type log_finish)
@@ -35,5 +60,24 @@ backup_detail::backup_detail(std::vector<backup_detail::entry>& entries, epoch_i
     configuration_id_ = "0";
 }
 
+backup_detail::backup_detail(std::vector<backup_detail::entry>& entries, epoch_id_type log_start, epoch_id_type log_finish)
+     : log_start_(log_start), log_finish_(log_finish), entries_(std::move(entries)) {
+    configuration_id_ = "0";
+}
+
+backup_detail::backup_detail(std::shared_future<epoch_id_type> rotated, prepare_function prepare)
+     : rotated_(std::move(rotated)), prepare_(std::move(prepare)) {
+    configuration_id_ = "0";
+}
+
+std::uintmax_t backup_detail::total_size() const {
+    prepare();
+    std::uintmax_t total = 0;
+    for (const auto& e : entries_) {
+        total += e.size();
+    }
+    return total;
+}
+
 
 } // namespace limestone::api
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/filesystem/fstream.hpp>
+#include <nlohmann/json.hpp>
+
+#include <glog/logging.h>
+#include <limestone/logging.h>
+#include "logging_helper.h"
+
+#include "compaction_catalog.h"
+
+namespace limestone::internal {
+
+compaction_catalog compaction_catalog::from_dir(const boost::filesystem::path& dir) {
+    compaction_catalog catalog{};
+    boost::filesystem::path catalog_path = dir / std::string(file_name);
+    if (!boost::filesystem::exists(catalog_path)) {
+        // made by older version, or never compacted
+        boost::filesystem::path base_path = dir / std::string(base_file_name);
+        if (boost::filesystem::exists(base_path)) {
+            generation gen{};
+            gen.id = 0;
+            gen.files.emplace_back(base_file_name);
+            gen.rewound = true;  // older version always rewinds
+            gen.size = boost::filesystem::file_size(base_path);
+            catalog.generations_.emplace_back(std::move(gen));
+        }
+        return catalog;
+    }
+    boost::filesystem::ifstream istrm(catalog_path);
+    if (!istrm) {
+        LOG_LP(ERROR) << "cannot read compaction catalog file: " << catalog_path;
+        throw std::runtime_error("cannot read compaction catalog file");
+    }
+    try {
+        nlohmann::json json;
+        istrm >> json;
+        catalog.next_id_ = json.at("next_id").get<std::uint64_t>();
+        for (const auto& g : json.at("generations")) {
+            generation gen{};
+            gen.id = g.at("id").get<std::uint64_t>();
+            gen.level = g.at("level").get<int>();
+            gen.files = g.at("files").get<std::vector<std::string>>();
+            gen.min_epoch = g.at("min_epoch").get<epoch_id_type>();
+            gen.max_epoch = g.at("max_epoch").get<epoch_id_type>();
+            gen.entries = g.at("entries").get<std::uint64_t>();
+            gen.tombstones = g.at("tombstones").get<std::uint64_t>();
+            gen.rewound = g.at("write_versions").get<std::string>() == "rewound";
+            gen.size = g.at("size").get<std::uintmax_t>();
+            gen.sources = g.at("sources").get<std::vector<std::string>>();
+            catalog.generations_.emplace_back(std::move(gen));
+        }
+    } catch (nlohmann::json::exception& e) {
+        LOG_LP(ERROR) << "compaction catalog file is broken: " << catalog_path << ", " << e.what();
+        throw std::runtime_error("compaction catalog file is broken");
+    }
+    return catalog;
+}
+
+void compaction_catalog::write(const boost::filesystem::path& dir) const {
+    nlohmann::json gens = nlohmann::json::array();
+    for (const auto& gen : generations_) {
+        gens.push_back({
+            { "id", gen.id },
+            { "level", gen.level },
+            { "files", gen.files },
+            { "min_epoch", gen.min_epoch },
+            { "max_epoch", gen.max_epoch },
+            { "entries", gen.entries },
+            { "tombstones", gen.tombstones },
+            { "write_versions", gen.rewound ? "rewound" : "preserved" },
+            { "size", gen.size },
+            { "sources", gen.sources },
+        });
+    }
+    nlohmann::json json = {
+        { "format_version", "1.0" },
+        { "next_id", next_id_ },
+        { "generations", gens },
+    };
+    boost::filesystem::path catalog_path = dir / std::string(file_name);
+    boost::filesystem::path tmp_path = dir / (std::string(file_name) + ".tmp");
+    FILE* strm = fopen(tmp_path.c_str(), "w");  // NOLINT(*-owning-memory)
+    if (!strm) {
+        LOG_LP(ERROR) << "fopen for write failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    std::string json_str = json.dump(4);
+    auto ret = fwrite(json_str.c_str(), json_str.length(), 1, strm);
+    if (ret != 1) {
+        LOG_LP(ERROR) << "fwrite failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    if (fflush(strm) != 0) {
+        LOG_LP(ERROR) << "fflush failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    if (fsync(fileno(strm)) != 0) {
+        LOG_LP(ERROR) << "fsync failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
+        LOG_LP(ERROR) << "fclose failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    boost::filesystem::rename(tmp_path, catalog_path);
+}
+
+bool compaction_catalog::contains(std::string_view filename) const noexcept {
+    return std::any_of(generations_.begin(), generations_.end(), [&filename](const generation& gen){
+        return std::find(gen.files.begin(), gen.files.end(), filename) != gen.files.end();
+    });
+}
+
+compaction_catalog::generation& compaction_catalog::add_generation(generation gen, std::size_t segments) {
+    if (gen.files.empty()) {
+        gen.id = next_id_++;
+        for (std::size_t i = 0; i < segments; i++) {
+            gen.files.emplace_back(file_name_of(gen.id, i));
+        }
+    } else if (gen.id >= next_id_) {
+        next_id_ = gen.id + 1;
+    }
+    return generations_.emplace_back(std::move(gen));
+}
+
+void compaction_catalog::remove_generation(std::uint64_t id) {
+    generations_.erase(std::remove_if(generations_.begin(), generations_.end(), [id](const generation& gen){ return gen.id == id; }),
+                       generations_.end());
+}
+
+std::string compaction_catalog::file_name_of(std::uint64_t id, std::size_t segment) {
+    // segment n is named like the pwal file of channel n: pwal_0000.compacted, pwal_0001.compacted, ...
+    std::ostringstream ss;
+    ss << "pwal_" << std::setw(4) << std::setfill('0') << segment << ".compacted";
+    if (id != 0) {
+        ss << "." << id;
+    }
+    return ss.str();
+}
+
+int compaction_catalog::level_for_size(std::uintmax_t size, std::uintmax_t base_size, std::size_t fanout) noexcept {
+    int level = 0;
+    for (std::uintmax_t limit = base_size; size >= limit && fanout > 1; limit *= fanout) {
+        level++;
+    }
+    return level;
+}
+
+}
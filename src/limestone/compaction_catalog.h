@@ -0,0 +1,107 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <limestone/api/epoch_id_type.h>
+
+namespace limestone::internal {
+using namespace limestone::api;
+
+/**
+ * @brief the list of compacted pwal files (generations) in a dblogdir
+ * @details each generation is made by one compaction run, from pwal files not yet compacted (delta)
+ * or from other generations (merge). the catalog records which files and epochs each generation covers,
+ * so the next compaction can read only the delta and the generations to be merged.
+ */
+class compaction_catalog {
+public:
+    /**
+     * @brief name of the catalog file
+     */
+    static constexpr const std::string_view file_name = "limestone-compaction-catalog.json";
+
+    /**
+     * @brief name of the (first) compacted pwal file made by the full compaction (generation 0)
+     */
+    static constexpr const std::string_view base_file_name = "pwal_0000.compacted";
+
+    /**
+     * @brief default size limit of level-0 generations for leveled compaction
+     */
+    static constexpr std::uintmax_t default_level_base_size = 64UL * 1024UL * 1024UL;
+
+    /**
+     * @brief information of a compacted pwal file
+     */
+    struct generation {
+        std::uint64_t id{};
+        int level{};
+        std::vector<std::string> files{};  // compacted pwal files (segments), the key spaces of them are disjoint
+        epoch_id_type min_epoch{};  // minimum write version (major) in the file
+        epoch_id_type max_epoch{};  // maximum write version (major) in the file
+        std::uint64_t entries{};
+        std::uint64_t tombstones{};  // remove entries, included in entries
+        bool rewound{};  // write versions of the entries are cleared, and the epoch snippet is of epoch 0
+        std::uintmax_t size{};
+        std::vector<std::string> sources{};  // files compacted into this generation
+    };
+
+    /**
+     * @brief load the catalog in the directory
+     * @details if the directory has no catalog file but has the file made by the full compaction of
+     * older version, returns the catalog containing only that file.
+     * @throws std::runtime_error if the catalog file is broken
+     */
+    static compaction_catalog from_dir(const boost::filesystem::path& dir);
+
+    /**
+     * @brief write the catalog file to the directory, by replacing the old one atomically
+     */
+    void write(const boost::filesystem::path& dir) const;
+
+    [[nodiscard]] const std::vector<generation>& generations() const noexcept { return generations_; }
+    [[nodiscard]] bool contains(std::string_view filename) const noexcept;
+
+    /**
+     * @brief register new generation; if the files are not set, the id and the names of the segments are assigned
+     */
+    generation& add_generation(generation gen, std::size_t segments = 1);
+    void remove_generation(std::uint64_t id);
+
+    /**
+     * @returns the name of the compacted file for the generation id and the segment number
+     */
+    static std::string file_name_of(std::uint64_t id, std::size_t segment = 0);
+
+    /**
+     * @returns the level of the generation of the size
+     * @note level is 0 for the files smaller than base_size, and grows by one for every multiplication by fanout
+     */
+    static int level_for_size(std::uintmax_t size, std::uintmax_t base_size, std::size_t fanout) noexcept;
+
+private:
+    std::vector<generation> generations_{};
+    std::uint64_t next_id_{1};
+};
+
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include <boost/filesystem.hpp>
+
+#include "compaction_catalog.h"
+#include "persistent_format.h"
+
+namespace limestone::internal {
+
+/**
+ * @brief progress of a compaction phase, reported to compaction_options::report_progress
+ */
+struct compaction_progress {
+    enum class phase {
+        scan,   // reading pwal files into the sort databases
+        write,  // writing compacted pwal files from the sort databases
+    };
+    phase current{};
+    std::size_t done{};      // number of pwal files scanned, or compacted pwal files written
+    std::size_t total{};
+    std::uintmax_t bytes{};  // bytes read from pwal files, or written to compacted pwal files
+    std::chrono::steady_clock::duration elapsed{};  // since the phase started
+};
+
+/**
+ * @brief options of compaction
+ */
+struct compaction_options {
+    /**
+     * @brief number of threads scanning pwal files, and writing compacted pwal files
+     * @details the threads are shared by the phases and the levels of one compaction call.
+     */
+    int num_worker{1};
+
+    /**
+     * @brief number of compacted pwal files (segments) made by one compaction
+     * @details the key space is partitioned into this number of sort databases,
+     * each of them is written into its own segment as soon as the scan finishes.
+     */
+    std::size_t num_segments{1};
+
+    /**
+     * @brief upper limit of the temporary space used by the compaction in bytes, 0 means unlimited
+     * @details the space is estimated by the size of the entries held in the sort databases, i.e. the latest version
+     * of each key (every version with SORT_METHOD_PUT_ONLY), and is released as each sort database is written out.
+     * the compacted pwal files are the result of the compaction, and do not count toward the limit.
+     */
+    std::uintmax_t temp_space_limit{0};
+
+    /**
+     * @brief keep the original write versions of the entries even if no older data remains
+     * @details by default, the write versions are cleared (rewound to epoch 0) when compacting into the oldest data.
+     * the compacted pwal files made with this option keep the epochs of the entries, so that they can be
+     * used for point-in-time recovery, and be merged with newer pwal files by comparing the write versions.
+     */
+    bool preserve_write_versions{false};
+
+    /**
+     * @brief persistent format version of the compacted pwal files
+     * @details must not be newer than the version of the log directory in which the compacted pwal files are placed.
+     */
+    int persistent_format_version{latest_persistent_format_version};
+
+    /**
+     * @brief directory of the epoch files, if not placed with the pwal files (metadata_location)
+     */
+    boost::filesystem::path epoch_dir{};
+
+    /**
+     * @brief how to handle remove entries (tombstones)
+     */
+    enum class tombstone_mode {
+        automatic,  // keep them while older generations may contain the keys, drop them at the oldest generation
+        retain,     // always keep them, e.g. for merging the compacted files with older data later
+    };
+    tombstone_mode tombstones{tombstone_mode::automatic};
+
+    /**
+     * @brief called after each pwal file is scanned and each segment is written, if set
+     * @note called from worker threads, but never concurrently
+     */
+    std::function<void(const compaction_progress&)> report_progress{};
+};
+
+/**
+ * @brief result of compaction
+ */
+struct compaction_result {
+    compaction_catalog catalog{};  // generations made by the compaction
+    std::uint64_t tombstones_retained{};  // remove entries in the compacted pwal files
+    std::uint64_t tombstones_dropped{};   // remove entries dropped by the compaction
+};
+
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include <glog/logging.h>
+#include <limestone/logging.h>
+#include "logging_helper.h"
+
+#include "compression.h"
+
+namespace limestone::internal {
+
+void compress_block(std::string_view data, std::string& out) {
+    uLongf size = compressBound(data.size());
+    out.resize(size);
+    int rc = compress2(reinterpret_cast<Bytef*>(out.data()), &size,  // NOLINT(*-reinterpret-cast)
+                       reinterpret_cast<const Bytef*>(data.data()), data.size(), Z_BEST_SPEED);  // NOLINT(*-reinterpret-cast)
+    if (rc != Z_OK) {
+        LOG_LP(ERROR) << "compress2 failed, rc = " << rc;
+        throw std::runtime_error("compression error");
+    }
+    out.resize(size);
+}
+
+bool decompress_block(std::string_view block, std::size_t size, std::string& out) {
+    out.resize(size);
+    uLongf out_size = size;
+    int rc = uncompress(reinterpret_cast<Bytef*>(out.data()), &out_size,  // NOLINT(*-reinterpret-cast)
+                        reinterpret_cast<const Bytef*>(block.data()), block.size());  // NOLINT(*-reinterpret-cast)
+    return rc == Z_OK && out_size == size;
+}
+
+}
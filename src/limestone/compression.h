@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace limestone::internal {
+
+/**
+ * @brief compress the data into one block (deflate, zlib format), with the fastest level
+ * @param data the data to be compressed
+ * @param out the buffer to store the compressed block, resized to the size of the block
+ * @throws std::runtime_error if the compression fails
+ */
+void compress_block(std::string_view data, std::string& out);
+
+/**
+ * @brief decompress the block made by compress_block()
+ * @param block the compressed block
+ * @param size the size of the data before compressed
+ * @param out the buffer to store the data, resized to size
+ * @returns false if the block is broken, or its content is not of the size
+ */
+bool decompress_block(std::string_view block, std::size_t size, std::string& out);
+
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include <glog/logging.h>
+#include <limestone/logging.h>
+#include "logging_helper.h"
+
+#include "crc32c.h"
+
+namespace limestone::internal {
+
+// reflected polynomial of CRC32C
+static constexpr std::uint32_t crc32c_polynomial = 0x82F63B78U;
+
+static constexpr std::array<std::uint32_t, 256> make_crc32c_table() {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; i++) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1U) != 0 ? (c >> 1U) ^ crc32c_polynomial : c >> 1U;
+        }
+        table.at(i) = c;
+    }
+    return table;
+}
+
+static constexpr std::array<std::uint32_t, 256> crc32c_table = make_crc32c_table();
+
+std::uint32_t crc32c_extend_portable(std::uint32_t crc, const void* data, std::size_t size) noexcept {
+    const auto* p = static_cast<const unsigned char*>(data);
+    std::uint32_t c = ~crc;
+    for (std::size_t i = 0; i < size; i++) {
+        c = crc32c_table.at((c ^ p[i]) & 0xffU) ^ (c >> 8U);  // NOLINT(*-pointer-arithmetic)
+    }
+    return ~c;
+}
+
+// a * b modulo the polynomial, in the reflected bit order
+static constexpr std::uint32_t multiply_mod_polynomial(std::uint32_t a, std::uint32_t b) noexcept {
+    std::uint32_t m = 1U << 31U;
+    std::uint32_t p = 0;
+    while (m != 0) {
+        if ((a & m) != 0) {
+            p ^= b;
+        }
+        m >>= 1U;
+        b = (b & 1U) != 0 ? (b >> 1U) ^ crc32c_polynomial : b >> 1U;
+    }
+    return p;
+}
+
+// x^(8 * n) modulo the polynomial, by multiplying x^(2^k) for each bit of 8 * n
+static constexpr std::uint32_t x8n_mod_polynomial(std::uint64_t n) noexcept {
+    std::uint32_t p = 1U << 31U;  // x^0
+    std::uint32_t x2k = 1U << 23U;  // x^8
+    for (; n != 0; n >>= 1U) {
+        if ((n & 1U) != 0) {
+            p = multiply_mod_polynomial(x2k, p);
+        }
+        x2k = multiply_mod_polynomial(x2k, x2k);
+    }
+    return p;
+}
+
+#if defined(__x86_64__)
+// the data of 3 * crc32c_stripe bytes or more is checksummed in three independent streams of the crc32 instruction,
+// which has the latency of three cycles but the throughput of one per cycle, and the results are combined by
+// shifting the checksums of the preceding streams over the following ones
+static constexpr std::size_t crc32c_stripe = 128;
+
+// the multiplication by x^(8 * crc32c_stripe) modulo the polynomial, for each byte of the multiplicand
+static constexpr std::array<std::array<std::uint32_t, 256>, 4> make_crc32c_shift_table() {
+    std::array<std::array<std::uint32_t, 256>, 4> table{};
+    const std::uint32_t x8n = x8n_mod_polynomial(crc32c_stripe);
+    for (std::uint32_t k = 0; k < 4; k++) {
+        for (std::uint32_t i = 0; i < 256; i++) {
+            table.at(k).at(i) = multiply_mod_polynomial(x8n, i << (8U * k));
+        }
+    }
+    return table;
+}
+
+static constexpr std::array<std::array<std::uint32_t, 256>, 4> crc32c_shift_table = make_crc32c_shift_table();
+
+// the checksum register after crc32c_stripe zero bytes are processed from c
+static std::uint32_t crc32c_shift_stripe(std::uint32_t c) noexcept {
+    return crc32c_shift_table.at(0).at(c & 0xffU) ^ crc32c_shift_table.at(1).at((c >> 8U) & 0xffU)
+        ^ crc32c_shift_table.at(2).at((c >> 16U) & 0xffU) ^ crc32c_shift_table.at(3).at(c >> 24U);
+}
+
+__attribute__((target("sse4.2")))
+static std::uint32_t crc32c_extend_sse42(std::uint32_t crc, const void* data, std::size_t size) noexcept {
+    const auto* p = static_cast<const unsigned char*>(data);
+    std::uint64_t c = ~crc;
+    for (; size >= 3 * crc32c_stripe; size -= 3 * crc32c_stripe, p += 3 * crc32c_stripe) {  // NOLINT(*-pointer-arithmetic)
+        std::uint64_t c1 = 0;
+        std::uint64_t c2 = 0;
+        for (std::size_t i = 0; i < crc32c_stripe; i += sizeof(std::uint64_t)) {
+            std::uint64_t v0{};
+            std::uint64_t v1{};
+            std::uint64_t v2{};
+            std::memcpy(&v0, p + i, sizeof(v0));  // NOLINT(*-pointer-arithmetic)
+            std::memcpy(&v1, p + crc32c_stripe + i, sizeof(v1));  // NOLINT(*-pointer-arithmetic)
+            std::memcpy(&v2, p + 2 * crc32c_stripe + i, sizeof(v2));  // NOLINT(*-pointer-arithmetic)
+            c = _mm_crc32_u64(c, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+        c = crc32c_shift_stripe(crc32c_shift_stripe(static_cast<std::uint32_t>(c)) ^ static_cast<std::uint32_t>(c1)) ^ static_cast<std::uint32_t>(c2);
+    }
+    for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), p += sizeof(std::uint64_t)) {  // NOLINT(*-pointer-arithmetic)
+        std::uint64_t v{};
+        std::memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    auto c32 = static_cast<std::uint32_t>(c);
+    for (; size > 0; size--, p++) {  // NOLINT(*-pointer-arithmetic)
+        c32 = _mm_crc32_u8(c32, *p);
+    }
+    return ~c32;
+}
+#endif
+
+std::uint32_t crc32c_extend(std::uint32_t crc, const void* data, std::size_t size) noexcept {
+#if defined(__x86_64__)
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) {
+        return crc32c_extend_sse42(crc, data, size);
+    }
+#endif
+    return crc32c_extend_portable(crc, data, size);
+}
+
+std::uint32_t crc32c_overwrite(std::uint32_t crc, std::uint64_t size, std::uint64_t offset,
+                               const void* old_bytes, const void* new_bytes, std::size_t len) noexcept {
+    // CRC is linear for the data of the same length: crc(a) ^ crc(b) equals to the CRC of (a ^ b) without
+    // the initial and final inversion, and the CRC of the difference followed by zeros is computed by multiplying x^(8 * zeros)
+    const auto* o = static_cast<const unsigned char*>(old_bytes);
+    const auto* n = static_cast<const unsigned char*>(new_bytes);
+    std::uint32_t c = 0;
+    for (std::size_t i = 0; i < len; i++) {
+        c = crc32c_table.at((c ^ o[i] ^ n[i]) & 0xffU) ^ (c >> 8U);  // NOLINT(*-pointer-arithmetic)
+    }
+    return crc ^ multiply_mod_polynomial(x8n_mod_polynomial(size - offset - len), c);
+}
+
+std::uint32_t crc32c_of_file(const boost::filesystem::path& file) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);  // NOLINT(*-vararg)
+    if (fd < 0) {
+        LOG_LP(ERROR) << "cannot open " << file << ", errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    std::vector<char> buffer(1024UL * 1024UL);
+    std::uint32_t crc = 0;
+    while (true) {
+        ssize_t r = ::read(fd, buffer.data(), buffer.size());
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_LP(ERROR) << "cannot read " << file << ", errno = " << errno;
+            ::close(fd);
+            throw std::runtime_error("I/O error");
+        }
+        if (r == 0) {
+            break;
+        }
+        crc = crc32c_extend(crc, buffer.data(), r);
+    }
+    ::close(fd);
+    return crc;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+
+namespace limestone::internal {
+
+/**
+ * @brief extend the CRC32C (Castagnoli) checksum of preceding data with the following data
+ * @details crc32c_extend(crc32c_extend(0, a), b) equals to the checksum of a followed by b.
+ * uses the SSE4.2 crc32 instruction if the CPU supports it.
+ */
+std::uint32_t crc32c_extend(std::uint32_t crc, const void* data, std::size_t size) noexcept;
+
+/**
+ * @brief crc32c_extend() by table lookup, without the CPU instruction; for tests
+ */
+std::uint32_t crc32c_extend_portable(std::uint32_t crc, const void* data, std::size_t size) noexcept;
+
+inline std::uint32_t crc32c(const void* data, std::size_t size) noexcept {
+    return crc32c_extend(0, data, size);
+}
+
+/**
+ * @brief update the CRC32C checksum of data, for some bytes of the data overwritten
+ * @param crc the checksum of the data before overwritten
+ * @param size the size of the whole data
+ * @param offset the position of the overwritten bytes in the data
+ * @param old_bytes the bytes before overwritten
+ * @param new_bytes the bytes after overwritten
+ * @param len the number of the overwritten bytes
+ * @returns the checksum of the data after overwritten, computed without reading the rest of the data
+ */
+std::uint32_t crc32c_overwrite(std::uint32_t crc, std::uint64_t size, std::uint64_t offset,
+                               const void* old_bytes, const void* new_bytes, std::size_t len) noexcept;
+
+/**
+ * @returns CRC32C checksum of the whole content of the file
+ * @throws std::runtime_error if the file cannot be read
+ */
+std::uint32_t crc32c_of_file(const boost::filesystem::path& file);
+
+}
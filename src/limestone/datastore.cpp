@@ -13,6 +13,9 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 #include <thread>
 #include <chrono>
 #include <iomanip>
@@ -25,49 +28,83 @@
 #include "logging_helper.h"
 
 #include <limestone/api/datastore.h>
+#include "crc32c.h"
+#include "dblog_scan.h"
 #include "internal.h"
 #include "log_entry.h"
+#include "numa.h"
+#include "task_pool.h"
 
 namespace limestone::api {
 
 datastore::datastore() noexcept = default;
 
-datastore::datastore(configuration const& conf) : location_(conf.data_locations_.at(0)) {
+datastore::datastore(configuration const& conf) : location_(conf.data_locations_.at(0)), metadata_location_(location_) {
     LOG(INFO) << "/:limestone:config:datastore setting log location = " << location_.string();
     boost::system::error_code error;
     const bool result_check = boost::filesystem::exists(location_, error);
-    boost::filesystem::path manifest_path = boost::filesystem::path(location_) / std::string(internal::manifest_file_name);
     if (!result_check || error) {
         const bool result_mkdir = boost::filesystem::create_directory(location_, error);
         if (!result_mkdir || error) {
             LOG_LP(ERROR) << "fail to create directory: result_mkdir: " << result_mkdir << ", error_code: " << error << ", path: " << location_;
             throw std::runtime_error("fail to create the log_location directory");
         }
-        internal::setup_initial_logdir(location_);
-        add_file(manifest_path);
-    } else {
-        int count = 0;
-        // use existing log-dir
-        for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(location_)) {
+    }
+
+    // the epoch files and the manifest file are placed on metadata_location if specified,
+    // except for the log directory made by older version, which has them with the pwal files
+    if (const auto& metadata_location = conf.metadata_location_;
+        !metadata_location.empty() && !boost::filesystem::equivalent(metadata_location, location_, error)) {
+        if (boost::filesystem::exists(location_ / std::string(internal::manifest_file_name))
+            && !boost::filesystem::exists(metadata_location / std::string(internal::manifest_file_name))) {
+            LOG(INFO) << "/:limestone:config:datastore metadata files exist in the log location, metadata location is not used";
+        } else {
+            boost::filesystem::create_directories(metadata_location, error);
+            if (error) {
+                LOG_LP(ERROR) << "fail to create directory: " << metadata_location << ", " << error.message();
+                throw std::runtime_error("fail to create the metadata_location directory");
+            }
+            metadata_location_ = metadata_location;
+        }
+    }
+    LOG(INFO) << "/:limestone:config:datastore setting metadata location = " << metadata_location_.string();
+
+    // the epoch file may be left being rewritten by the crash, the main one is still valid
+    boost::filesystem::remove(metadata_location_ / std::string(epoch_tmp_file_name), error);
+
+    // use existing log-dir
+    int count = 0;
+    std::vector<boost::filesystem::path> dirs{location_};
+    if (metadata_location_ != location_) {
+        dirs.emplace_back(metadata_location_);
+    }
+    for (const auto& dir : dirs) {
+        for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(dir)) {
             if (!boost::filesystem::is_directory(p)) {
                 count++;
                 add_file(p);
             }
         }
-        if (count == 0) {
-            internal::setup_initial_logdir(location_);
-            add_file(manifest_path);
+    }
+    if (count == 0) {
+        int version = conf.persistent_format_version_;
+        if (version < internal::oldest_persistent_format_version || internal::latest_persistent_format_version < version) {
+            LOG_LP(ERROR) << "unsupported persistent format version: " << version;
+            throw std::runtime_error("unsupported persistent format version");
         }
+        LOG(INFO) << "/:limestone:config:datastore setting persistent format version of new log directory = " << version;
+        internal::setup_initial_logdir(metadata_location_, version);
+        add_file(metadata_location_ / std::string(internal::manifest_file_name));
     }
 
     // XXX: prusik era
     // TODO: read rotated epoch files if main epoch file does not exist
-    epoch_file_path_ = location_ / boost::filesystem::path(std::string(epoch_file_name));
+    epoch_file_path_ = metadata_location_ / boost::filesystem::path(std::string(epoch_file_name));
     const bool result = boost::filesystem::exists(epoch_file_path_, error);
     if (!result || error) {
         FILE* strm = fopen(epoch_file_path_.c_str(), "a");  // NOLINT(*-owning-memory)
         if (!strm) {
-            LOG_LP(ERROR) << "does not have write permission for the log_location directory, path: " <<  location_;
+            LOG_LP(ERROR) << "does not have write permission for the log_location directory, path: " <<  metadata_location_;
             throw std::runtime_error("does not have write permission for the log_location directory");
         }
         if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
@@ -77,8 +114,32 @@ datastore::datastore(configuration const& conf) : location_(conf.data_locations_
         add_file(epoch_file_path_);
     }
 
+    // the other data locations have only pwal files
+    data_locations_ = conf.data_locations_;
+    for (std::size_t i = 1; i < data_locations_.size(); i++) {
+        const auto& dir = data_locations_.at(i);
+        boost::filesystem::create_directories(dir, error);
+        if (error) {
+            LOG_LP(ERROR) << "fail to create directory: " << dir << ", " << error.message();
+            throw std::runtime_error("fail to create the data location directory");
+        }
+        for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(dir)) {
+            if (internal::dblog_scan::is_wal(p)) {
+                add_file(p);
+            }
+        }
+        LOG(INFO) << "/:limestone:config:datastore setting additional log location = " << dir.string();
+    }
+    for (const auto& dir : data_locations_) {
+        data_location_nodes_.emplace_back(internal::numa_node_of_path(dir));
+    }
+
     recover_max_parallelism_ = conf.recover_max_parallelism_;
     LOG(INFO) << "/:limestone:config:datastore setting the number of recover process thread = " << recover_max_parallelism_;
+    task_pool_ = std::make_unique<internal::task_pool>(static_cast<std::size_t>(std::max(recover_max_parallelism_, 1)));
+
+    pwal_compression_ = conf.pwal_compression_;
+    LOG(INFO) << "/:limestone:config:datastore setting pwal compression = " << (pwal_compression_ ? "on" : "off");
 
     VLOG_LP(log_debug) << "datastore is created, location = " << location_.string();
 }
@@ -90,7 +151,7 @@ void datastore::recover() const noexcept {
 }
 
 void datastore::ready() {
-    internal::check_logdir_format(location_);
+    persistent_format_version_ = internal::check_logdir_format(metadata_location_);
     create_snapshot();
     state_ = state::ready;
 }
@@ -105,13 +166,46 @@ std::shared_ptr<snapshot> datastore::shared_snapshot() const {
     return std::shared_ptr<snapshot>(new snapshot(location_));
 }
 
+const std::map<storage_id_type, storage_stats>& datastore::storage_statistics() const noexcept {
+    check_after_ready(static_cast<const char*>(__func__));
+    return storage_stats_;
+}
+
 log_channel& datastore::create_channel(const boost::filesystem::path& location) {
+    return create_channel(location, internal::numa_node_of_current_cpu());
+}
+
+log_channel& datastore::create_channel(const boost::filesystem::path& location, int numa_node) {
     check_before_ready(static_cast<const char*>(__func__));
     
     std::lock_guard<std::mutex> lock(mtx_channel_);
     
     auto id = log_channel_id_.fetch_add(1);
-    log_channels_.emplace_back(std::unique_ptr<log_channel>(new log_channel(location, id, *this)));  // constructor of log_channel is private
+    boost::filesystem::path channel_location = location;
+    if (data_locations_.size() > 1 && location == location_) {
+        // the least loaded data location by the number of channels, among the ones on the same NUMA node if any
+        bool node_matched = numa_node >= 0
+            && std::find(data_location_nodes_.begin(), data_location_nodes_.end(), numa_node) != data_location_nodes_.end();
+        std::vector<std::size_t> channels(data_locations_.size());
+        for (const auto& lc : log_channels_) {
+            auto it = std::find(data_locations_.begin(), data_locations_.end(), lc->location_);
+            if (it != data_locations_.end()) {
+                channels.at(it - data_locations_.begin())++;
+            }
+        }
+        std::size_t selected = data_locations_.size();
+        for (std::size_t i = 0; i < data_locations_.size(); i++) {
+            if (node_matched && data_location_nodes_.at(i) != numa_node) {
+                continue;
+            }
+            if (selected == data_locations_.size() || channels.at(i) < channels.at(selected)) {
+                selected = i;
+            }
+        }
+        channel_location = data_locations_.at(selected);
+    }
+    // constructor of log_channel is private
+    log_channels_.emplace_back(std::unique_ptr<log_channel>(new (numa_node) log_channel(channel_location, id, *this, numa_node)));
     return *log_channels_.at(id);
 }
 
@@ -162,7 +256,8 @@ void datastore::update_min_epoch_id(bool from_switch_epoch) {  // NOLINT(readabi
                 LOG_LP(ERROR) << "fopen failed, errno = " << errno;
                 throw std::runtime_error("I/O error");
             }
-            log_entry::durable_epoch(strm, static_cast<epoch_id_type>(epoch_id_recorded_.load()));
+            auto epoch = static_cast<epoch_id_type>(epoch_id_recorded_.load());
+            log_entry::durable_epoch(strm, epoch);
             if (fflush(strm) != 0) {
                 LOG_LP(ERROR) << "fflush failed, errno = " << errno;
                 throw std::runtime_error("I/O error");
@@ -171,10 +266,14 @@ void datastore::update_min_epoch_id(bool from_switch_epoch) {  // NOLINT(readabi
                 LOG_LP(ERROR) << "fsync failed, errno = " << errno;
                 throw std::runtime_error("I/O error");
             }
+            auto size = ftell(strm);
             if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
                 LOG_LP(ERROR) << "fclose failed, errno = " << errno;
                 throw std::runtime_error("I/O error");
             }
+            if (size >= static_cast<long>(epoch_file_compaction_threshold)) {
+                compact_epoch_file(epoch);
+            }
             break;
         }
     }
@@ -220,27 +319,83 @@ std::future<void> datastore::shutdown() noexcept {
 
 // old interface
 backup& datastore::begin_backup() {
-    backup_ = std::unique_ptr<backup>(new backup(files_));
+    // the files are listed when the rotation in progress, if any, finishes
+    std::shared_future<epoch_id_type> rotating{};
+    {
+        std::lock_guard<std::mutex> lock(mtx_rotation_);
+        if (rotation_pending_ > 0) {
+            rotating = rotation_done_;
+        }
+    }
+    backup_ = std::unique_ptr<backup>(new backup(rotating, [this]() {
+        std::lock_guard<std::mutex> lock(mtx_files_);
+        return files_;
+    }));
     return *backup_;
 }
 
-std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {  // NOLINT(readability-function-cognitive-complexity)
-    rotate_log_files();
-
-    // LOG-0: all files are log file, so all files are selected in both standard/transaction mode.
-    (void) btype;
+std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {
+    auto rotated = rotate_log_files();
+    auto detail = std::unique_ptr<backup_detail>(new backup_detail(rotated, [this, btype](epoch_id_type) {
+        return list_backup_entries(btype);
+    }));
+    detail->complete_ = [this](epoch_id_type log_finish, const std::vector<backup_detail::entry>& entries) {
+        complete_backup(log_finish, entries);
+    };
+    return detail;
+}
 
+std::pair<epoch_id_type, std::vector<backup_detail::entry>> datastore::list_backup_entries(backup_type btype) {  // NOLINT(readability-function-cognitive-complexity)
     // calcuate files_ minus active-files
-    std::set<boost::filesystem::path> inactive_files(files_);
+    std::set<boost::filesystem::path> inactive_files;
+    std::map<boost::filesystem::path, std::uint32_t> checksums;
+    {
+        std::lock_guard<std::mutex> lock(mtx_files_);
+        inactive_files = files_;
+        checksums = file_checksums_;
+    }
     inactive_files.erase(epoch_file_path_);
     for (const auto& lc : log_channels_) {
+        std::lock_guard<std::mutex> lock(lc->mtx_rotate_);
         if (lc->registered_) {
             inactive_files.erase(lc->file_path());
         }
     }
 
+    // LOG-0: all files are log file, so standard backup selects all files.
+    // transaction backup selects the files not included in the previous backup (incremental backup),
+    // except for mutable files which are always selected.
+    std::lock_guard<std::mutex> backup_lock(mtx_backup_);
+    bool incremental = btype == backup_type::transaction && backed_up_epoch_.has_value();
+    epoch_id_type log_start = incremental ? backed_up_epoch_.value() + 1 : 0;
+
+    // the last rotated epoch file is the one made by the rotation for this backup
+    boost::filesystem::path last_epoch_file{};
+    for (const auto& ent : inactive_files) {
+        auto filename = ent.filename().string();
+        if (filename.rfind("epoch.", 0) == 0 && (last_epoch_file.empty() || last_epoch_file.filename().string() < filename)) {
+            last_epoch_file = ent;
+        }
+    }
+
     // build entries
     std::vector<backup_detail::entry> entries;
+    auto add_entry = [&entries, &checksums, incremental, this](const boost::filesystem::path& ent, const std::string& dst, bool is_mutable, bool is_detached) {
+        if (incremental && !is_mutable && backed_up_files_.count(ent) > 0) {
+            return;  // included in the previous backup
+        }
+        boost::system::error_code error;
+        std::uintmax_t size = boost::filesystem::file_size(ent, error);
+        if (error) {
+            LOG_LP(ERROR) << "cannot get the size of " << ent << ": " << error.message();
+            throw std::runtime_error("I/O error");
+        }
+        std::optional<std::uint32_t> crc32c{};
+        if (auto it = checksums.find(ent); it != checksums.end() && !is_mutable) {
+            crc32c = it->second;
+        }
+        entries.emplace_back(ent.string(), dst, is_mutable, is_detached, size, crc32c);
+    };
     for (auto & ent : inactive_files) {
         // LOG-0: assume files are located flat in logdir.
         auto filename = ent.filename().string();
@@ -262,7 +417,7 @@ std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {  //
                         }
                         continue;
                     }
-                    entries.emplace_back(ent.string(), dst, false, false);
+                    add_entry(ent, dst, false, true);
                 } else {
                     // unknown type
                 }
@@ -278,8 +433,7 @@ std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {  //
                         continue;
                     }
 
-                    // TODO: only last epoch file is not-detached
-                    entries.emplace_back(ent.string(), dst, false, false);
+                    add_entry(ent, dst, false, ent != last_epoch_file);
                 } else {
                     // unknown type
                 }
@@ -287,7 +441,9 @@ std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {  //
             }
             case 'l': {
                 if (filename == internal::manifest_file_name) {
-                    entries.emplace_back(ent.string(), dst, true, false);
+                    add_entry(ent, dst, true, false);
+                } else if (filename == internal::compaction_catalog::file_name) {
+                    add_entry(ent, dst, true, false);
                 } else {
                     // unknown type
                 }
@@ -297,7 +453,72 @@ std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype) {  //
             }
         }
     }
-    return std::unique_ptr<backup_detail>(new backup_detail(entries, epoch_id_switched_.load()));
+
+    return {log_start, std::move(entries)};
+}
+
+void datastore::complete_backup(epoch_id_type log_finish, const std::vector<backup_detail::entry>& entries) {
+    std::lock_guard<std::mutex> backup_lock(mtx_backup_);
+
+    // forget the files removed since, e.g. by compaction
+    for (auto it = backed_up_files_.begin(); it != backed_up_files_.end(); ) {
+        boost::system::error_code error;
+        if (!boost::filesystem::exists(*it, error) && !error) {
+            it = backed_up_files_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const auto& e : entries) {
+        if (!e.is_mutable()) {
+            backed_up_files_.emplace(e.source_path());
+        }
+    }
+    if (!backed_up_epoch_.has_value() || backed_up_epoch_.value() < log_finish) {
+        backed_up_epoch_ = log_finish;
+    }
+}
+
+std::unique_ptr<backup_detail> datastore::begin_backup(backup_type btype, const boost::filesystem::path& staging_dir) {
+    auto detail = begin_backup(btype);
+
+    boost::system::error_code error;
+    boost::filesystem::create_directories(staging_dir, error);
+    if (error) {
+        LOG_LP(ERROR) << "fail to create directory: " << staging_dir << ", " << error.message();
+        throw std::runtime_error("I/O error");
+    }
+    std::vector<backup_detail::entry> entries;
+    for (const auto& e : detail->entries()) {
+        auto src = e.source_path();
+        auto dst = staging_dir / e.destination_path();
+        try {
+            if (e.is_mutable()) {
+                // take a copy, the original may be modified
+                std::atomic_uintmax_t copied{0};
+                internal::copy_file_fast(src, dst, copied);
+            } else {
+                boost::filesystem::create_hard_link(src, dst, error);
+                if (error) {
+                    // e.g. staging directory is on another filesystem
+                    VLOG_LP(log_debug) << "cannot make hard link " << dst << " (" << error.message() << "), copying the file";
+                    std::atomic_uintmax_t copied{0};
+                    internal::copy_file_fast(src, dst, copied);
+                }
+            }
+        } catch (boost::filesystem::filesystem_error& ex) {
+            LOG_LP(ERROR) << "fail to stage the backup file: " << ex.what();
+            throw std::runtime_error("I/O error");
+        }
+        // staged files are not modified by the datastore
+        entries.emplace_back(dst, e.destination_path(), false, e.is_detached(), boost::filesystem::file_size(dst), e.crc32c());
+    }
+    auto staged = std::unique_ptr<backup_detail>(new backup_detail(entries, detail->log_start(), detail->log_finish()));
+    // the completed backup covers the original files, not the staged ones
+    staged->complete_ = [this, original = detail->entries()](epoch_id_type log_finish, const std::vector<backup_detail::entry>&) {
+        complete_backup(log_finish, original);
+    };
+    return staged;
 }
 
 tag_repository& datastore::epoch_tag_repository() noexcept {
@@ -308,73 +529,145 @@ void datastore::recover([[maybe_unused]] const epoch_tag& tag) const noexcept {
     check_before_ready(static_cast<const char*>(__func__));
 }
 
-epoch_id_type datastore::rotate_log_files() {
-    // TODO:
-    //   for each logchannel lc:
-    //     if lc is in session, reserve do_rotate for end-of-session
-    //               otherwise, lc.do_rotate_file() immediately
-    //   rotate epoch file
-
-    // XXX: adhoc implementation:
-    //   for each logchannel lc:
-    //       lc.do_rotate_file()
-    //   rotate epoch file
+std::shared_future<epoch_id_type> datastore::rotate_log_files() {
+    std::lock_guard<std::mutex> lock(mtx_rotation_);
+    if (rotation_pending_ > 0) {
+        return rotation_done_;  // join the rotation in progress
+    }
+    rotation_promise_ = std::promise<epoch_id_type>();
+    rotation_done_ = rotation_promise_.get_future().share();
+    rotation_epoch_ = epoch_id_switched_.load();
+    rotation_error_ = nullptr;
+
+    // the epoch keeps the name unique even if rotated twice in a millisecond,
+    // incremental backup identifies the files by name
+    rotation_pending_ = 1;  // not to finish while requesting
     for (const auto& lc : log_channels_) {
-#if 0
-        // XXX: this condition may miss log-files made before this process and not rotated
-        if (!lc->registered_) {
-            continue;
-        }
-#else
-        boost::system::error_code error;
-        bool result = boost::filesystem::exists(lc->file_path(), error);
-        if (!result || error) {
-            continue;  // skip if not exists
-        }
-        result = boost::filesystem::is_empty(lc->file_path(), error);
-        if (result || error) {
-            continue;  // skip if empty
+        try {
+            if (!lc->request_rotate(rotation_epoch_)) {
+                rotation_pending_++;
+            }
+        } catch (...) {
+            if (!rotation_error_) {
+                rotation_error_ = std::current_exception();
+            }
         }
-#endif
-        lc->do_rotate_file();
     }
-    rotate_epoch_file();
+    rotation_pending_--;
+    finish_rotation_if_done();
+    return rotation_done_;
+}
+
+void datastore::channel_rotated(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mtx_rotation_);
+    if (error && !rotation_error_) {
+        rotation_error_ = std::move(error);
+    }
+    rotation_pending_--;
+    finish_rotation_if_done();
+}
 
-    return epoch_id_switched_.load();
+void datastore::finish_rotation_if_done() {
+    if (rotation_pending_ > 0) {
+        return;
+    }
+    if (!rotation_error_) {
+        try {
+            rotate_epoch_file();
+        } catch (...) {
+            rotation_error_ = std::current_exception();
+        }
+    }
+    if (rotation_error_) {
+        rotation_promise_.set_exception(rotation_error_);
+    } else {
+        rotation_promise_.set_value(rotation_epoch_);
+    }
 }
 
 void datastore::rotate_epoch_file() {
-    // XXX: multi-thread broken
+    std::lock_guard<std::mutex> lock(mtx_epoch_file_);
 
+    // the durable epoch is put at the end of the name, so that the lookup does not need to read the file
+    std::optional<epoch_id_type> durable_epoch = internal::last_durable_epoch_from_tail(epoch_file_path_);
     std::stringstream ss;
     ss << "epoch."
        << std::setw(14) << std::setfill('0') << current_unix_epoch_in_millis()
        << "." << epoch_id_switched_.load();
+    if (durable_epoch.has_value()) {
+        ss << "." << durable_epoch.value();
+    }
     std::string new_name = ss.str();
-    boost::filesystem::path new_file = location_ / new_name;
+    boost::filesystem::path new_file = metadata_location_ / new_name;
     boost::filesystem::rename(epoch_file_path_, new_file);
-    add_file(new_file);
+    add_file(new_file, internal::crc32c_of_file(new_file));  // epoch file is small enough to read again
 
     // create new one
     boost::filesystem::ofstream strm{};
     strm.open(epoch_file_path_, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
     if(!strm || !strm.is_open() || strm.bad() || strm.fail()){
-        LOG_LP(ERROR) << "does not have write permission for the log_location directory, path: " <<  location_;
+        LOG_LP(ERROR) << "does not have write permission for the log_location directory, path: " <<  metadata_location_;
         throw std::runtime_error("does not have write permission for the log_location directory");
     }
     strm.close();
 }
 
-void datastore::add_file(const boost::filesystem::path& file) noexcept {
+void datastore::compact_epoch_file(epoch_id_type epoch) {
+    // write the new one aside and replace, so that the epoch file always has the durable epoch even if crashed
+    boost::filesystem::path tmp_path = metadata_location_ / std::string(epoch_tmp_file_name);
+    FILE* strm = fopen(tmp_path.c_str(), "w");  // NOLINT(*-owning-memory)
+    if (!strm) {
+        LOG_LP(ERROR) << "fopen failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    log_entry::durable_epoch(strm, epoch);
+    if (fflush(strm) != 0) {
+        LOG_LP(ERROR) << "fflush failed, errno = " << errno;
+        fclose(strm);  // NOLINT(*-owning-memory)
+        throw std::runtime_error("I/O error");
+    }
+    if (fsync(fileno(strm)) != 0) {
+        LOG_LP(ERROR) << "fsync failed, errno = " << errno;
+        fclose(strm);  // NOLINT(*-owning-memory)
+        throw std::runtime_error("I/O error");
+    }
+    if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
+        LOG_LP(ERROR) << "fclose failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    boost::filesystem::rename(tmp_path, epoch_file_path_);
+
+    // make the rename durable, otherwise the epoch file may be rolled back to the one before compaction
+    int dir_fd = ::open(metadata_location_.c_str(), O_RDONLY | O_DIRECTORY);  // NOLINT(*-vararg)
+    if (dir_fd < 0) {
+        LOG_LP(ERROR) << "open failed, errno = " << errno << ", path: " << metadata_location_;
+        throw std::runtime_error("I/O error");
+    }
+    if (fsync(dir_fd) != 0) {
+        LOG_LP(ERROR) << "fsync failed, errno = " << errno << ", path: " << metadata_location_;
+        ::close(dir_fd);
+        throw std::runtime_error("I/O error");
+    }
+    if (::close(dir_fd) != 0) {
+        LOG_LP(ERROR) << "close failed, errno = " << errno << ", path: " << metadata_location_;
+        throw std::runtime_error("I/O error");
+    }
+}
+
+void datastore::add_file(const boost::filesystem::path& file, std::optional<std::uint32_t> crc32c) noexcept {
     std::lock_guard<std::mutex> lock(mtx_files_);
 
     files_.insert(file);
+    if (crc32c) {
+        file_checksums_[file] = crc32c.value();
+    }
 }
 
 void datastore::subtract_file(const boost::filesystem::path& file) {
     std::lock_guard<std::mutex> lock(mtx_files_);
 
     files_.erase(file);
+    file_checksums_.erase(file);
 }
 
 void datastore::check_after_ready(std::string_view func) const noexcept {
@@ -30,10 +30,10 @@ namespace limestone::internal {
 using namespace limestone::api;
 
 // setup log-dir with no data
-void setup_initial_logdir(const boost::filesystem::path& logdir) {
-    nlohmann::json manifest_v1 = {
+void setup_initial_logdir(const boost::filesystem::path& logdir, int persistent_format_version) {
+    nlohmann::json manifest = {
         { "format_version", "1.0" },
-        { "persistent_format_version", 1 }
+        { "persistent_format_version", persistent_format_version }
     };
     boost::filesystem::path config = logdir / std::string(manifest_file_name);
     FILE* strm = fopen(config.c_str(), "w");  // NOLINT(*-owning-memory)
@@ -41,7 +41,7 @@ void setup_initial_logdir(const boost::filesystem::path& logdir) {
         LOG_LP(ERROR) << "fopen for write failed, errno = " << errno;
         throw std::runtime_error("I/O error");
     }
-    std::string manifest_str = manifest_v1.dump(4);
+    std::string manifest_str = manifest.dump(4);
     auto ret = fwrite(manifest_str.c_str(), manifest_str.length(), 1, strm);
     if (ret != 1) {
         LOG_LP(ERROR) << "fwrite failed, errno = " << errno;
@@ -64,6 +64,10 @@ void setup_initial_logdir(const boost::filesystem::path& logdir) {
 static constexpr const char *version_error_prefix = "/:limestone unsupported dbdir persistent format version: "
     "see https://github.com/project-tsurugi/tsurugidb/blob/master/docs/upgrade-guide.md";
 
+std::string supported_versions() {
+    return "version " + std::to_string(oldest_persistent_format_version) + " to " + std::to_string(latest_persistent_format_version);
+}
+
 int is_supported_version(const boost::filesystem::path& manifest_path, std::string& errmsg) {
     std::ifstream istrm(manifest_path.string());
     if (!istrm) {
@@ -75,10 +79,11 @@ int is_supported_version(const boost::filesystem::path& manifest_path, std::stri
         istrm >> manifest;
         auto version = manifest["persistent_format_version"];
         if (version.is_number_integer()) {
-            if (version == 1) {
-                return 1;  // supported
+            int v = version.get<int>();
+            if (oldest_persistent_format_version <= v && v <= latest_persistent_format_version) {
+                return v;  // supported
             }
-            errmsg = "version mismatch: version " + version.dump() + ", server supports version 1";
+            errmsg = "version mismatch: version " + version.dump() + ", server supports " + supported_versions();
             return 0;
         }
         errmsg = "invalid manifest file, invalid persistent_format_version: " + version.dump();
@@ -90,11 +95,11 @@ int is_supported_version(const boost::filesystem::path& manifest_path, std::stri
     }
 }
 
-void check_logdir_format(const boost::filesystem::path& logdir) {
+int check_logdir_format(const boost::filesystem::path& logdir) {
     boost::filesystem::path manifest_path = logdir / std::string(manifest_file_name);
     if (!boost::filesystem::exists(manifest_path)) {
         VLOG_LP(log_info) << "no manifest file in logdir, maybe v0";
-        LOG(ERROR) << version_error_prefix << " (version mismatch: version 0, server supports version 1)";
+        LOG(ERROR) << version_error_prefix << " (version mismatch: version 0, server supports " << supported_versions() << ")";
         throw std::runtime_error("logdir version mismatch");
     }
     std::string errmsg;
@@ -108,6 +113,7 @@ void check_logdir_format(const boost::filesystem::path& logdir) {
         LOG(ERROR) << "/:limestone dbdir is corrupted, can not use.";
         throw std::runtime_error("logdir corrupted");
     }
+    return vc;
 }
 
 } // namespace limestone::internal
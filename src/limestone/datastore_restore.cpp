@@ -14,13 +14,24 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+
 #include <glog/logging.h>
 #include <limestone/logging.h>
 #include "logging_helper.h"
 
 #include <limestone/api/datastore.h>
 #include <limestone/status.h>
+#include "crc32c.h"
 #include "internal.h"
+#include "task_pool.h"
 
 namespace limestone::internal {
 
@@ -56,6 +67,113 @@ static status check_manifest(const boost::filesystem::path& manifest_path) {
     return status::ok;
 }
 
+// read/write chunk for the fallback copy
+static constexpr std::size_t copy_buffer_size = 1024UL * 1024UL;
+
+class unique_fd {
+public:
+    explicit unique_fd(int fd) noexcept : fd_(fd) {}
+    ~unique_fd() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    unique_fd(const unique_fd&) = delete;
+    unique_fd& operator=(const unique_fd&) = delete;
+    unique_fd(unique_fd&&) = delete;
+    unique_fd& operator=(unique_fd&&) = delete;
+    [[nodiscard]] int get() const noexcept { return fd_; }
+private:
+    int fd_;
+};
+
+// copy the file by the fastest way available: reflink (FICLONE) if on the same filesystem which supports it,
+// copy_file_range (copies in the kernel), then read/write.
+// done is increased by the bytes copied.
+// if crc32c is requested, the data must pass through the user space, so read/write is used.
+// throws boost::filesystem::filesystem_error on error, as boost::filesystem::copy_file does
+void copy_file_fast(const boost::filesystem::path& src, const boost::filesystem::path& dst, std::atomic_uintmax_t& done,
+                    std::uint32_t* crc32c) {
+    auto fail = [&src, &dst](const char* what) {
+        throw boost::filesystem::filesystem_error(what, src, dst, boost::system::error_code(errno, boost::system::system_category()));
+    };
+    unique_fd in{::open(src.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT(*-vararg)
+    if (in.get() < 0) {
+        fail("open");
+    }
+    struct stat st{};
+    if (::fstat(in.get(), &st) != 0) {
+        fail("fstat");
+    }
+    unique_fd out{::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777)};  // NOLINT(*-vararg)
+    if (out.get() < 0) {
+        fail("open");
+    }
+    if (crc32c) {
+        *crc32c = 0;
+    }
+#ifdef FICLONE
+    if (!crc32c && ::ioctl(out.get(), FICLONE, in.get()) == 0) {  // NOLINT(*-vararg)
+        done += st.st_size;
+        return;
+    }
+#endif
+    std::uintmax_t remaining = st.st_size;
+    bool use_copy_file_range = !crc32c;
+    std::vector<char> buffer{};
+    if (!use_copy_file_range) {
+        buffer.resize(copy_buffer_size);
+    }
+    while (remaining > 0) {
+        std::size_t len = std::min(remaining, static_cast<std::uintmax_t>(copy_buffer_size));
+        if (use_copy_file_range) {
+            ssize_t n = ::copy_file_range(in.get(), nullptr, out.get(), nullptr, len, 0);
+            if (n > 0) {
+                remaining -= n;
+                done += n;
+                continue;
+            }
+            if (n == 0) {
+                break;  // the file is shrunk
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+                fail("copy_file_range");
+            }
+            // not supported for these files, continue from the current offsets by read/write
+            use_copy_file_range = false;
+            buffer.resize(copy_buffer_size);
+        }
+        ssize_t r = ::read(in.get(), buffer.data(), len);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("read");
+        }
+        if (r == 0) {
+            break;  // the file is shrunk
+        }
+        for (ssize_t written = 0; written < r; ) {
+            ssize_t w = ::write(out.get(), buffer.data() + written, r - written);  // NOLINT(*-pointer-arithmetic)
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail("write");
+            }
+            written += w;
+        }
+        if (crc32c) {
+            *crc32c = crc32c_extend(*crc32c, buffer.data(), r);
+        }
+        remaining -= r;
+        done += r;
+    }
+}
+
 }  // namespace limestone::internal
 
 namespace limestone::api {
@@ -63,27 +181,24 @@ namespace limestone::api {
 status datastore::restore(std::string_view from, bool keep_backup) const noexcept {
     VLOG_LP(log_debug) << "restore begin, from directory = " << from << " , keep_backup = " << std::boolalpha << keep_backup;
     auto from_dir = boost::filesystem::path(std::string(from));
+    start_restore(from);
 
     // log_dir version check
     boost::filesystem::path manifest_path = from_dir / std::string(internal::manifest_file_name);
     if (!boost::filesystem::exists(manifest_path)) {
         VLOG_LP(log_info) << "no manifest file in backup";
-        LOG(ERROR) << internal::version_error_prefix << " (version mismatch: version 0, server supports version 1)";
-        return status::err_broken_data;
+        LOG(ERROR) << internal::version_error_prefix << " (version mismatch: version 0, server supports " << internal::supported_versions() << ")";
+        return finish_restore(status::err_broken_data);
     }
-    if (auto rc = internal::check_manifest(manifest_path); rc != status::ok) { return rc; }
+    if (auto rc = internal::check_manifest(manifest_path); rc != status::ok) { return finish_restore(rc); }
 
-    if (auto rc = internal::purge_dir(location_); rc != status::ok) { return rc; }
+    if (auto rc = purge_data_locations(); rc != status::ok) { return finish_restore(rc); }
 
+    std::vector<file_set_entry> files;
     for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(from_dir)) {
-        try {
-            boost::filesystem::copy_file(p, location_ / p.filename());
-        }
-        catch (boost::filesystem::filesystem_error& ex) {
-            LOG_LP(ERROR) << ex.what() << " file = " << p.string();
-            return status::err_permission_error;
-        }
+        files.emplace_back(p, p.filename(), false);
     }
+    if (auto rc = restore_files(files); rc != status::ok) { return finish_restore(rc); }
     if (!keep_backup) {
         for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(from_dir)) {
             try {
@@ -101,6 +216,7 @@ status datastore::restore(std::string_view from, bool keep_backup) const noexcep
 status datastore::restore(std::string_view from, std::vector<file_set_entry>& entries) {
     VLOG_LP(log_debug) << "restore (from prusik) begin, from directory = " << from;
     auto from_dir = boost::filesystem::path(std::string(from));
+    start_restore(from);
 
     // log_dir version check
     int manifest_count = 0;
@@ -116,19 +232,20 @@ status datastore::restore(std::string_view from, std::vector<file_set_entry>& en
         }
         if (!boost::filesystem::exists(src) || !boost::filesystem::is_regular_file(src)) {
             LOG_LP(ERROR) << "file not found : file = " << src.string();
-            return status::err_not_found;
+            return finish_restore(status::err_not_found);
         }
-        if (auto rc = internal::check_manifest(src); rc != status::ok) { return rc; }
+        if (auto rc = internal::check_manifest(src); rc != status::ok) { return finish_restore(rc); }
         manifest_count++;
     }
     if (manifest_count < 1) {  // XXX: change to != 1 ??
         VLOG_LP(log_info) << "no manifest file in backup";
-        LOG(ERROR) << internal::version_error_prefix << " (version mismatch: version 0, server supports version 1)";
-        return status::err_broken_data;
+        LOG(ERROR) << internal::version_error_prefix << " (version mismatch: version 0, server supports " << internal::supported_versions() << ")";
+        return finish_restore(status::err_broken_data);
     }
 
-    if (auto rc = internal::purge_dir(location_); rc != status::ok) { return rc; }
+    if (auto rc = purge_data_locations(); rc != status::ok) { return finish_restore(rc); }
 
+    std::vector<file_set_entry> files;
     for (auto & ent : entries) {
         boost::filesystem::path src{ent.source_path()};
         boost::filesystem::path dst{ent.destination_path()};
@@ -141,17 +258,112 @@ status datastore::restore(std::string_view from, std::vector<file_set_entry>& en
         // TODO: assert dst.is_relative()
         if (!boost::filesystem::exists(src) || !boost::filesystem::is_regular_file(src)) {
             LOG_LP(ERROR) << "file not found : file = " << src.string();
-            return status::err_not_found;
-        }
-        try {
-            boost::filesystem::copy_file(src, location_ / dst);
-        } catch (boost::filesystem::filesystem_error& ex) {
-            LOG_LP(ERROR) << ex.what() << " file = " << src.string();
-            return status::err_permission_error;
+            return finish_restore(status::err_not_found);
         }
+        files.emplace_back(src, dst, ent.is_detached(), ent.crc32c());
+    }
+    return restore_files(files);
+}
 
+status datastore::purge_data_locations() const noexcept {
+    // restored pwal files are spread over the data locations, the old ones in any data location must not remain
+    for (const auto& dir : data_locations_) {
+        if (auto rc = internal::purge_dir(dir); rc != status::ok) { return rc; }
+    }
+    if (data_locations_.empty()) {
+        if (auto rc = internal::purge_dir(location_); rc != status::ok) { return rc; }
+    }
+    if (metadata_location_ != location_ && !metadata_location_.empty()) {
+        if (auto rc = internal::purge_dir(metadata_location_); rc != status::ok) { return rc; }
     }
     return status::ok;
 }
 
+boost::filesystem::path datastore::restore_location_of(const boost::filesystem::path& file) const {
+    auto filename = file.filename().string();
+    if (!metadata_location_.empty() && (filename.rfind(epoch_file_name, 0) == 0 || filename == internal::manifest_file_name)) {
+        return metadata_location_;
+    }
+    if (data_locations_.size() > 1 && filename.rfind(log_channel::prefix, 0) == 0) {
+        // the pwal file of a channel, active (pwal_NNNN) or rotated (pwal_NNNN.<time>.<epoch>), is placed by the channel id
+        // as create_channel() places the channels in turn; the compacted files (pwal_0000.compacted...) stay in location_
+        std::size_t pos = log_channel::prefix.size();
+        std::size_t end = filename.find_first_not_of("0123456789", pos);
+        bool channel_file = end != pos && end - pos <= 9
+            && (end == std::string::npos || (filename.at(end) == '.' && end + 1 < filename.size() && std::isdigit(filename.at(end + 1)) != 0));
+        if (channel_file) {
+            auto id = std::stoul(filename.substr(pos, end - pos));
+            return data_locations_.at(id % data_locations_.size());
+        }
+    }
+    return location_;
+}
+
+restore_progress datastore::restore_status() const noexcept {
+    std::lock_guard<std::mutex> lock(mtx_restore_);
+    return {restore_result_, restore_kind_, restore_source_, restore_bytes_done_.load(), restore_bytes_total_};
+}
+
+void datastore::start_restore(std::string_view from) const noexcept {
+    std::lock_guard<std::mutex> lock(mtx_restore_);
+    restore_kind_ = restore_progress::status_kind::prepareing;
+    restore_result_ = status::ok;
+    restore_source_ = from;
+    restore_bytes_done_ = 0;
+    restore_bytes_total_ = 0;
+}
+
+status datastore::finish_restore(status rc) const noexcept {
+    std::lock_guard<std::mutex> lock(mtx_restore_);
+    restore_kind_ = rc == status::ok ? restore_progress::status_kind::completed : restore_progress::status_kind::failed;
+    restore_result_ = rc;
+    return rc;
+}
+
+status datastore::restore_files(const std::vector<file_set_entry>& files) const noexcept {
+    std::vector<std::uintmax_t> sizes(files.size());
+    for (std::size_t i = 0; i < files.size(); i++) {
+        boost::system::error_code error;
+        sizes.at(i) = boost::filesystem::file_size(files.at(i).source_path(), error);
+        if (error) {
+            LOG_LP(ERROR) << error.message() << " file = " << files.at(i).source_path().string();
+            return finish_restore(status::err_permission_error);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_restore_);
+        restore_kind_ = restore_progress::status_kind::running;
+        restore_bytes_total_ = std::accumulate(sizes.begin(), sizes.end(), static_cast<std::uintmax_t>(0));
+    }
+
+    // larger files first, not to leave a large file to the end
+    std::vector<std::size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&sizes](std::size_t a, std::size_t b){ return sizes.at(a) > sizes.at(b); });
+    std::atomic_bool broken{false};
+    try {
+        task_pool_->parallel_for(order.size(), [this, &files, &order, &broken](std::size_t i) {
+            const auto& file = files.at(order.at(i));
+            if (!file.crc32c()) {
+                internal::copy_file_fast(file.source_path(), restore_location_of(file.destination_path()) / file.destination_path(), restore_bytes_done_);
+                return;
+            }
+            std::uint32_t crc32c{};
+            internal::copy_file_fast(file.source_path(), restore_location_of(file.destination_path()) / file.destination_path(), restore_bytes_done_, &crc32c);
+            if (crc32c != file.crc32c().value()) {
+                LOG_LP(ERROR) << "checksum mismatch, file = " << file.source_path().string();
+                broken = true;
+                throw std::runtime_error("checksum mismatch");
+            }
+        });
+    } catch (boost::filesystem::filesystem_error& ex) {
+        LOG_LP(ERROR) << ex.what() << " file = " << ex.path1().string();
+        return finish_restore(status::err_permission_error);
+    } catch (std::exception& ex) {
+        LOG_LP(ERROR) << "restore failed: " << ex.what();
+        return finish_restore(broken ? status::err_broken_data : status::err_permission_error);
+    }
+    return finish_restore(status::ok);
+}
+
 } // namespace limestone::api
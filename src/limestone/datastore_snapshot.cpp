@@ -18,22 +18,30 @@
 #include <boost/filesystem/fstream.hpp>
 #include <cstdlib>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <map>
 #include <mutex>
+#include <set>
+#include <type_traits>
 
 #include <glog/logging.h>
 #include <limestone/logging.h>
 #include "logging_helper.h"
 
 #include <limestone/api/datastore.h>
+#include "compaction_catalog.h"
 #include "dblog_scan.h"
 #include "internal.h"
 #include "log_entry.h"
 #include "sortdb_wrapper.h"
+#include "task_pool.h"
 
 namespace limestone::internal {
 
 constexpr std::size_t write_version_size = sizeof(epoch_id_type) + sizeof(std::uint64_t);
 static_assert(write_version_size == 16);
+static constexpr std::array<char, write_version_size> zero_write_version{};
 
 [[maybe_unused]]
 static void store_bswap64_value(void *dest, const void *src) {
@@ -52,46 +60,73 @@ static int comp_twisted_key(const std::string_view& a, const std::string_view& b
     return std::memcmp(b.data(), a.data(), write_version_size);
 }
 
+// the buffers below are thread_local, so that each scanning thread reuses its own ones
+// instead of allocating them for every entry
+
+// returns true if an entry of the same key is already inserted, i.e. either of them is superseded
 [[maybe_unused]]
-static void insert_entry_or_update_to_max(sortdb_wrapper* sortdb, log_entry& e) {
+// grown: set to the change of the size of the entries in sortdb (key_sid and value_etc), if given
+static bool insert_entry_or_update_to_max(sortdb_wrapper* sortdb, log_entry& e, std::intmax_t* grown = nullptr) {
+    thread_local std::string value{};
+    thread_local std::string db_value{};
     bool need_write = true;
+    bool exists = sortdb->get(e.key_sid(), &value);
     // skip older entry than already inserted
-    std::string value;
-    if (sortdb->get(e.key_sid(), &value)) {
+    if (exists) {
         write_version_type write_version;
         e.write_version(write_version);
-        if (write_version < write_version_type(value.substr(1))) {
+        if (write_version < write_version_type(std::string_view(value).substr(1))) {
             need_write = false;
         }
     }
     if (need_write) {
-        std::string db_value;
-        db_value.append(1, static_cast<char>(e.type()));
+        db_value.assign(1, static_cast<char>(e.type()));
         db_value.append(e.value_etc());
         sortdb->put(e.key_sid(), db_value);
     }
+    if (grown != nullptr) {
+        if (!need_write) {
+            *grown = 0;
+        } else if (exists) {
+            *grown = static_cast<std::intmax_t>(db_value.size()) - static_cast<std::intmax_t>(value.size());
+        } else {
+            *grown = static_cast<std::intmax_t>(e.key_sid().size() + e.value_etc().size());
+        }
+    }
+    return exists;
 }
 
 [[maybe_unused]]
 static void insert_twisted_entry(sortdb_wrapper* sortdb, log_entry& e) {
     // key_sid: storage_id[8] key[*], value_etc: epoch[8]LE minor_version[8]LE value[*], type: type[1]
     // db_key: epoch[8]BE minor_version[8]BE storage_id[8] key[*], db_value: type[1] value[*]
-    std::string db_key(write_version_size + e.key_sid().size(), '\0');
+    thread_local std::string db_key{};
+    thread_local std::string db_value{};
+    db_key.resize(write_version_size + e.key_sid().size());
     store_bswap64_value(&db_key[0], &e.value_etc()[0]);  // NOLINT(readability-container-data-pointer)
     store_bswap64_value(&db_key[8], &e.value_etc()[8]);
     std::memcpy(&db_key[write_version_size], e.key_sid().data(), e.key_sid().size());
-    std::string db_value(1, static_cast<char>(e.type()));
-    db_value.append(e.value_etc().substr(write_version_size));
+    db_value.assign(1, static_cast<char>(e.type()));
+    db_value.append(e.value_etc(), write_version_size);
     sortdb->put(db_key, db_value);
 }
 
-static std::pair<epoch_id_type, std::unique_ptr<sortdb_wrapper>> create_sortdb_from_wals(const boost::filesystem::path& from_dir, int num_worker) {
+// pool: the threads scanning pwal files, num_worker of them at most
+// superseded: counts the entries superseded in the sort database by storage, if given;
+//   counted only by the sort method which keeps the max version in the sort database (not SORT_METHOD_PUT_ONLY)
+static std::pair<epoch_id_type, std::unique_ptr<sortdb_wrapper>> create_sortdb_from_wals(const boost::filesystem::path& from_dir,
+                                                                                         task_pool& pool, int num_worker,
+                                                                                         const std::vector<boost::filesystem::path>& extra_wal_dirs = {},
+                                                                                         const boost::filesystem::path& epoch_dir = {},
+                                                                                         [[maybe_unused]] std::map<storage_id_type, std::uint64_t>* superseded = nullptr) {
 #if defined SORT_METHOD_PUT_ONLY
     auto sortdb = std::make_unique<sortdb_wrapper>(from_dir, comp_twisted_key);
 #else
     auto sortdb = std::make_unique<sortdb_wrapper>(from_dir);
 #endif
     dblog_scan logscan{from_dir};
+    logscan.set_extra_wal_dirs(extra_wal_dirs);
+    logscan.set_epoch_dir(epoch_dir);
 
     epoch_id_type ld_epoch = logscan.last_durable_epoch_in_dir();
 
@@ -99,7 +134,11 @@ static std::pair<epoch_id_type, std::unique_ptr<sortdb_wrapper>> create_sortdb_f
     auto add_entry = [&sortdb](log_entry& e){insert_twisted_entry(sortdb.get(), e);};
     bool works_with_multi_thread = true;
 #else
-    auto add_entry = [&sortdb](log_entry& e){insert_entry_or_update_to_max(sortdb.get(), e);};
+    auto add_entry = [&sortdb, superseded](log_entry& e){
+        if (insert_entry_or_update_to_max(sortdb.get(), e) && superseded != nullptr) {
+            (*superseded)[e.storage()]++;  // single-threaded
+        }
+    };
     bool works_with_multi_thread = false;
 #endif
 
@@ -108,6 +147,7 @@ static std::pair<epoch_id_type, std::unique_ptr<sortdb_wrapper>> create_sortdb_f
         num_worker = 1;
     }
     logscan.set_thread_num(num_worker);
+    logscan.set_task_pool(&pool);
     try {
         epoch_id_type max_appeared_epoch = logscan.scan_pwal_files_throws(ld_epoch, add_entry);
         return {max_appeared_epoch, std::move(sortdb)};
@@ -120,14 +160,26 @@ static std::pair<epoch_id_type, std::unique_ptr<sortdb_wrapper>> create_sortdb_f
     }
 }
 
-static void sortdb_foreach(sortdb_wrapper *sortdb, std::function<void(const std::string_view key, const std::string_view value)> write_snapshot_entry) {
+// write_snapshot_entry, write_snapshot_remove_entry: void(std::string_view key, std::string_view value),
+//   taken as template parameters so that they are inlined into the loop over the sort database
+// write_snapshot_remove_entry: called for remove_entry (tombstone) if given, otherwise tombstones are dropped
+// skip_superseded_entry: void(std::string_view key), called for the older versions of the key if given;
+//   they are in the sort database only with SORT_METHOD_PUT_ONLY
+template<class F, class G = std::nullptr_t, class H = std::nullptr_t>
+static void sortdb_foreach(sortdb_wrapper *sortdb, F&& write_snapshot_entry, G&& write_snapshot_remove_entry = nullptr,
+                           [[maybe_unused]] H&& skip_superseded_entry = nullptr) {
     static_assert(sizeof(log_entry::entry_type) == 1);
+    constexpr bool keep_tombstones = !std::is_null_pointer_v<std::decay_t<G>>;
 #if defined SORT_METHOD_PUT_ONLY
-    sortdb->each([write_snapshot_entry, last_key = std::string{}](const std::string_view db_key, const std::string_view db_value) mutable {
+    constexpr bool count_superseded = !std::is_null_pointer_v<std::decay_t<H>>;
+    sortdb->each([&write_snapshot_entry, &write_snapshot_remove_entry, &skip_superseded_entry, last_key = std::string{}, value = std::string{}](const std::string_view db_key, const std::string_view db_value) mutable {
         // using the first entry in GROUP BY (original-)key
         // NB: max versions comes first (by the custom-comparator)
         std::string_view key(db_key.data() + write_version_size, db_key.size() - write_version_size);
         if (key == last_key) {  // same (original-)key with prev
+            if constexpr (count_superseded) {
+                skip_superseded_entry(key);
+            }
             return; // skip
         }
         last_key.assign(key);
@@ -135,7 +187,7 @@ static void sortdb_foreach(sortdb_wrapper *sortdb, std::function<void(const std:
         auto entry_type = static_cast<log_entry::entry_type>(db_value[0]);
         switch (entry_type) {
         case log_entry::entry_type::normal_entry: {
-            std::string value(write_version_size + db_value.size() - 1, '\0');
+            value.resize(write_version_size + db_value.size() - 1);
             store_bswap64_value(&value[0], &db_key[0]);
             store_bswap64_value(&value[8], &db_key[8]);
             std::memcpy(&value[write_version_size], &db_value[1], db_value.size() - 1);
@@ -143,6 +195,12 @@ static void sortdb_foreach(sortdb_wrapper *sortdb, std::function<void(const std:
             break;
         }
         case log_entry::entry_type::remove_entry:
+            if constexpr (keep_tombstones) {
+                value.resize(write_version_size);
+                store_bswap64_value(&value[0], &db_key[0]);
+                store_bswap64_value(&value[8], &db_key[8]);
+                write_snapshot_remove_entry(key, value);
+            }
             break;  // skip
         default:
             LOG(ERROR) << "never reach " << static_cast<int>(entry_type);
@@ -150,13 +208,16 @@ static void sortdb_foreach(sortdb_wrapper *sortdb, std::function<void(const std:
         }
     });
 #else
-    sortdb->each([&write_snapshot_entry](const std::string_view db_key, const std::string_view db_value) {
+    sortdb->each([&write_snapshot_entry, &write_snapshot_remove_entry](const std::string_view db_key, const std::string_view db_value) {
         auto entry_type = static_cast<log_entry::entry_type>(db_value[0]);
         switch (entry_type) {
         case log_entry::entry_type::normal_entry:
             write_snapshot_entry(db_key, db_value.substr(1));
             break;
         case log_entry::entry_type::remove_entry:
+            if constexpr (keep_tombstones) {
+                write_snapshot_remove_entry(db_key, db_value.substr(1));
+            }
             break;  // skip
         default:
             LOG(ERROR) << "never reach " << static_cast<int>(entry_type);
@@ -166,46 +227,416 @@ static void sortdb_foreach(sortdb_wrapper *sortdb, std::function<void(const std:
 #endif
 }
 
-void create_comapct_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir, int num_worker) {
-    auto [max_appeared_epoch, sortdb] = create_sortdb_from_wals(from_dir, num_worker);
-
+static void ensure_directory(const boost::filesystem::path& dir) {
     boost::system::error_code error;
-    const bool result_check = boost::filesystem::exists(to_dir, error);
+    const bool result_check = boost::filesystem::exists(dir, error);
     if (!result_check || error) {
-        const bool result_mkdir = boost::filesystem::create_directory(to_dir, error);
+        const bool result_mkdir = boost::filesystem::create_directory(dir, error);
         if (!result_mkdir || error) {
-            LOG_LP(ERROR) << "fail to create directory " << to_dir;
+            LOG_LP(ERROR) << "fail to create directory " << dir;
             throw std::runtime_error("I/O error");
         }
     }
+}
 
-    boost::filesystem::path snapshot_file = to_dir / boost::filesystem::path("pwal_0000.compacted");
-    VLOG_LP(log_info) << "generating compacted pwal file: " << snapshot_file;
-    FILE* ostrm = fopen(snapshot_file.c_str(), "w");  // NOLINT(*-owning-memory)
+// the size of the temporary data made by the compaction, checked against compaction_options::temp_space_limit
+class temp_space_budget {
+public:
+    explicit temp_space_budget(std::uintmax_t limit) noexcept : limit_(limit) {}
+
+    void acquire(std::uintmax_t bytes) {
+        if (auto used = used_ += bytes; limit_ > 0 && used > limit_) {
+            exceeded_ = true;
+            throw std::runtime_error("temporary space limit exceeded");
+        }
+    }
+    void release(std::uintmax_t bytes) noexcept { used_ -= bytes; }
+    [[nodiscard]] bool exceeded() const noexcept { return exceeded_; }
+
+private:
+    std::uintmax_t limit_;
+    std::atomic_uintmax_t used_{0};
+    std::atomic_bool exceeded_{false};
+};
+
+// a part of the key space, sorted in its own sort database so that
+// the partitions can be filled and written out in parallel
+struct sort_partition {
+    boost::filesystem::path dir{};
+    std::unique_ptr<sortdb_wrapper> sortdb{};
+    std::mutex mtx{};  // serializes get-and-put of insert_entry_or_update_to_max
+    std::atomic_uintmax_t bytes{0};  // size of the entries put into sortdb
+
+    explicit sort_partition(boost::filesystem::path d) : dir(std::move(d)) {
+        ensure_directory(dir);
+#if defined SORT_METHOD_PUT_ONLY
+        sortdb = std::make_unique<sortdb_wrapper>(dir, comp_twisted_key);
+#else
+        sortdb = std::make_unique<sortdb_wrapper>(dir);
+#endif
+    }
+    ~sort_partition() {
+        sortdb.reset();
+        boost::system::error_code error;
+        boost::filesystem::remove_all(dir, error);
+    }
+    sort_partition(const sort_partition&) = delete;
+    sort_partition& operator=(const sort_partition&) = delete;
+    sort_partition(sort_partition&&) = delete;
+    sort_partition& operator=(sort_partition&&) = delete;
+};
+
+// serializes the calls of compaction_options::report_progress from worker threads
+class progress_reporter {
+public:
+    progress_reporter(const compaction_options& options, compaction_progress::phase phase, std::size_t total)
+        : report_(options.report_progress), start_(std::chrono::steady_clock::now()) {
+        progress_.current = phase;
+        progress_.total = total;
+    }
+    void advance(std::uintmax_t bytes) {
+        if (!report_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock{mtx_};
+        progress_.done++;
+        progress_.bytes += bytes;
+        progress_.elapsed = std::chrono::steady_clock::now() - start_;
+        report_(progress_);
+    }
+
+private:
+    const std::function<void(const compaction_progress&)>& report_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mtx_{};
+    compaction_progress progress_{};
+};
+
+struct compacted_file_stat {
+    std::optional<epoch_id_type> min_epoch{};  // minimum write version (major) in the file
+    epoch_id_type max_epoch{0};
+    std::uint64_t entries{0};
+    std::uint64_t tombstones{0};
+    std::uint64_t dropped_tombstones{0};
+    std::uintmax_t size{0};
+};
+
+// write the contents of sortdb as one epoch snippet
+//   rewind: clear write versions of the entries; valid only if no older data remains after this compaction
+//   keep_tombstones: write remove_entry to shadow the entries in the other (older) generations
+//   persistent_format_version: the format of the entries and the header of the snippet
+static compacted_file_stat write_compacted_pwal(sortdb_wrapper* sortdb, const boost::filesystem::path& file, epoch_id_type epoch,
+                                                bool rewind, bool keep_tombstones, int persistent_format_version) {
+    VLOG_LP(log_info) << "generating compacted pwal file: " << file;
+    FILE* ostrm = fopen(file.c_str(), "w");  // NOLINT(*-owning-memory)
     if (!ostrm) {
-        LOG_LP(ERROR) << "cannot create snapshot file (" << snapshot_file << ")";
+        LOG_LP(ERROR) << "cannot create snapshot file (" << file << ")";
         throw std::runtime_error("I/O error");
     }
     setvbuf(ostrm, nullptr, _IOFBF, 128L * 1024L);  // NOLINT, NB. glibc may ignore size when _IOFBF and buffer=NULL
-    bool rewind = true;  // TODO: change by flag
-    epoch_id_type epoch = rewind ? 0 : max_appeared_epoch;
-    log_entry::begin_session(ostrm, epoch);
-    auto write_snapshot_entry = [&ostrm, &rewind](std::string_view key_stid, std::string_view value_etc) {
+    if (rewind) {
+        epoch = 0;
+    }
+    bool with_checksum = persistent_format_version >= checksummed_persistent_format_version;
+    bool sized_snippet = persistent_format_version >= sized_snippet_persistent_format_version;
+    bool packed_entries = persistent_format_version >= packed_entry_persistent_format_version;
+    storage_id_type previous_storage_id = 0;
+    auto write_entry = [&](std::string_view key_sid, std::string_view value_etc) {
+        if (packed_entries) {
+            log_entry::write_packed(ostrm, epoch, previous_storage_id, key_sid, value_etc);
+        } else {
+            log_entry::write(ostrm, key_sid, value_etc, with_checksum);
+        }
+    };
+    auto write_remove_entry = [&](std::string_view key_sid, std::string_view value_etc) {
+        if (packed_entries) {
+            log_entry::write_remove_packed(ostrm, epoch, previous_storage_id, key_sid, value_etc);
+        } else {
+            log_entry::write_remove(ostrm, key_sid, value_etc, with_checksum);
+        }
+    };
+    if (sized_snippet) {
+        log_entry::begin_sized_session(ostrm, epoch);
+    } else {
+        log_entry::begin_session(ostrm, epoch);
+    }
+    compacted_file_stat stat{};
+    auto count_entry = [&stat](std::string_view value_etc) {
+        epoch_id_type e = log_entry::write_version_epoch_number(value_etc);
+        stat.min_epoch = std::min(stat.min_epoch.value_or(e), e);
+        stat.max_epoch = std::max(stat.max_epoch, e);
+        stat.entries++;
+    };
+    auto write_snapshot_entry = [&rewind, &write_entry, &count_entry, value = std::string{}](std::string_view key_stid, std::string_view value_etc) mutable {
         if (rewind) {
-            static std::string value{};
             value = value_etc;
-            std::memset(value.data(), 0, 16);
-            log_entry::write(ostrm, key_stid, value);
+            std::memset(value.data(), 0, write_version_size);
+            write_entry(key_stid, value);
+            count_entry(value);
         } else {
-            log_entry::write(ostrm, key_stid, value_etc);
+            write_entry(key_stid, value_etc);
+            count_entry(value_etc);
         }
     };
-    sortdb_foreach(sortdb.get(), write_snapshot_entry);
+    auto write_snapshot_remove_entry = [&rewind, &keep_tombstones, &write_remove_entry, &count_entry, &stat](std::string_view key_stid, std::string_view value_etc) {
+        if (!keep_tombstones) {
+            stat.dropped_tombstones++;
+            return;
+        }
+        std::string_view value = rewind ? std::string_view(zero_write_version.data(), zero_write_version.size()) : value_etc;
+        write_remove_entry(key_stid, value);
+        count_entry(value);
+        stat.tombstones++;
+    };
+    sortdb_foreach(sortdb, write_snapshot_entry, write_snapshot_remove_entry);
     //log_entry::end_session(ostrm, epoch);
+    if (sized_snippet) {
+        // the file has only this snippet
+        auto length = static_cast<std::uint64_t>(ftell(ostrm)) - log_entry::sized_marker_size;
+        auto marker = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, epoch, length, stat.entries);
+        if (fseek(ostrm, 0, SEEK_SET) != 0 || fwrite(marker.data(), marker.size(), 1, ostrm) != 1) {
+            LOG_LP(ERROR) << "cannot write the header of snapshot file (" << file << "), errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
+    }
     if (fclose(ostrm) != 0) {  // NOLINT(*-owning-memory)
-        LOG_LP(ERROR) << "cannot close snapshot file (" << snapshot_file << "), errno = " << errno;
+        LOG_LP(ERROR) << "cannot close snapshot file (" << file << "), errno = " << errno;
         throw std::runtime_error("I/O error");
     }
+    stat.size = boost::filesystem::file_size(file);
+    return stat;
+}
+
+static std::vector<std::string> list_pwal_files(const boost::filesystem::path& dir, const std::function<bool(const boost::filesystem::path&)>& filter) {
+    std::vector<std::string> files;
+    for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(dir)) {
+        if (dblog_scan::is_wal(p) && filter(p)) {
+            files.emplace_back(p.filename().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// compact gen.sources in from_dir into gen.files in to_dir, and set the statistics of the generation
+//   the sort databases are made in to_dir, one per segment; each of them is removed as soon as its segment is written
+//   bottom: no older data remains after this compaction
+// returns the number of remove entries dropped
+static std::uint64_t compact_into_generation(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir,
+                                    epoch_id_type ld_epoch, bool bottom, const compaction_options& options, task_pool& pool,
+                                    compaction_catalog::generation& gen) {
+    std::set<std::string> sources(gen.sources.begin(), gen.sources.end());
+    std::uintmax_t source_bytes{0};
+    for (const auto& f : sources) {
+        source_bytes += boost::filesystem::file_size(from_dir / f);
+    }
+    if (auto space = boost::filesystem::space(to_dir); space.available < source_bytes) {
+        LOG_LP(WARNING) << "free space of " << to_dir << " (" << space.available << " bytes) may not be enough for compacting "
+                        << source_bytes << " bytes of pwal files";
+    }
+
+    std::vector<std::unique_ptr<sort_partition>> parts;
+    parts.reserve(gen.files.size());
+    for (std::size_t i = 0; i < gen.files.size(); i++) {
+        parts.emplace_back(std::make_unique<sort_partition>(to_dir / ("partition_" + std::to_string(i))));
+    }
+    temp_space_budget budget{options.temp_space_limit};
+
+    // scan: distribute the entries to the partitions by key
+    // charged by the size retained in the sort database, not by the size scanned
+    auto add_entry = [&parts, &budget](log_entry& e) {
+        auto& part = *parts[std::hash<std::string>{}(e.key_sid()) % parts.size()];
+#if defined SORT_METHOD_PUT_ONLY
+        // every version is kept until written
+        std::uintmax_t size = e.key_sid().size() + e.value_etc().size();
+        budget.acquire(size);
+        part.bytes += size;
+        insert_twisted_entry(part.sortdb.get(), e);
+#else
+        std::lock_guard<std::mutex> lock{part.mtx};
+        std::intmax_t grown{};
+        insert_entry_or_update_to_max(part.sortdb.get(), e, &grown);
+        if (grown > 0) {
+            part.bytes += static_cast<std::uintmax_t>(grown);
+            budget.acquire(static_cast<std::uintmax_t>(grown));
+        } else if (grown < 0) {
+            part.bytes -= static_cast<std::uintmax_t>(-grown);
+            budget.release(static_cast<std::uintmax_t>(-grown));
+        }
+#endif
+    };
+    dblog_scan logscan{from_dir};
+    logscan.set_file_filter([&sources](const boost::filesystem::path& p){ return sources.count(p.filename().string()) > 0; });
+    logscan.set_thread_num(options.num_worker);
+    logscan.set_task_pool(&pool);
+    progress_reporter scanned{options, compaction_progress::phase::scan, sources.size()};
+    logscan.set_file_scanned_callback([&scanned](const boost::filesystem::path& p){ scanned.advance(boost::filesystem::file_size(p)); });
+    try {
+        logscan.scan_pwal_files_throws(ld_epoch, add_entry);
+    } catch (std::runtime_error& e) {
+        if (budget.exceeded()) {
+            LOG_LP(ERROR) << "temporary space of compaction exceeds the limit (" << options.temp_space_limit << " bytes)";
+            throw;
+        }
+        VLOG_LP(log_info) << "failed to scan pwal files: " << e.what();
+        LOG(ERROR) << "/:limestone dblogdir (transaction log directory) is corrupted: " << from_dir;
+        throw std::runtime_error("dblogdir is corrupted");
+    }
+
+    // write: each partition into its own segment
+    bool rewind = bottom && !options.preserve_write_versions;
+    bool keep_tombstones = !bottom || options.tombstones == compaction_options::tombstone_mode::retain;
+    std::vector<compacted_file_stat> stats(parts.size());
+    progress_reporter written{options, compaction_progress::phase::write, parts.size()};
+    pool.parallel_for(parts.size(), [&](std::size_t i) {
+        stats[i] = write_compacted_pwal(parts[i]->sortdb.get(), to_dir / gen.files[i], ld_epoch, rewind, keep_tombstones,
+                                        options.persistent_format_version);
+        budget.release(parts[i]->bytes);
+        parts[i].reset();
+        written.advance(stats[i].size);
+    }, static_cast<std::size_t>(options.num_worker));
+
+    std::optional<epoch_id_type> min_epoch{};
+    std::uint64_t dropped_tombstones{0};
+    gen.max_epoch = 0;
+    gen.entries = 0;
+    gen.tombstones = 0;
+    gen.size = 0;
+    for (const auto& stat : stats) {
+        if (stat.min_epoch) {
+            min_epoch = std::min(min_epoch.value_or(*stat.min_epoch), *stat.min_epoch);
+        }
+        gen.max_epoch = std::max(gen.max_epoch, stat.max_epoch);
+        gen.entries += stat.entries;
+        gen.tombstones += stat.tombstones;
+        gen.size += stat.size;
+        dropped_tombstones += stat.dropped_tombstones;
+    }
+    gen.min_epoch = min_epoch.value_or(0);
+    gen.rewound = rewind;
+    return dropped_tombstones;
+}
+
+static void count_retained_tombstones(compaction_result& result) {
+    result.tombstones_retained = 0;
+    for (const auto& gen : result.catalog.generations()) {
+        result.tombstones_retained += gen.tombstones;
+    }
+}
+
+compaction_result create_comapct_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir, const compaction_options& options) {
+    ensure_directory(to_dir);
+    dblog_scan logscan{from_dir};
+    logscan.set_epoch_dir(options.epoch_dir);
+    epoch_id_type ld_epoch = logscan.last_durable_epoch_in_dir();
+
+    compaction_catalog::generation gen{};
+    gen.id = 0;
+    for (std::size_t i = 0; i < std::max(options.num_segments, static_cast<std::size_t>(1)); i++) {
+        gen.files.emplace_back(compaction_catalog::file_name_of(0, i));
+    }
+    gen.sources = list_pwal_files(from_dir, [](const boost::filesystem::path&){ return true; });
+    compaction_result result{};
+    task_pool pool{static_cast<std::size_t>(std::max(options.num_worker, 1))};
+    result.tombstones_dropped = compact_into_generation(from_dir, to_dir, ld_epoch, true, options, pool, gen);
+
+    result.catalog.add_generation(std::move(gen));
+    result.catalog.write(to_dir);
+    count_retained_tombstones(result);
+    return result;
+}
+
+static void link_or_copy_file(const boost::filesystem::path& from, const boost::filesystem::path& to) {
+    boost::system::error_code error;
+    boost::filesystem::create_hard_link(from, to, error);
+    if (error) {
+        // e.g. working directory is on another filesystem
+        VLOG_LP(log_debug) << "cannot make hard link " << to << " (" << error.message() << "), copying the file";
+        boost::filesystem::copy_file(from, to);
+    }
+}
+
+compaction_result create_leveled_compact_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir,
+                                               epoch_id_type ld_epoch, const compaction_options& options,
+                                               std::size_t fanout, std::uintmax_t base_size) {
+    if (fanout < 2) {
+        LOG_LP(ERROR) << "invalid fanout of leveled compaction: " << fanout;
+        throw std::runtime_error("invalid fanout");
+    }
+    compaction_result result{};
+    auto& catalog = result.catalog;
+    catalog = compaction_catalog::from_dir(from_dir);
+    ensure_directory(to_dir);
+    std::size_t segments = std::max(options.num_segments, static_cast<std::size_t>(1));
+    // shared by the compactions of all levels
+    task_pool pool{static_cast<std::size_t>(std::max(options.num_worker, 1))};
+
+    // generations not touched by this compaction are kept as is
+    for (const auto& gen : catalog.generations()) {
+        for (const auto& file : gen.files) {
+            link_or_copy_file(from_dir / file, to_dir / file);
+        }
+    }
+
+    // compact pwal files not yet compacted (delta) into the new generation
+    auto delta_files = list_pwal_files(from_dir, [&catalog](const boost::filesystem::path& p){ return !catalog.contains(p.filename().string()); });
+    if (!delta_files.empty()) {
+        // the delta is the oldest data only if no generation exists
+        bool bottom = catalog.generations().empty();
+        compaction_catalog::generation gen{};
+        gen.sources = std::move(delta_files);
+        auto& added = catalog.add_generation(std::move(gen), segments);
+        result.tombstones_dropped += compact_into_generation(from_dir, to_dir, ld_epoch, bottom, options, pool, added);
+        added.level = compaction_catalog::level_for_size(added.size, base_size, fanout);
+        VLOG_LP(log_info) << "compacted " << added.sources.size() << " pwal files into generation " << added.id << " (level " << added.level << ")";
+    }
+
+    // merge generations while some level has fanout or more generations
+    auto level_of = [base_size, fanout](const compaction_catalog::generation& gen){
+        return compaction_catalog::level_for_size(gen.size, base_size, fanout);
+    };
+    for (;;) {
+        std::map<int, std::vector<compaction_catalog::generation>> levels;
+        for (const auto& gen : catalog.generations()) {
+            levels[level_of(gen)].emplace_back(gen);
+        }
+        auto target = std::find_if(levels.begin(), levels.end(), [fanout](const auto& l){ return l.second.size() >= fanout; });
+        if (target == levels.end()) {
+            break;
+        }
+        const auto& inputs = target->second;
+        std::set<std::uint64_t> input_ids;
+        std::set<std::string> input_files;
+        epoch_id_type inputs_max_epoch{0};
+        for (const auto& gen : inputs) {
+            input_ids.emplace(gen.id);
+            input_files.insert(gen.files.begin(), gen.files.end());
+            inputs_max_epoch = std::max(inputs_max_epoch, gen.max_epoch);
+        }
+        // tombstones can be dropped (and write versions can be rewound) only if
+        // all the generations not merged are newer than the merged ones
+        bool bottom = std::all_of(catalog.generations().begin(), catalog.generations().end(), [&](const auto& gen){
+            return input_ids.count(gen.id) > 0 || gen.min_epoch > inputs_max_epoch;
+        });
+
+        compaction_catalog::generation gen{};
+        gen.sources.assign(input_files.begin(), input_files.end());
+        auto& added = catalog.add_generation(std::move(gen), segments);
+        result.tombstones_dropped += compact_into_generation(to_dir, to_dir, ld_epoch, bottom, options, pool, added);
+        added.level = level_of(added);
+        auto added_id = added.id;
+        for (const auto& input : inputs) {
+            for (const auto& file : input.files) {
+                boost::filesystem::remove(to_dir / file);
+            }
+            catalog.remove_generation(input.id);
+        }
+        VLOG_LP(log_info) << "merged " << inputs.size() << " generations of level " << target->first << " into generation " << added_id;
+    }
+
+    catalog.write(to_dir);
+    count_retained_tombstones(result);
+    return result;
 }
 
 }
@@ -215,7 +646,13 @@ using namespace limestone::internal;
 
 void datastore::create_snapshot() {
     const auto& from_dir = location_;
-    auto [max_appeared_epoch, sortdb] = create_sortdb_from_wals(from_dir, recover_max_parallelism_);
+    // pwal files of the channels striped to the other data locations
+    std::vector<boost::filesystem::path> extra_wal_dirs{};
+    if (data_locations_.size() > 1) {
+        extra_wal_dirs.assign(data_locations_.begin() + 1, data_locations_.end());
+    }
+    std::map<storage_id_type, std::uint64_t> superseded{};
+    auto [max_appeared_epoch, sortdb] = create_sortdb_from_wals(from_dir, *task_pool_, recover_max_parallelism_, extra_wal_dirs, metadata_location_, &superseded);
     epoch_id_switched_.store(max_appeared_epoch);
     epoch_id_informed_.store(max_appeared_epoch);
 
@@ -238,8 +675,33 @@ void datastore::create_snapshot() {
         throw std::runtime_error("I/O error");
     }
     setvbuf(ostrm, nullptr, _IOFBF, 128L * 1024L);  // NOLINT, NB. glibc may ignore size when _IOFBF and buffer=NULL
-    auto write_snapshot_entry = [&ostrm](std::string_view key, std::string_view value){log_entry::write(ostrm, key, value);};
-    sortdb_foreach(sortdb.get(), write_snapshot_entry);
+    // the snapshot file is made at every start, so always with checksums, which are verified by the cursor
+    // the statistics of the storages are collected on the way; the keys of a storage are usually adjacent
+    storage_stats_.clear();
+    storage_stats* last_stats{};
+    storage_id_type last_storage_id{};
+    auto stats_of = [this, &last_stats, &last_storage_id](std::string_view key_sid) -> storage_stats& {
+        storage_id_type storage_id{};
+        std::memcpy(&storage_id, key_sid.data(), sizeof(storage_id_type));
+        if (last_stats == nullptr || storage_id != last_storage_id) {
+            last_stats = &storage_stats_[storage_id];
+            last_storage_id = storage_id;
+        }
+        return *last_stats;
+    };
+    auto write_snapshot_entry = [&ostrm, &stats_of](std::string_view key, std::string_view value){
+        log_entry::write(ostrm, key, value, true);
+        auto& stats = stats_of(key);
+        stats.entries_++;
+        stats.key_bytes_ += key.size() - sizeof(storage_id_type);
+        stats.value_bytes_ += value.size() - write_version_size;
+    };
+    auto count_tombstone = [&stats_of](std::string_view key, std::string_view){ stats_of(key).tombstones_++; };
+    auto count_superseded = [&stats_of](std::string_view key){ stats_of(key).superseded_versions_++; };
+    sortdb_foreach(sortdb.get(), write_snapshot_entry, count_tombstone, count_superseded);
+    for (const auto& [storage_id, count] : superseded) {
+        storage_stats_[storage_id].superseded_versions_ += count;
+    }
     if (fclose(ostrm) != 0) {  // NOLINT(*-owning-memory)
         LOG_LP(ERROR) << "cannot close snapshot file (" << snapshot_file << "), errno = " << errno;
         throw std::runtime_error("I/O error");
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <array>
 #include <iomanip>
+#include <optional>
 #include <boost/filesystem.hpp>
 
 #include <glog/logging.h>
@@ -55,8 +58,69 @@ std::optional<epoch_id_type> last_durable_epoch(const boost::filesystem::path& f
     return rv;
 }
 
+// return the epoch of the last record in file, which is the max epoch as durable markers are appended in ascending order.
+// fall back to last_durable_epoch() if the last record does not look like a durable marker.
+std::optional<epoch_id_type> last_durable_epoch_from_tail(const boost::filesystem::path& file) {
+    constexpr std::size_t record_size = 1 + sizeof(std::uint64_t);  // type + epoch
+
+    boost::system::error_code error;
+    std::uintmax_t size = boost::filesystem::file_size(file, error);
+    if (error) {
+        LOG_LP(ERROR) << "cannot get the size of epoch file: " << file << ": " << error.message();
+        throw std::runtime_error("cannot read epoch file");
+    }
+    if (size == 0) {
+        return {};
+    }
+    if (size % record_size != 0) {
+        return last_durable_epoch(file);
+    }
+    boost::filesystem::ifstream istrm;
+    istrm.open(file, std::ios_base::in | std::ios_base::binary);
+    if (!istrm) {  // permission?
+        LOG_LP(ERROR) << "cannot read epoch file: " << file;
+        throw std::runtime_error("cannot read epoch file");
+    }
+    std::array<unsigned char, record_size> buf{};
+    istrm.seekg(-static_cast<std::streamoff>(record_size), std::ios_base::end);
+    istrm.read(reinterpret_cast<char*>(buf.data()), record_size);  // NOLINT(*-reinterpret-cast)
+    if (!istrm || buf[0] != static_cast<unsigned char>(log_entry::entry_type::marker_durable)) {
+        istrm.close();
+        return last_durable_epoch(file);
+    }
+    istrm.close();
+    std::uint64_t epoch = 0;
+    for (std::size_t i = record_size - 1; i > 0; i--) {
+        epoch = (epoch << 8U) | buf.at(i);
+    }
+    return static_cast<epoch_id_type>(epoch);
+}
+
+std::optional<epoch_id_type> durable_epoch_of_rotated_epoch_file(std::string_view filename) {
+    // "epoch.<time>.<switched epoch>.<durable epoch>"
+    std::size_t dots = 0;
+    std::size_t last_dot = 0;
+    for (std::size_t i = 0; i < filename.size(); i++) {
+        if (filename[i] == '.') {
+            dots++;
+            last_dot = i;
+        }
+    }
+    if (dots != 3 || filename.rfind("epoch.", 0) != 0 || last_dot + 1 == filename.size()) {
+        return {};
+    }
+    std::uint64_t epoch = 0;
+    for (char c : filename.substr(last_dot + 1)) {
+        if (c < '0' || '9' < c) {
+            return {};
+        }
+        epoch = epoch * 10 + static_cast<std::uint64_t>(c - '0');
+    }
+    return static_cast<epoch_id_type>(epoch);
+}
+
 epoch_id_type dblog_scan::last_durable_epoch_in_dir() {
-    auto& from_dir = dblogdir_;
+    auto& from_dir = epoch_dir_.empty() ? dblogdir_ : epoch_dir_;
     // read main epoch file first
     auto main_epoch_file = from_dir / std::string(epoch_file_name);
     if (!boost::filesystem::exists(main_epoch_file)) {
@@ -65,17 +129,25 @@ epoch_id_type dblog_scan::last_durable_epoch_in_dir() {
         LOG_LP(ERROR) << "epoch file does not exist: " << main_epoch_file;
         throw std::runtime_error("epoch file does not exist");
     }
-    std::optional<epoch_id_type> ld_epoch = last_durable_epoch(main_epoch_file);
+    std::optional<epoch_id_type> ld_epoch = last_durable_epoch_from_tail(main_epoch_file);
     if (ld_epoch.has_value()) {
         return *ld_epoch;
     }
 
     // main epoch file is empty,
-    // read all rotated-epoch files
+    // look up all rotated-epoch files; the durable epoch is in the file name if rotated by the current datastore,
+    // otherwise read the last record of the file
     for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(from_dir)) {
-        if (p.filename().string().rfind(epoch_file_name, 0) == 0) {  // starts_with(epoch_file_name)
-            // this is epoch file (main one or rotated)
-            std::optional<epoch_id_type> epoch = last_durable_epoch(p);
+        auto filename = p.filename().string();
+        if (filename == epoch_tmp_file_name) {
+            continue;  // not rotated one, may be incomplete
+        }
+        if (filename.rfind(epoch_file_name, 0) == 0 && filename.size() > epoch_file_name.size()) {  // starts_with(epoch_file_name), and not main one
+            // this is rotated epoch file
+            std::optional<epoch_id_type> epoch = durable_epoch_of_rotated_epoch_file(filename);
+            if (!epoch.has_value()) {
+                epoch = last_durable_epoch_from_tail(p);
+            }
             if (!epoch.has_value()) {
                 continue;  // file is empty
             }
@@ -105,10 +177,46 @@ epoch_id_type scan_one_pwal_file(const boost::filesystem::path& p, epoch_id_type
     return rc;
 }
 
+std::vector<boost::filesystem::path> dblog_scan::files_in_dirs(bool larger_first) const {
+    std::vector<std::vector<boost::filesystem::path>> lists{};
+    lists.emplace_back(boost::filesystem::directory_iterator(dblogdir_), boost::filesystem::directory_iterator());
+    for (const auto& dir : extra_wal_dirs_) {
+        lists.emplace_back(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator());
+    }
+    if (larger_first) {
+        for (auto& list : lists) {
+            std::vector<std::pair<std::uintmax_t, boost::filesystem::path>> sized{};
+            sized.reserve(list.size());
+            for (auto& p : list) {
+                boost::system::error_code error;
+                auto size = boost::filesystem::is_regular_file(p, error) ? boost::filesystem::file_size(p, error) : 0;
+                sized.emplace_back(error ? 0 : size, std::move(p));
+            }
+            std::stable_sort(sized.begin(), sized.end(), [](const auto& a, const auto& b){ return a.first > b.first; });
+            for (std::size_t i = 0; i < sized.size(); i++) {
+                list.at(i) = std::move(sized.at(i).second);
+            }
+        }
+    }
+    std::size_t max_size = 0;
+    for (const auto& list : lists) {
+        max_size = std::max(max_size, list.size());
+    }
+    std::vector<boost::filesystem::path> files{};
+    for (std::size_t i = 0; i < max_size; i++) {
+        for (const auto& list : lists) {
+            if (i < list.size()) {
+                files.emplace_back(list.at(i));
+            }
+        }
+    }
+    return files;
+}
+
 void dblog_scan::detach_wal_files(bool skip_empty_files) {
     // rotate_attached_wal_files
     std::vector<boost::filesystem::path> attached_files;
-    for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(dblogdir_)) {
+    for (const boost::filesystem::path& p : files_in_dirs()) {
         if (is_wal(p) && !is_detached_wal(p)) {
             if (skip_empty_files && boost::filesystem::is_empty(p)) {
                 continue;
@@ -139,7 +247,7 @@ epoch_id_type dblog_scan::scan_pwal_files(  // NOLINT(readability-function-cogni
     if (max_parse_error_value) { *max_parse_error_value = dblog_scan::parse_error::failed; }
     std::atomic<dblog_scan::parse_error::code> max_error_value{dblog_scan::parse_error::code::ok};
     auto process_file = [&](const boost::filesystem::path& p) {  // NOLINT(readability-function-cognitive-complexity)
-        if (is_wal(p)) {
+        if (is_wal(p) && (!file_filter_ || file_filter_(p))) {
             parse_error ec;
             auto rc = scan_one_pwal_file(p, ld_epoch, add_entry, report_error, ec);
             epoch_id_type max_epoch_of_file = rc;
@@ -192,44 +300,20 @@ epoch_id_type dblog_scan::scan_pwal_files(  // NOLINT(readability-function-cogni
                    && !max_appeared_epoch.compare_exchange_weak(t, max_epoch_of_file)) {
                 /* nop */
             }
+            if (file_scanned_) {
+                file_scanned_(p);
+            }
         }
     };
-    std::mutex dir_mtx;
-    auto dir_begin = boost::filesystem::directory_iterator(dblogdir_);
-    auto dir_end = boost::filesystem::directory_iterator();
-    std::vector<std::thread> workers;
-    std::mutex ex_mtx;
-    std::exception_ptr ex_ptr{};
-    workers.reserve(thread_num_);
-    for (int i = 0; i < thread_num_; i++) {
-        workers.emplace_back(std::thread([&](){
-            for (;;) {
-                boost::filesystem::path p;
-                {
-                    std::lock_guard<std::mutex> g{dir_mtx};
-                    if (dir_begin == dir_end) break;
-                    p = *dir_begin++;
-                }
-                try {
-                    process_file(p);
-                } catch (std::runtime_error& ex) {
-                    VLOG(log_info) << "/:limestone catch runtime_error(" << ex.what() << ")";
-                    std::lock_guard<std::mutex> g2{ex_mtx};
-                    if (!ex_ptr) {  // only save one
-                        ex_ptr = std::current_exception();
-                    }
-                    std::lock_guard<std::mutex> g{dir_mtx};
-                    dir_begin = dir_end;  // skip all unprocessed files
-                    break;
-                }
-            }
-        }));
-    }
-    for (int i = 0; i < thread_num_; i++) {
-        workers[i].join();
-    }
-    if (ex_ptr) {
-        std::rethrow_exception(ex_ptr);
+    auto files = files_in_dirs(true);
+    // the threads of this call, if not shared with the other phases
+    std::optional<task_pool> own_pool{};
+    task_pool* pool = task_pool_ != nullptr ? task_pool_ : &own_pool.emplace(thread_num_);
+    try {
+        pool->parallel_for(files.size(), [&](std::size_t i) { process_file(files.at(i)); }, static_cast<std::size_t>(thread_num_));
+    } catch (std::runtime_error& ex) {
+        VLOG(log_info) << "/:limestone catch runtime_error(" << ex.what() << ")";
+        throw;
     }
     if (max_parse_error_value) { *max_parse_error_value = max_error_value; }
     return max_appeared_epoch;
@@ -242,6 +326,8 @@ epoch_id_type dblog_scan::scan_pwal_files_throws(epoch_id_type ld_epoch, const s
     set_process_at_nondurable_epoch_snippet(process_at_nondurable::repair_by_mark);
     set_process_at_truncated_epoch_snippet(process_at_truncated::report);
     set_process_at_damaged_epoch_snippet(process_at_damaged::report);
+    // every error aborts the scan by log_error_and_throw
+    split_files_ = true;
     return scan_pwal_files(ld_epoch, add_entry, log_error_and_throw);
 }
 
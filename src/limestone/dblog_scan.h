@@ -19,6 +19,7 @@
 #include <limestone/api/datastore.h>
 #include "internal.h"
 #include "log_entry.h"
+#include "task_pool.h"
 
 namespace limestone::internal {
 // accessing dblogdir before db start
@@ -30,6 +31,12 @@ class dblog_scan {
      */
     static constexpr const std::string_view epoch_file_name = "epoch";  /* datastore::epoch_file_name */
 
+    // XXX: copied from datastore.h, resolve dup
+    /**
+     * @brief name of a file to be renamed to the epoch file, left if crashed while compacting the epoch file
+     */
+    static constexpr const std::string_view epoch_tmp_file_name = "epoch.tmp";  /* datastore::epoch_tmp_file_name */
+
     // XXX: copied from log_channel.h, resolve dup
     /**
      * @brief prefix of pwal file name
@@ -82,13 +89,55 @@ public:
     };
 
     using error_report_func_t = std::function<bool(log_entry::read_error&)>;
+    using snippet_scanned_func_t = std::function<void(const boost::filesystem::path& file, epoch_id_type epoch,
+                                                      std::streamoff offset, std::streamoff length, bool valid)>;
 
     explicit dblog_scan(const boost::filesystem::path& logdir) : dblogdir_(logdir) { }
     explicit dblog_scan(boost::filesystem::path&& logdir) : dblogdir_(std::move(logdir)) { }
 
     const boost::filesystem::path& get_dblogdir() { return dblogdir_; }
+    /**
+     * @brief set the number of the pwal files (or their parts) scanned at a time
+     */
     void set_thread_num(int thread_num) noexcept { thread_num_ = thread_num; }
+    /**
+     * @brief set the threads to scan the pwal files, shared with the other phases
+     * @details if not set, scan_pwal_files makes its own threads of thread_num for each call.
+     */
+    void set_task_pool(task_pool* pool) noexcept { task_pool_ = pool; }
+    /**
+     * @brief set the size of the parts of a pwal file scanned in parallel by scan_pwal_files_throws with set_task_pool()
+     * @details a pwal file larger than this is divided at the epoch snippets with the lengths (persistent format version 3
+     * or later) into the parts of about this size, so that a large file is not left to one thread. 0 not to divide.
+     */
+    void set_split_size(std::uintmax_t split_size) noexcept { split_size_ = split_size; }
     void set_fail_fast(bool fail_fast) noexcept { fail_fast_ = fail_fast; }
+    /**
+     * @brief restrict the pwal files to be scanned
+     * @param filter returns true for the files to be scanned, or nullptr to scan all pwal files in the directory
+     */
+    void set_file_filter(std::function<bool(const boost::filesystem::path&)> filter) noexcept { file_filter_ = std::move(filter); }
+    /**
+     * @brief set the function called after each pwal file is scanned by scan_pwal_files
+     * @note the function is called from the scanning threads concurrently
+     */
+    void set_file_scanned_callback(std::function<void(const boost::filesystem::path&)> callback) noexcept { file_scanned_ = std::move(callback); }
+    /**
+     * @brief set the function called at the end of each epoch snippet scanned
+     * @details the function is called just after the entries of the epoch snippet are passed to add_entry, in the same thread.
+     * length is the size of the epoch snippet including its header, up to the broken part if any;
+     * valid is false if the entries of the epoch snippet are not processed (invalidated or nondurable).
+     */
+    void set_snippet_scanned_callback(snippet_scanned_func_t callback) noexcept { snippet_scanned_ = std::move(callback); }
+    /**
+     * @brief set the directories which contain pwal files in addition to dblogdir (striped logging)
+     * @details the epoch files are read only from dblogdir.
+     */
+    void set_extra_wal_dirs(std::vector<boost::filesystem::path> dirs) noexcept { extra_wal_dirs_ = std::move(dirs); }
+    /**
+     * @brief set the directory of the epoch files, if not dblogdir (metadata_location)
+     */
+    void set_epoch_dir(boost::filesystem::path dir) noexcept { epoch_dir_ = std::move(dir); }
     void detach_wal_files(bool skip_empty_files = true);
 
     enum class process_at_nondurable {
@@ -139,16 +188,50 @@ public:
         const error_report_func_t& report_error,
         parse_error& pe);
 
+    /**
+     * @returns the ranges of the parts of the pwal file mapped on data, divided by the split size;
+     * each of them but the first starts with an epoch snippet header, one range of the whole file if not divided
+     */
+    std::vector<std::pair<std::streamoff, std::streamoff>> split_pwal_file(const char* data, std::size_t size) const;
+
     static bool is_wal(const boost::filesystem::path& p) { return p.filename().string().rfind(pwal_prefix, 0) == 0; }
     static bool is_detached_wal(const boost::filesystem::path& p) {
         auto filename = p.filename().string();
         return (filename.length() > 9 && filename.rfind(pwal_prefix, 0) == 0);
     }
 
+    /**
+     * @returns the files in dblogdir and the extra pwal directories,
+     * taking one file from each directory in turn so that the directories are read in parallel
+     * @param larger_first order the files in each directory by size, larger first,
+     * so that a large file is not left to the end of a parallel scan
+     */
+    std::vector<boost::filesystem::path> files_in_dirs(bool larger_first = false) const;
+
+    /**
+     * @brief default of set_split_size()
+     */
+    static constexpr std::uintmax_t default_split_size = 64UL * 1024 * 1024;
+
 private:
     boost::filesystem::path dblogdir_;
+    std::vector<boost::filesystem::path> extra_wal_dirs_{};
+    boost::filesystem::path epoch_dir_{};
     int thread_num_{1};
+    task_pool* task_pool_{};
+    std::uintmax_t split_size_{default_split_size};
+    // the pwal files may be divided, only if every broken entry in a durable epoch snippet aborts the whole scan
+    bool split_files_{false};
+
+    // scan the part of the pwal file mapped on data from begin to end;
+    // the offsets of the epoch snippets to be marked invalid are added to marks, and the number of them to fixed
+    epoch_id_type scan_pwal_range(const boost::filesystem::path& p, const char* data, std::streamoff begin, std::streamoff end,
+        epoch_id_type ld_epoch, const std::function<void(log_entry&)>& add_entry, const error_report_func_t& report_error,
+        parse_error& pe, std::vector<std::streamoff>& marks, int& fixed);
     bool fail_fast_{false};
+    std::function<bool(const boost::filesystem::path&)> file_filter_{};
+    std::function<void(const boost::filesystem::path&)> file_scanned_{};
+    snippet_scanned_func_t snippet_scanned_{};
 
     // repair-nondurable-epoch-snippet
     //   (implemented in 1.0.0 BETA2)
@@ -14,9 +14,15 @@
  * limitations under the License.
  */
 
+#include <array>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <stdlib.h>  // NOLINT(*-deprecated-headers): <cstdlib> does not provide std::mkdtemp
 #include <glog/logging.h>
+#include <nlohmann/json.hpp>
 #include <limestone/logging.h>
 #include "logging_helper.h"
 
@@ -33,6 +39,7 @@ DEFINE_string(epoch, "", "specify valid epoch upper limit");
 DEFINE_int32(thread_num, 1, "specify thread num of scanning wal file");
 DEFINE_bool(h, false, "display help message");
 DEFINE_bool(verbose, false, "verbose");
+DEFINE_string(metadata_location, "", "directory of the epoch files and the manifest file, if not placed in dblogdir");
 
 // inspect, repair
 DEFINE_bool(cut, false, "repair by cutting for error-truncate and error-broken");
@@ -44,6 +51,12 @@ DEFINE_bool(force, false, "(subcommand compaction) skip start prompt");
 DEFINE_bool(dry_run, false, "(subcommand compaction) dry run");
 DEFINE_string(working_dir, "", "(subcommand compaction) working directory");
 DEFINE_bool(make_backup, false, "(subcommand compaction) make backup of target dblogdir");
+DEFINE_bool(leveled, false, "(subcommand compaction) compact only new pwal files, and merge compacted files level by level");
+DEFINE_int32(level_fanout, 4, "(subcommand compaction) number of compacted files in a level to be merged, for leveled compaction");
+DEFINE_int32(segments, 1, "(subcommand compaction) number of compacted pwal files written in parallel");
+DEFINE_string(temp_space_limit, "", "(subcommand compaction) upper limit of temporary space used by compaction (e.g. 100G)");
+DEFINE_string(tombstones, "auto", "(subcommand compaction) handling of remove entries (auto/retain)");
+DEFINE_bool(preserve_write_versions, false, "(subcommand compaction) keep write versions of entries instead of clearing them");
 
 enum subcommand {
     cmd_inspect,
@@ -58,8 +71,137 @@ void log_and_exit(int error) {
 
 namespace limestone {
 
-void inspect(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
-    std::cout << "persistent-format-version: 1" << std::endl;
+// statistics of the durable entries, printed by inspect with --output_format=machine-readable
+class entry_stats {
+public:
+    void add(log_entry& e) {
+        if (e.type() == log_entry::entry_type::normal_entry) {
+            normal_entries_++;
+        } else {
+            remove_entries_++;
+        }
+        auto key_size = e.key_sid().size() - sizeof(storage_id_type);
+        auto value_size = e.type() == log_entry::entry_type::normal_entry ? e.value_etc().size() - sizeof(epoch_id_type) - sizeof(std::uint64_t) : 0;
+        key_bytes_ += key_size;
+        value_bytes_ += value_size;
+        key_size_histogram_.at(bucket_of(key_size))++;
+        value_size_histogram_.at(bucket_of(value_size))++;
+        storages_[e.storage()]++;
+    }
+
+    void merge(const entry_stats& other) {
+        normal_entries_ += other.normal_entries_;
+        remove_entries_ += other.remove_entries_;
+        key_bytes_ += other.key_bytes_;
+        value_bytes_ += other.value_bytes_;
+        for (std::size_t i = 0; i < histogram_buckets; i++) {
+            key_size_histogram_.at(i) += other.key_size_histogram_.at(i);
+            value_size_histogram_.at(i) += other.value_size_histogram_.at(i);
+        }
+        for (const auto& [storage_id, count] : other.storages_) {
+            storages_[storage_id] += count;
+        }
+    }
+
+    void to_json(nlohmann::json& json) const {
+        json["normal_entries"] = normal_entries_;
+        json["remove_entries"] = remove_entries_;
+        json["key_bytes"] = key_bytes_;
+        json["value_bytes"] = value_bytes_;
+        json["key_size_histogram"] = histogram_to_json(key_size_histogram_);
+        json["value_size_histogram"] = histogram_to_json(value_size_histogram_);
+        auto& storages = json["storages"] = nlohmann::json::object();
+        for (const auto& [storage_id, count] : storages_) {
+            storages[std::to_string(storage_id)] = count;
+        }
+    }
+
+private:
+    // bucket i counts the sizes in [2^(i-1), 2^i), bucket 0 counts the size 0
+    static constexpr std::size_t histogram_buckets = 33;
+    using histogram = std::array<std::uint64_t, histogram_buckets>;
+
+    static std::size_t bucket_of(std::size_t size) {
+        std::size_t bucket = 0;
+        while (size > 0 && bucket < histogram_buckets - 1) {
+            size >>= 1U;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    static nlohmann::json histogram_to_json(const histogram& h) {
+        // trailing empty buckets are omitted
+        std::size_t n = histogram_buckets;
+        while (n > 0 && h.at(n - 1) == 0) {
+            n--;
+        }
+        return std::vector<std::uint64_t>(h.begin(), h.begin() + static_cast<std::ptrdiff_t>(n));
+    }
+
+    std::uint64_t normal_entries_{};
+    std::uint64_t remove_entries_{};
+    std::uint64_t key_bytes_{};
+    std::uint64_t value_bytes_{};
+    histogram key_size_histogram_{};
+    histogram value_size_histogram_{};
+    std::map<storage_id_type, std::uint64_t> storages_{};
+};
+
+// the statistics of the pwal file being scanned by this thread;
+// each pwal file is scanned by one thread from its beginning to end
+struct file_stats {
+    entry_stats snippet{};
+    entry_stats file{};
+    std::uint64_t snippets{};
+    std::uint64_t invalid_snippets{};
+};
+static thread_local file_stats current_file_stats{};  // NOLINT(*-avoid-non-const-global-variables)
+
+static void add_to_stats(log_entry& e) {
+    current_file_stats.snippet.add(e);
+}
+
+// print the statistics of each epoch snippet and pwal file in JSON Lines, gathered by the scanning threads
+static void set_stats_callbacks(dblog_scan &ds, std::mutex& mtx_out) {
+    ds.set_snippet_scanned_callback([&mtx_out](const boost::filesystem::path& p, epoch_id_type epoch, std::streamoff offset, std::streamoff length, bool valid) {
+        nlohmann::json json{
+            {"type", "snippet"},
+            {"file", p.filename().string()},
+            {"epoch", epoch},
+            {"offset", offset},
+            {"length", length},
+            {"valid", valid},
+        };
+        current_file_stats.snippet.to_json(json);
+        current_file_stats.file.merge(current_file_stats.snippet);
+        current_file_stats.snippet = entry_stats{};
+        current_file_stats.snippets++;
+        if (!valid) {
+            current_file_stats.invalid_snippets++;
+        }
+        std::lock_guard<std::mutex> lock(mtx_out);
+        std::cout << json.dump() << std::endl;
+    });
+    ds.set_file_scanned_callback([&mtx_out](const boost::filesystem::path& p) {
+        boost::system::error_code error;
+        auto size = boost::filesystem::file_size(p, error);
+        nlohmann::json json{
+            {"type", "file"},
+            {"file", p.filename().string()},
+            {"size", error ? std::uintmax_t{0} : size},
+            {"snippets", current_file_stats.snippets},
+            {"invalid_snippets", current_file_stats.invalid_snippets},
+        };
+        current_file_stats.file.to_json(json);
+        current_file_stats = file_stats{};
+        std::lock_guard<std::mutex> lock(mtx_out);
+        std::cout << json.dump() << std::endl;
+    });
+}
+
+void inspect(dblog_scan &ds, std::optional<epoch_id_type> epoch, int persistent_format_version) {
+    std::cout << "persistent-format-version: " << persistent_format_version << std::endl;
     epoch_id_type ld_epoch{};
     try {
         ld_epoch = ds.last_durable_epoch_in_dir();
@@ -74,6 +216,11 @@ void inspect(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
     ds.set_process_at_truncated_epoch_snippet(dblog_scan::process_at_truncated::report);
     ds.set_process_at_damaged_epoch_snippet(dblog_scan::process_at_damaged::report);
     ds.set_fail_fast(false);
+    std::mutex mtx_out{};
+    bool stats = FLAGS_output_format == "machine-readable";
+    if (stats) {
+        set_stats_callbacks(ds, mtx_out);
+    }
     dblog_scan::parse_error::code max_ec{};
     epoch_id_type max_appeared_epoch = ds.scan_pwal_files(epoch.value_or(ld_epoch), [&](log_entry& e){
         if (e.type() == log_entry::entry_type::normal_entry) {
@@ -84,6 +231,10 @@ void inspect(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
             count_remove_entry++;
         } else {
             LOG(ERROR) << static_cast<int>(e.type());
+            return;
+        }
+        if (stats) {
+            add_to_stats(e);
         }
     }, [](log_entry::read_error& ec){
         VLOG(30) << "ERROR " << ec.value() << " : " << ec.message();
@@ -176,11 +327,61 @@ static boost::filesystem::path make_work_dir_next_to(const boost::filesystem::pa
     return make_tmp_dir_next_to(target_dir, ".work_XXXXXX");
 }
 
+// parse size with optional binary suffix (K, M, G, T)
+static std::optional<std::uintmax_t> parse_size(const std::string& str) {
+    if (str.empty() || str[0] < '0' || '9' < str[0]) {
+        return std::nullopt;  // std::stoull accepts a sign and leading spaces
+    }
+    std::size_t idx{};
+    std::uintmax_t size{};
+    try {
+        size = std::stoull(str, &idx);
+    } catch (std::exception& e) {
+        return std::nullopt;
+    }
+    std::string_view suffix{str.c_str() + idx};  // NOLINT(*-pointer-arithmetic)
+    constexpr std::string_view units = "KMGT";
+    if (suffix.empty()) {
+        return size;
+    }
+    auto pos = units.find(suffix[0]);
+    if (suffix.size() != 1 || pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    auto shift = 10U * (pos + 1);
+    if (size > (UINTMAX_MAX >> shift)) {
+        return std::nullopt;  // overflow
+    }
+    return size << shift;
+}
+
+// prints progress of compaction at most once per second, and at the end of each phase
+class compaction_progress_printer {
+public:
+    void print(const compaction_progress& progress) {
+        auto now = std::chrono::steady_clock::now();
+        if (progress.done < progress.total && now - last_print_ < std::chrono::seconds(1)) {
+            return;
+        }
+        last_print_ = now;
+        double mib = static_cast<double>(progress.bytes) / (1024.0 * 1024.0);
+        double sec = std::chrono::duration<double>(progress.elapsed).count();
+        bool scan = progress.current == compaction_progress::phase::scan;
+        std::cout << "compaction-progress: " << (scan ? "scanned " : "written ")
+                  << progress.done << "/" << progress.total << (scan ? " pwal files, " : " compacted files, ")
+                  << std::fixed << std::setprecision(1) << mib << " MiB, "
+                  << (sec > 0 ? mib / sec : 0.0) << " MiB/s" << std::defaultfloat << std::endl;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_print_{};
+};
+
 static boost::filesystem::path make_backup_dir_next_to(const boost::filesystem::path& target_dir) {
     return make_tmp_dir_next_to(target_dir, ".backup_XXXXXX");
 }
 
-void compaction(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
+void compaction(dblog_scan &ds, std::optional<epoch_id_type> epoch, int persistent_format_version) {
     epoch_id_type ld_epoch{};
     if (epoch.has_value()) {
         ld_epoch = epoch.value();
@@ -193,6 +394,32 @@ void compaction(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
         }
         std::cout << "durable-epoch: " << ld_epoch << std::endl;
     }
+    if (FLAGS_leveled && FLAGS_level_fanout < 2) {
+        LOG(ERROR) << "invalid value for --level_fanout option";
+        log_and_exit(64);
+    }
+    if (FLAGS_segments < 1) {
+        LOG(ERROR) << "invalid value for --segments option";
+        log_and_exit(64);
+    }
+    compaction_options::tombstone_mode tombstones{};
+    if (FLAGS_tombstones == "auto") {
+        tombstones = compaction_options::tombstone_mode::automatic;
+    } else if (FLAGS_tombstones == "retain") {
+        tombstones = compaction_options::tombstone_mode::retain;
+    } else {
+        LOG(ERROR) << "invalid value for --tombstones option";
+        log_and_exit(64);
+    }
+    std::uintmax_t temp_space_limit{0};
+    if (!FLAGS_temp_space_limit.empty()) {
+        auto limit = parse_size(FLAGS_temp_space_limit);
+        if (!limit.has_value() || limit.value() == 0) {
+            LOG(ERROR) << "invalid value for --temp_space_limit option";
+            log_and_exit(64);
+        }
+        temp_space_limit = limit.value();
+    }
     auto from_dir = ds.get_dblogdir();
     boost::filesystem::path tmp;
     if (!FLAGS_working_dir.empty()) {
@@ -214,31 +441,60 @@ void compaction(dblog_scan &ds, std::optional<epoch_id_type> epoch) {
         }
     }
 
-    setup_initial_logdir(tmp);
+    // keep the persistent format version, the older servers may use the directory;
+    // if the metadata files are placed on metadata_location, they are kept there as they are
+    bool with_metadata = FLAGS_metadata_location.empty();
+    if (with_metadata) {
+        setup_initial_logdir(tmp, persistent_format_version);
+    }
 
     VLOG_LP(log_info) << "making compact pwal file to " << tmp;
-    create_comapct_pwal(from_dir, tmp, FLAGS_thread_num);
+    compaction_progress_printer printer{};
+    compaction_options options{};
+    options.num_worker = FLAGS_thread_num;
+    options.num_segments = FLAGS_segments;
+    options.temp_space_limit = temp_space_limit;
+    options.tombstones = tombstones;
+    options.preserve_write_versions = FLAGS_preserve_write_versions;
+    options.persistent_format_version = persistent_format_version;
+    options.epoch_dir = FLAGS_metadata_location;
+    options.report_progress = [&printer](const compaction_progress& progress){ printer.print(progress); };
+    auto start = std::chrono::steady_clock::now();
+    compaction_result result{};
+    if (FLAGS_leveled) {
+        result = create_leveled_compact_pwal(from_dir, tmp, ld_epoch, options,
+                                             FLAGS_level_fanout, compaction_catalog::default_level_base_size);
+        std::cout << "compacted-generations: " << result.catalog.generations().size() << std::endl;
+    } else {
+        result = create_comapct_pwal(from_dir, tmp, options);
+    }
+    std::cout << "tombstones-retained: " << result.tombstones_retained << std::endl;
+    std::cout << "tombstones-dropped: " << result.tombstones_dropped << std::endl;
+    std::cout << "compaction-time: " << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::defaultfloat << std::endl;
 
     // epoch file
-    VLOG_LP(log_info) << "making compact epoch file to " << tmp;
-    FILE* strm = fopen((tmp / "epoch").c_str(), "a");  // NOLINT(*-owning-memory)
-    if (!strm) {
-        LOG_LP(ERROR) << "fopen failed, errno = " << errno;
-        throw std::runtime_error("I/O error");
-    }
-    // TODO: if to-flat mode, set ld_epoch := 1
-    log_entry::durable_epoch(strm, ld_epoch);
-    if (fflush(strm) != 0) {
-        LOG_LP(ERROR) << "fflush failed, errno = " << errno;
-        throw std::runtime_error("I/O error");
-    }
-    if (fsync(fileno(strm)) != 0) {
-        LOG_LP(ERROR) << "fsync failed, errno = " << errno;
-        throw std::runtime_error("I/O error");
-    }
-    if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
-        LOG_LP(ERROR) << "fclose failed, errno = " << errno;
-        throw std::runtime_error("I/O error");
+    if (with_metadata) {
+        VLOG_LP(log_info) << "making compact epoch file to " << tmp;
+        FILE* strm = fopen((tmp / "epoch").c_str(), "a");  // NOLINT(*-owning-memory)
+        if (!strm) {
+            LOG_LP(ERROR) << "fopen failed, errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
+        // TODO: if to-flat mode, set ld_epoch := 1
+        log_entry::durable_epoch(strm, ld_epoch);
+        if (fflush(strm) != 0) {
+            LOG_LP(ERROR) << "fflush failed, errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
+        if (fsync(fileno(strm)) != 0) {
+            LOG_LP(ERROR) << "fsync failed, errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
+        if (fclose(strm) != 0) {  // NOLINT(*-owning-memory)
+            LOG_LP(ERROR) << "fclose failed, errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
     }
 
     if (FLAGS_dry_run) {
@@ -290,13 +546,25 @@ int main(char *dir, subcommand mode) {  // NOLINT
         LOG(ERROR) << "dblogdir not exists";
         log_and_exit(64);
     }
+    boost::filesystem::path metadata_dir = p;
+    if (!FLAGS_metadata_location.empty()) {
+        metadata_dir = FLAGS_metadata_location;
+        std::cout << "metadata-location: " << metadata_dir << std::endl;
+        if (!boost::filesystem::exists(metadata_dir)) {
+            LOG(ERROR) << "metadata location not exists";
+            log_and_exit(64);
+        }
+    }
     try {
-        check_logdir_format(p);
+        int persistent_format_version = check_logdir_format(metadata_dir);
         dblog_scan ds(p);
+        if (!FLAGS_metadata_location.empty()) {
+            ds.set_epoch_dir(metadata_dir);
+        }
         ds.set_thread_num(FLAGS_thread_num);
-        if (mode == cmd_inspect) inspect(ds, opt_epoch);
+        if (mode == cmd_inspect) inspect(ds, opt_epoch, persistent_format_version);
         if (mode == cmd_repair) repair(ds, opt_epoch);
-        if (mode == cmd_compaction) compaction(ds, opt_epoch);
+        if (mode == cmd_compaction) compaction(ds, opt_epoch, persistent_format_version);
     } catch (std::runtime_error& e) {
         LOG(ERROR) << e.what();
         log_and_exit(64);
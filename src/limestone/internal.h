@@ -16,11 +16,16 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <optional>
 
 #include <boost/filesystem.hpp>
 
 #include <limestone/api/datastore.h>
+#include "compaction_catalog.h"
+#include "compaction_options.h"
+#include "persistent_format.h"
 
 namespace limestone::internal {
 using namespace limestone::api;
@@ -30,6 +35,12 @@ using namespace limestone::api;
 // return max epoch in file.
 std::optional<epoch_id_type> last_durable_epoch(const boost::filesystem::path& file);
 
+// return the epoch of the last durable marker in file, reading only the tail of the file when possible.
+std::optional<epoch_id_type> last_durable_epoch_from_tail(const boost::filesystem::path& file);
+
+// return the durable epoch carried by the name of the rotated epoch file, if any.
+std::optional<epoch_id_type> durable_epoch_of_rotated_epoch_file(std::string_view filename);
+
 // deprecated, to be removed
 epoch_id_type scan_one_pwal_file(const boost::filesystem::path& pwal, epoch_id_type ld_epoch, const std::function<void(log_entry&)>& add_entry);
 
@@ -37,21 +48,52 @@ epoch_id_type scan_one_pwal_file(const boost::filesystem::path& pwal, epoch_id_t
 
 inline constexpr const std::string_view manifest_file_name = "limestone-manifest.json";
 
-void setup_initial_logdir(const boost::filesystem::path& logdir);
+/**
+ * @brief make the manifest file, of the oldest persistent format version unless specified
+ */
+void setup_initial_logdir(const boost::filesystem::path& logdir, int persistent_format_version = oldest_persistent_format_version);
+
+/**
+ * @returns the description of the supported persistent format versions, for error messages
+ */
+std::string supported_versions();
 
 /**
- * @returns positive-integer: ok supported, zero: not supported, negative-integer: error, corrupted
+ * @returns positive-integer: ok supported (the persistent format version), zero: not supported, negative-integer: error, corrupted
  */
 int is_supported_version(const boost::filesystem::path& manifest_path, std::string& errmsg);
 
-void check_logdir_format(const boost::filesystem::path& logdir);
+/**
+ * @returns the persistent format version of the log directory
+ * @throws std::runtime_error if the version is not supported or the manifest file is corrupted
+ */
+int check_logdir_format(const boost::filesystem::path& logdir);
 
 // from datastore_restore.cpp
 
 status purge_dir(const boost::filesystem::path& dir);
 
+/**
+ * @brief copy the file by reflink, copy_file_range, or read/write, whichever available first
+ * @param done increased by the bytes copied
+ * @param crc32c if not null, the file is copied by read/write and the CRC32C checksum of the data is stored
+ * @throws boost::filesystem::filesystem_error on error
+ */
+void copy_file_fast(const boost::filesystem::path& src, const boost::filesystem::path& dst, std::atomic_uintmax_t& done,
+                    std::uint32_t* crc32c = nullptr);
+
 // from datastore_snapshot.cpp
 
-void create_comapct_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir, int num_worker);
+compaction_result create_comapct_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir, const compaction_options& options);
+
+/**
+ * @brief compact pwal files not yet compacted into a new generation, and merge generations level by level
+ * @details the generations in from_dir which are not merged are linked (or copied) to to_dir.
+ * a level has generations of similar size; if a level has fanout or more generations, they are merged into one.
+ * @returns the catalog of the generations in to_dir
+ */
+compaction_result create_leveled_compact_pwal(const boost::filesystem::path& from_dir, const boost::filesystem::path& to_dir,
+                                               epoch_id_type ld_epoch, const compaction_options& options,
+                                               std::size_t fanout, std::uintmax_t base_size);
 
 }
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <chrono>
 #include <sstream>
 #include <iomanip>
@@ -25,64 +27,302 @@
 #include <limestone/api/log_channel.h>
 
 #include <limestone/api/datastore.h>
+#include "crc32c.h"
+#include "internal.h"
 #include "log_entry.h"
+#include "numa.h"
 
 namespace limestone::api {
 
-log_channel::log_channel(boost::filesystem::path location, std::size_t id, datastore& envelope) noexcept
-    : envelope_(envelope), location_(std::move(location)), id_(id)
+// the pwal file is written through the stdio stream of this cookie,
+// which computes the checksum of the data on the way to the file
+struct checksum_cookie {
+    int fd;
+    std::uint32_t* crc32c;
+};
+
+static ssize_t checksum_cookie_write(void* cookie, const char* buf, std::size_t size) {
+    auto* c = static_cast<checksum_cookie*>(cookie);
+    std::size_t written = 0;
+    while (written < size) {
+        ssize_t w = ::write(c->fd, buf + written, size - written);  // NOLINT(*-pointer-arithmetic)
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        *c->crc32c = internal::crc32c_extend(*c->crc32c, buf + written, w);  // NOLINT(*-pointer-arithmetic)
+        written += w;
+    }
+    return static_cast<ssize_t>(written);
+}
+
+static int checksum_cookie_close(void* cookie) {
+    auto* c = static_cast<checksum_cookie*>(cookie);
+    int rc = ::close(c->fd);
+    delete c;  // NOLINT(*-owning-memory)
+    return rc;
+}
+
+static const cookie_io_functions_t checksum_cookie_functions = {
+    nullptr, checksum_cookie_write, nullptr, checksum_cookie_close
+};
+
+log_channel::log_channel(boost::filesystem::path location, std::size_t id, datastore& envelope, int numa_node) noexcept
+    : envelope_(envelope), location_(std::move(location)), id_(id), numa_node_(numa_node)
 {
     std::stringstream ss;
     ss << prefix << std::setw(4) << std::setfill('0') << std::dec << id_;
     file_ = ss.str();
 }
 
+log_channel::~log_channel() noexcept {
+    // the stream of the session not ended uses buffer_, close it before buffer_ is freed
+    if (strm_) {
+        fclose(strm_);  // NOLINT(*-owning-memory)
+    }
+    if (session_strm_) {
+        fclose(session_strm_);  // NOLINT(*-owning-memory)
+    }
+    free(session_buf_);  // NOLINT(*-owning-memory, *-no-malloc)
+    internal::deallocate_on_node(buffer_, buffer_size);
+}
+
+void* log_channel::operator new(std::size_t size, int numa_node) {
+    return internal::allocate_on_node(size, numa_node);
+}
+
+void log_channel::operator delete(void* p, [[maybe_unused]] int numa_node) noexcept {
+    internal::deallocate_on_node(p, sizeof(log_channel));
+}
+
+void log_channel::operator delete(void* p, std::size_t size) noexcept {
+    internal::deallocate_on_node(p, size);
+}
+
 void log_channel::begin_session() {
     do {
         current_epoch_id_.store(envelope_.epoch_id_switched_.load());
         std::atomic_thread_fence(std::memory_order_acq_rel);
     } while (current_epoch_id_.load() != envelope_.epoch_id_switched_.load());
 
+    // enter the session before touching the file, so that the rotation requested from now on is deferred to the end of the session
+    {
+        std::lock_guard<std::mutex> lock(mtx_rotate_);
+        in_session_ = true;
+    }
+    try {
+        open_session();
+    } catch (...) {
+        abandon_session();
+        throw;
+    }
+}
+
+void log_channel::open_session() {
     auto log_file = file_path();
-    strm_ = fopen(log_file.c_str(), "a");  // NOLINT(*-owning-memory)
-    if (!strm_) {
+    if (!crc32c_valid_) {
+        // the file may have been made before this process
+        crc32c_ = boost::filesystem::exists(log_file) ? internal::crc32c_of_file(log_file) : 0;
+        crc32c_valid_ = true;
+    }
+    // not O_APPEND, the header of the epoch snippet is updated by pwrite at the end of the session
+    fd_ = ::open(log_file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);  // NOLINT(*-vararg)
+    if (fd_ < 0) {
         LOG_LP(ERROR) << "I/O error, cannot make file on " <<  location_ << ", errno = " << errno;
         throw std::runtime_error("I/O error");
     }
-    setvbuf(strm_, nullptr, _IOFBF, 128L * 1024L);  // NOLINT, NB. glibc may ignore size when _IOFBF and buffer=NULL
-    if (!registered_) {
-        envelope_.add_file(log_file);
-        registered_ = true;
+    snippet_pos_ = ::lseek(fd_, 0, SEEK_END);
+    if (snippet_pos_ < 0) {
+        LOG_LP(ERROR) << "lseek failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    auto* cookie = new checksum_cookie{fd_, &crc32c_};  // NOLINT(*-owning-memory)
+    strm_ = fopencookie(cookie, "a", checksum_cookie_functions);
+    if (!strm_) {
+        LOG_LP(ERROR) << "I/O error, cannot open stream of " << log_file << ", errno = " << errno;
+        delete cookie;  // NOLINT(*-owning-memory)
+        throw std::runtime_error("I/O error");
+    }
+    if (!buffer_) {
+        buffer_ = static_cast<char*>(internal::allocate_on_node(buffer_size, numa_node_));
+    }
+    setvbuf(strm_, buffer_, _IOFBF, buffer_size);
+    with_checksum_ = envelope_.persistent_format_version_ >= internal::checksummed_persistent_format_version;
+    compressed_snippet_ = envelope_.pwal_compression_
+        && envelope_.persistent_format_version_ >= internal::compressed_snippet_persistent_format_version;
+    sized_snippet_ = !compressed_snippet_ && envelope_.persistent_format_version_ >= internal::sized_snippet_persistent_format_version;
+    packed_entries_ = envelope_.persistent_format_version_ >= internal::packed_entry_persistent_format_version;
+    snippet_entries_ = 0;
+    previous_storage_id_ = 0;
+    entry_strm_ = strm_;
+    if (compressed_snippet_) {
+        if (!session_strm_) {
+            session_strm_ = open_memstream(&session_buf_, &session_size_);
+            if (!session_strm_) {
+                LOG_LP(ERROR) << "open_memstream failed, errno = " << errno;
+                throw std::runtime_error("I/O error");
+            }
+        } else if (fseek(session_strm_, 0, SEEK_SET) != 0) {
+            // drop the entries left by the session failed on the way
+            LOG_LP(ERROR) << "fseek failed, errno = " << errno;
+            throw std::runtime_error("I/O error");
+        }
+        entry_strm_ = session_strm_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_rotate_);
+        if (!registered_) {
+            envelope_.add_file(log_file);
+            registered_ = true;
+        }
+    }
+    if (compressed_snippet_) {
+        // the marker is written with the compressed entries at the end of the session
+    } else if (sized_snippet_) {
+        log_entry::begin_sized_session(strm_, static_cast<epoch_id_type>(current_epoch_id_.load()));
+    } else {
+        log_entry::begin_session(strm_, static_cast<epoch_id_type>(current_epoch_id_.load()));
     }
-    log_entry::begin_session(strm_, static_cast<epoch_id_type>(current_epoch_id_.load()));
 }
 
 void log_channel::end_session() {
+    try {
+        close_session();
+    } catch (...) {
+        abandon_session();
+        throw;
+    }
+    leave_session(false);
+}
+
+void log_channel::close_session() {
+    if (compressed_snippet_) {
+        write_compressed_snippet();
+    }
     if (fflush(strm_) != 0) {
         LOG_LP(ERROR) << "fflush failed, errno = " << errno;
         throw std::runtime_error("I/O error");
     }
-    if (fsync(fileno(strm_)) != 0) {
+    if (sized_snippet_) {
+        write_snippet_length();
+    }
+    if (fsync(fd_) != 0) {
         LOG_LP(ERROR) << "fsync failed, errno = " << errno;
         throw std::runtime_error("I/O error");
     }
     finished_epoch_id_.store(current_epoch_id_.load());
     current_epoch_id_.store(UINT64_MAX);
     envelope_.update_min_epoch_id();
-    if (fclose(strm_) != 0) {  // NOLINT(*-owning-memory)
+    fd_ = -1;  // closed by fclose
+    int rc = fclose(strm_);  // NOLINT(*-owning-memory)
+    strm_ = nullptr;
+    if (rc != 0) {
         LOG_LP(ERROR) << "fclose failed, errno = " << errno;
         throw std::runtime_error("I/O error");
     }
 }
 
+// close the file of the session failed on the way, and leave the session
+void log_channel::abandon_session() noexcept {
+    if (strm_ != nullptr) {
+        fclose(strm_);  // NOLINT(*-owning-memory)
+        strm_ = nullptr;
+        fd_ = -1;  // closed by fclose
+    } else if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (session_strm_ != nullptr) {
+        // the buffered entries are not written, rewound again when the next session opens
+        fseek(session_strm_, 0, SEEK_SET);
+    }
+    try {
+        leave_session(true);
+    } catch (...) {
+        // the rotation failure is already reported to the datastore
+    }
+}
+
+// leave the session, and do the rotation requested while in the session;
+// if the session is failed, the file may be broken or missing, and its checksum is computed again
+void log_channel::leave_session(bool failed) {
+    bool rotated = false;
+    try {
+        std::lock_guard<std::mutex> lock(mtx_rotate_);
+        in_session_ = false;
+        if (failed) {
+            crc32c_valid_ = false;
+        }
+        if (rotate_requested_) {
+            rotate_requested_ = false;
+            rotated = true;
+            if (failed) {
+                rotate_file_if_not_empty(rotate_epoch_);
+            } else {
+                do_rotate_file(rotate_epoch_);
+            }
+        }
+    } catch (std::exception& e) {
+        LOG_LP(ERROR) << "rotation failed: " << e.what();
+        envelope_.channel_rotated(std::current_exception());
+        throw;
+    }
+    if (rotated) {
+        envelope_.channel_rotated();  // not under mtx_rotate_, datastore locks in the opposite order
+    }
+}
+
+// write the length and the number of the entries over the header of the epoch snippet of this session
+void log_channel::write_snippet_length() {
+    off_t file_size = ::lseek(fd_, 0, SEEK_CUR);
+    if (file_size < 0) {
+        LOG_LP(ERROR) << "lseek failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    auto epoch = static_cast<epoch_id_type>(current_epoch_id_.load());
+    auto length = static_cast<std::uint64_t>(file_size - snippet_pos_) - log_entry::sized_marker_size;
+    auto old_marker = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, epoch, 0, 0);
+    auto new_marker = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, epoch, length, snippet_entries_);
+    constexpr std::size_t offset = log_entry::sized_marker_length_offset;
+    constexpr std::size_t len = log_entry::sized_marker_size - offset;
+    if (::pwrite(fd_, &new_marker.at(offset), len, snippet_pos_ + static_cast<off_t>(offset)) != static_cast<ssize_t>(len)) {
+        LOG_LP(ERROR) << "pwrite failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    crc32c_ = internal::crc32c_overwrite(crc32c_, file_size, snippet_pos_ + offset, &old_marker.at(offset), &new_marker.at(offset), len);
+}
+
+// write the entries of this session, buffered in session_strm_, as one compressed block
+void log_channel::write_compressed_snippet() {
+    if (fflush(session_strm_) != 0) {
+        LOG_LP(ERROR) << "fflush failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+    auto size = static_cast<std::size_t>(ftell(session_strm_));
+    log_entry::write_compressed_session(strm_, static_cast<epoch_id_type>(current_epoch_id_.load()), snippet_entries_,
+                                        std::string_view(session_buf_, size), compressed_buf_);
+    // reuse the buffer for the next session
+    if (fseek(session_strm_, 0, SEEK_SET) != 0) {
+        LOG_LP(ERROR) << "fseek failed, errno = " << errno;
+        throw std::runtime_error("I/O error");
+    }
+}
+
 void log_channel::abort_session([[maybe_unused]] status status_code, [[maybe_unused]] const std::string& message) noexcept {
     LOG_LP(ERROR) << "not implemented";
     std::abort();  // FIXME
 }
 
 void log_channel::add_entry(storage_id_type storage_id, std::string_view key, std::string_view value, write_version_type write_version) {
-    log_entry::write(strm_, storage_id, key, value, write_version);
+    if (packed_entries_) {
+        log_entry::write_packed(entry_strm_, static_cast<epoch_id_type>(current_epoch_id_.load()), previous_storage_id_, storage_id, key, value, write_version);
+    } else {
+        log_entry::write(entry_strm_, storage_id, key, value, write_version, with_checksum_);
+    }
     write_version_ = write_version;
+    snippet_entries_++;
 }
 
 void log_channel::add_entry([[maybe_unused]] storage_id_type storage_id, [[maybe_unused]] std::string_view key, [[maybe_unused]] std::string_view value, [[maybe_unused]] write_version_type write_version, [[maybe_unused]] const std::vector<large_object_input>& large_objects) {
@@ -91,8 +331,13 @@ void log_channel::add_entry([[maybe_unused]] storage_id_type storage_id, [[maybe
 };
 
 void log_channel::remove_entry(storage_id_type storage_id, std::string_view key, write_version_type write_version) {
-    log_entry::write_remove(strm_, storage_id, key, write_version);
+    if (packed_entries_) {
+        log_entry::write_remove_packed(entry_strm_, static_cast<epoch_id_type>(current_epoch_id_.load()), previous_storage_id_, storage_id, key, write_version);
+    } else {
+        log_entry::write_remove(entry_strm_, storage_id, key, write_version, with_checksum_);
+    }
     write_version_ = write_version;
+    snippet_entries_++;
 }
 
 void log_channel::add_storage([[maybe_unused]] storage_id_type storage_id, [[maybe_unused]] write_version_type write_version) {
@@ -114,22 +359,48 @@ boost::filesystem::path log_channel::file_path() const noexcept {
     return location_ / file_;
 }
 
+bool log_channel::request_rotate(epoch_id_type epoch) {
+    std::lock_guard<std::mutex> lock(mtx_rotate_);
+    if (in_session_) {
+        rotate_requested_ = true;
+        rotate_epoch_ = epoch;
+        return false;
+    }
+    rotate_file_if_not_empty(epoch);
+    return true;
+}
+
+void log_channel::rotate_file_if_not_empty(epoch_id_type epoch) {
+    // not checking registered_, it may miss log-files made before this process and not rotated
+    boost::system::error_code error;
+    bool result = boost::filesystem::exists(file_path(), error);
+    if (!result || error) {
+        return;  // skip if not exists
+    }
+    result = boost::filesystem::is_empty(file_path(), error);
+    if (result || error) {
+        return;  // skip if empty
+    }
+    do_rotate_file(epoch);
+}
+
 // DO rotate without condition check.
-//  use this after your check
+//  use this after your check, with mtx_rotate_ held
 void log_channel::do_rotate_file(epoch_id_type epoch) {
-    // XXX: multi-thread broken
-
     std::stringstream ss;
     ss << file_.string() << "."
        << std::setw(14) << std::setfill('0') << envelope_.current_unix_epoch_in_millis()
        << "." << epoch;
     std::string new_name = ss.str();
     boost::filesystem::path new_file = location_ / new_name;
+    std::uint32_t checksum = crc32c_valid_ ? crc32c_ : internal::crc32c_of_file(file_path());
     boost::filesystem::rename(file_path(), new_file);
-    envelope_.add_file(new_file);
+    envelope_.add_file(new_file, checksum);
 
     envelope_.subtract_file(location_ / file_);
     registered_ = false;
+    crc32c_ = 0;  // for the new file
+    crc32c_valid_ = true;
 }
 
 } // namespace limestone::api
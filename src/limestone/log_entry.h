@@ -15,8 +15,10 @@
  */
 #pragma once
 
+#include <array>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <endian.h>
 #include <istream>
 #include <string>
@@ -29,6 +31,8 @@
 #include <limestone/api/write_version_type.h>
 #include <limestone/logging.h>
 #include "logging_helper.h"
+#include "compression.h"
+#include "crc32c.h"
 
 namespace limestone::api {
 
@@ -44,6 +48,22 @@ public:
         marker_durable = 4,
         remove_entry = 5,
         marker_invalidated_begin = 6,
+        // normal_entry and remove_entry followed by the CRC32C checksum of the entry (persistent format version 2)
+        normal_with_checksum = 7,
+        remove_with_checksum = 8,
+        // marker_begin and marker_invalidated_begin followed by the length and the number of the entries of the epoch snippet,
+        // and the checksum of them (persistent format version 3)
+        marker_begin_sized = 9,
+        marker_invalidated_begin_sized = 10,
+        // normal_entry and remove_entry in the compact form; the lengths and the write version are varint-encoded,
+        // storage_id and the epoch of the write version are the differences from the previous entry and the epoch snippet,
+        // followed by the CRC32C checksum of the entry (persistent format version 4)
+        normal_packed = 11,
+        remove_packed = 12,
+        // marker_begin and marker_invalidated_begin followed by the entries of the epoch snippet in one compressed block,
+        // and the checksums of the block and the header (persistent format version 5)
+        marker_begin_compressed = 13,
+        marker_invalidated_begin_compressed = 14,
     };
     class read_error {
     public:
@@ -57,6 +77,8 @@ public:
             unknown_type = 0x82,
             // unexpected type; eg. add_entry at the head of pwal file or in epoch file
             unexpected_type = 0x83,
+            // the content of the entry does not match its checksum
+            checksum_mismatch = 0x84,
         };
 
         read_error() noexcept : value_(ok) {}
@@ -77,6 +99,7 @@ public:
             case short_entry: return "unexpected EOF";
             case unknown_type: return "unknown log_entry type " + std::to_string(static_cast<int>(entry_type_));
             case unexpected_type: return "unexpected log_entry type " + std::to_string(static_cast<int>(entry_type_));
+            case checksum_mismatch: return "checksum mismatch in log_entry type " + std::to_string(static_cast<int>(entry_type_));
             }
             return "unknown error code " + std::to_string(value_);
         }
@@ -87,11 +110,59 @@ public:
     
     log_entry() = default;
 
+    // size of marker_begin_sized, and the position of the length in it, which is updated at the end of the session
+    static constexpr std::size_t sized_marker_size = 1 + sizeof(epoch_id_type) + sizeof(std::uint64_t) * 2 + sizeof(std::uint32_t);
+    static constexpr std::size_t sized_marker_length_offset = 1 + sizeof(epoch_id_type);
+
     static void begin_session(FILE* strm, epoch_id_type epoch) {
         entry_type type = entry_type::marker_begin;
         write_uint8(strm, static_cast<std::uint8_t>(type));
         write_uint64le(strm, static_cast<std::uint64_t>(epoch));
     }
+    // the length and the number of the entries are not known yet, they are written over the marker by the caller
+    static void begin_sized_session(FILE* strm, epoch_id_type epoch) {
+        auto marker = make_sized_marker(entry_type::marker_begin_sized, epoch, 0, 0);
+        write_bytes(strm, marker.data(), marker.size());
+    }
+    static std::array<char, sized_marker_size> make_sized_marker(entry_type type, epoch_id_type epoch, std::uint64_t length, std::uint64_t entries) {
+        std::array<char, sized_marker_size> marker{};
+        marker.at(0) = static_cast<char>(type);
+        store_uint64le(&marker.at(1), static_cast<std::uint64_t>(epoch));
+        store_uint64le(&marker.at(sized_marker_length_offset), length);
+        store_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t)), entries);
+        // not covering the type, which is changed by the invalidation
+        store_uint32le(&marker.at(sized_marker_size - sizeof(std::uint32_t)),
+                       internal::crc32c(&marker.at(1), sized_marker_size - 1 - sizeof(std::uint32_t)));
+        return marker;
+    }
+    // size of marker_begin_compressed; type, epoch, length of the block, number of the entries, size of the data in the block,
+    // checksum of the block, and checksum of the header
+    static constexpr std::size_t compressed_marker_size = 1 + sizeof(epoch_id_type) + sizeof(std::uint64_t) * 3 + sizeof(std::uint32_t) * 2;
+
+    // the entries of the epoch snippet, written in data, are compressed into one block following the marker
+    //  block: the buffer to store the compressed block
+    static void write_compressed_session(FILE* strm, epoch_id_type epoch, std::uint64_t entries, std::string_view data, std::string& block) {
+        internal::compress_block(data, block);
+        auto marker = make_compressed_marker(entry_type::marker_begin_compressed, epoch, block.size(), entries, data.size(),
+                                             internal::crc32c(block.data(), block.size()));
+        write_bytes(strm, marker.data(), marker.size());
+        write_bytes(strm, block.data(), block.size());
+    }
+    static std::array<char, compressed_marker_size> make_compressed_marker(entry_type type, epoch_id_type epoch, std::uint64_t length, std::uint64_t entries,
+                                                                           std::uint64_t data_size, std::uint32_t block_crc) {
+        std::array<char, compressed_marker_size> marker{};
+        marker.at(0) = static_cast<char>(type);
+        store_uint64le(&marker.at(1), static_cast<std::uint64_t>(epoch));
+        store_uint64le(&marker.at(sized_marker_length_offset), length);
+        store_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t)), entries);
+        store_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t) * 2), data_size);
+        store_uint32le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t) * 3), block_crc);
+        // not covering the type, as make_sized_marker()
+        store_uint32le(&marker.at(compressed_marker_size - sizeof(std::uint32_t)),
+                       internal::crc32c(&marker.at(1), compressed_marker_size - 1 - sizeof(std::uint32_t)));
+        return marker;
+    }
+
     static void end_session(FILE* strm, epoch_id_type epoch) {
         entry_type type = entry_type::marker_end;
         write_uint8(strm, static_cast<std::uint8_t>(type));
@@ -109,15 +180,22 @@ public:
     }
 
 // for writer (entry)
-    void write(FILE* strm) {
+//  with_checksum: write the entries in the form with checksum, for persistent format version 2 or later
+    void write(FILE* strm, bool with_checksum = false) {
         switch(entry_type_) {
         case entry_type::normal_entry:
-            write(strm, key_sid_, value_etc_);
+        case entry_type::normal_with_checksum:
+        case entry_type::normal_packed:
+            write(strm, key_sid_, value_etc_, with_checksum);
             break;
         case entry_type::remove_entry:
-            write_remove(strm, key_sid_, value_etc_);
+        case entry_type::remove_with_checksum:
+        case entry_type::remove_packed:
+            write_remove(strm, key_sid_, value_etc_, with_checksum);
             break;
         case entry_type::marker_begin:
+        case entry_type::marker_begin_sized:
+        case entry_type::marker_begin_compressed:
             begin_session(strm, epoch_id_);
             break;
         case entry_type::marker_end:
@@ -127,6 +205,8 @@ public:
             durable_epoch(strm, epoch_id_);
             break;
         case entry_type::marker_invalidated_begin:
+        case entry_type::marker_invalidated_begin_sized:
+        case entry_type::marker_invalidated_begin_compressed:
             invalidated_begin(strm, epoch_id_);
             break;
         case entry_type::this_id_is_not_used:
@@ -134,67 +214,134 @@ public:
         }
     }
 
-    static void write(FILE* strm, storage_id_type storage_id, std::string_view key, std::string_view value, write_version_type write_version) {
-        entry_type type = entry_type::normal_entry;
-        write_uint8(strm, static_cast<std::uint8_t>(type));
-
-        std::size_t key_len = key.length();
-        assert(key_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(key_len));
-
-        std::size_t value_len = value.length();
-        assert(value_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(value_len));
-
-        write_uint64le(strm, static_cast<std::uint64_t>(storage_id));
-        write_bytes(strm, key.data(), key_len);
-
-        write_uint64le(strm, static_cast<std::uint64_t>(write_version.epoch_number_));
-        write_uint64le(strm, static_cast<std::uint64_t>(write_version.minor_write_version_));
-        write_bytes(strm, value.data(), value_len);
+    static void write(FILE* strm, storage_id_type storage_id, std::string_view key, std::string_view value, write_version_type write_version,
+                      bool with_checksum = false) {
+        std::array<char, normal_entry_header_size> header{};
+        std::array<char, write_version_size> version{};
+        make_normal_entry_header(header, key.length(), value.length(), with_checksum);
+        store_uint64le(&header.at(1 + 2 * sizeof(std::uint32_t)), static_cast<std::uint64_t>(storage_id));
+        store_uint64le(&version.at(0), static_cast<std::uint64_t>(write_version.epoch_number_));
+        store_uint64le(&version.at(sizeof(epoch_id_type)), static_cast<std::uint64_t>(write_version.minor_write_version_));
+
+        std::size_t entry_size = header.size() + key.length() + version.size() + value.length() + (with_checksum ? sizeof(std::uint32_t) : 0);
+        if (entry_size <= coalesced_entry_size) {
+            // a small entry is assembled and checksummed in one piece, and passed to fwrite at once
+            std::array<char, coalesced_entry_size> buf;  // NOLINT(*-member-init): every byte written is set below
+            char* p = buf.data();
+            std::memcpy(p, header.data(), header.size());
+            p += header.size();  // NOLINT(*-pointer-arithmetic)
+            std::memcpy(p, key.data(), key.length());
+            p += key.length();  // NOLINT(*-pointer-arithmetic)
+            std::memcpy(p, version.data(), version.size());
+            p += version.size();  // NOLINT(*-pointer-arithmetic)
+            std::memcpy(p, value.data(), value.length());
+            p += value.length();  // NOLINT(*-pointer-arithmetic)
+            if (with_checksum) {
+                store_uint32le(p, internal::crc32c(buf.data(), p - buf.data()));
+            }
+            write_bytes(strm, buf.data(), entry_size);
+            return;
+        }
+        write_bytes(strm, header.data(), header.size());
+        write_bytes(strm, key.data(), key.length());
+        write_bytes(strm, version.data(), version.size());
+        write_bytes(strm, value.data(), value.length());
+        if (with_checksum) {
+            std::uint32_t crc = internal::crc32c(header.data(), header.size());
+            crc = internal::crc32c_extend(crc, key.data(), key.length());
+            crc = internal::crc32c_extend(crc, version.data(), version.size());
+            crc = internal::crc32c_extend(crc, value.data(), value.length());
+            write_uint32le(strm, crc);
+        }
     }
 
-    static void write(FILE* strm, std::string_view key_sid, std::string_view value_etc) {
-        entry_type type = entry_type::normal_entry;
-        write_uint8(strm, static_cast<std::uint8_t>(type));
-
-        std::size_t key_len = key_sid.length() - sizeof(storage_id_type);
-        assert(key_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(key_len));
-
-        std::size_t value_len = value_etc.length() - (sizeof(epoch_id_type) + sizeof(std::uint64_t));
-        assert(value_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(value_len));
+    static void write(FILE* strm, std::string_view key_sid, std::string_view value_etc, bool with_checksum = false) {
+        std::array<char, normal_entry_header_size - sizeof(storage_id_type)> header{};
+        make_normal_entry_header(header, key_sid.length() - sizeof(storage_id_type), value_etc.length() - write_version_size, with_checksum);
 
+        write_bytes(strm, header.data(), header.size());
         write_bytes(strm, key_sid.data(), key_sid.length());
         write_bytes(strm, value_etc.data(), value_etc.length());
+        if (with_checksum) {
+            write_uint32le(strm, checksum_of(header, key_sid, value_etc));
+        }
     }
 
-    static void write_remove(FILE* strm, storage_id_type storage_id, std::string_view key, write_version_type write_version) {
-        entry_type type = entry_type::remove_entry;
-        write_uint8(strm, static_cast<std::uint8_t>(type));
+    static void write_remove(FILE* strm, storage_id_type storage_id, std::string_view key, write_version_type write_version,
+                             bool with_checksum = false) {
+        std::array<char, remove_entry_header_size> header{};
+        std::array<char, write_version_size> version{};
+        make_remove_entry_header(header, key.length(), with_checksum);
+        store_uint64le(&header.at(1 + sizeof(std::uint32_t)), static_cast<std::uint64_t>(storage_id));
+        store_uint64le(&version.at(0), static_cast<std::uint64_t>(write_version.epoch_number_));
+        store_uint64le(&version.at(sizeof(epoch_id_type)), static_cast<std::uint64_t>(write_version.minor_write_version_));
+
+        write_bytes(strm, header.data(), header.size());
+        write_bytes(strm, key.data(), key.length());
+        write_bytes(strm, version.data(), version.size());
+        if (with_checksum) {
+            std::uint32_t crc = internal::crc32c(header.data(), header.size());
+            crc = internal::crc32c_extend(crc, key.data(), key.length());
+            crc = internal::crc32c_extend(crc, version.data(), version.size());
+            write_uint32le(strm, crc);
+        }
+    }
 
-        std::size_t key_len = key.length();
-        assert(key_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(key_len));
+    static void write_remove(FILE* strm, std::string_view key_sid, std::string_view value_etc, bool with_checksum = false) {
+        std::array<char, remove_entry_header_size - sizeof(storage_id_type)> header{};
+        make_remove_entry_header(header, key_sid.length() - sizeof(storage_id_type), with_checksum);
 
-        write_uint64le(strm, static_cast<std::uint64_t>(storage_id));
-        write_bytes(strm, key.data(), key_len);
+        write_bytes(strm, header.data(), header.size());
+        write_bytes(strm, key_sid.data(), key_sid.length());
+        write_bytes(strm, value_etc.data(), value_etc.length());
+        if (with_checksum) {
+            write_uint32le(strm, checksum_of(header, key_sid, value_etc));
+        }
+    }
 
-        write_uint64le(strm, static_cast<std::uint64_t>(write_version.epoch_number_));
-        write_uint64le(strm, static_cast<std::uint64_t>(write_version.minor_write_version_));
+// for writer (entry in the compact form, persistent format version 4)
+//  snippet_epoch: epoch of the epoch snippet in which the entry is written
+//  previous_storage_id: storage_id of the previous entry in the epoch snippet, 0 for the first entry; updated by this call
+    static void write_packed(FILE* strm, epoch_id_type snippet_epoch, storage_id_type& previous_storage_id,
+                             storage_id_type storage_id, std::string_view key, std::string_view value, write_version_type write_version) {
+        std::array<char, max_packed_header_size> header{};
+        std::size_t header_len = make_packed_header(header, entry_type::normal_packed, key.length(), value.length(),
+                                                    storage_id - previous_storage_id, write_version.epoch_number_ - snippet_epoch,
+                                                    write_version.minor_write_version_);
+        write_bytes(strm, header.data(), header_len);
+        write_bytes(strm, key.data(), key.length());
+        write_bytes(strm, value.data(), value.length());
+        std::uint32_t crc = internal::crc32c(header.data(), header_len);
+        crc = internal::crc32c_extend(crc, key.data(), key.length());
+        crc = internal::crc32c_extend(crc, value.data(), value.length());
+        write_uint32le(strm, crc);
+        previous_storage_id = storage_id;
     }
 
-    static void write_remove(FILE* strm, std::string_view key_sid, std::string_view value_etc) {
-        entry_type type = entry_type::remove_entry;
-        write_uint8(strm, static_cast<std::uint8_t>(type));
+    static void write_packed(FILE* strm, epoch_id_type snippet_epoch, storage_id_type& previous_storage_id,
+                             std::string_view key_sid, std::string_view value_etc) {
+        write_packed(strm, snippet_epoch, previous_storage_id, load_uint64le(key_sid.data()), key_sid.substr(sizeof(storage_id_type)),
+                     value_etc.substr(write_version_size), write_version_type(value_etc));
+    }
 
-        std::size_t key_len = key_sid.length() - sizeof(storage_id_type);
-        assert(key_len <= UINT32_MAX);
-        write_uint32le(strm, static_cast<std::uint32_t>(key_len));
+    static void write_remove_packed(FILE* strm, epoch_id_type snippet_epoch, storage_id_type& previous_storage_id,
+                                    storage_id_type storage_id, std::string_view key, write_version_type write_version) {
+        std::array<char, max_packed_header_size> header{};
+        std::size_t header_len = make_packed_header(header, entry_type::remove_packed, key.length(), 0,
+                                                    storage_id - previous_storage_id, write_version.epoch_number_ - snippet_epoch,
+                                                    write_version.minor_write_version_);
+        write_bytes(strm, header.data(), header_len);
+        write_bytes(strm, key.data(), key.length());
+        std::uint32_t crc = internal::crc32c(header.data(), header_len);
+        crc = internal::crc32c_extend(crc, key.data(), key.length());
+        write_uint32le(strm, crc);
+        previous_storage_id = storage_id;
+    }
 
-        write_bytes(strm, key_sid.data(), key_sid.length());
-        write_bytes(strm, value_etc.data(), value_etc.length());
+    static void write_remove_packed(FILE* strm, epoch_id_type snippet_epoch, storage_id_type& previous_storage_id,
+                                    std::string_view key_sid, std::string_view value_etc) {
+        write_remove_packed(strm, snippet_epoch, previous_storage_id, load_uint64le(key_sid.data()), key_sid.substr(sizeof(storage_id_type)),
+                            write_version_type(value_etc));
     }
 
 // for reader
@@ -209,16 +356,238 @@ public:
     }
 
     bool read_entry_from(std::istream& strm, read_error& ec) {
+        stream_reader in{strm};
+        return read_next(in, ec);
+    }
+
+    /**
+     * @brief contiguous bytes of the pwal file, e.g. mapped on memory, from which the entries are read
+     * without going through std::istream for each field
+     */
+    class buffer_reader {
+    public:
+        buffer_reader() noexcept = default;
+        buffer_reader(const char* data, std::size_t size) noexcept : begin_(data), pos_(data), end_(data + size) {}  // NOLINT(*-pointer-arithmetic)
+        // reads the bytes of data from begin to end, the positions are still told from the head of data
+        buffer_reader(const char* data, std::size_t begin, std::size_t end) noexcept
+            : begin_(data), pos_(data + begin), end_(data + end) {}  // NOLINT(*-pointer-arithmetic)
+
+        // reads len bytes; if not enough bytes remain, consumes all of them and returns false
+        bool read(void* buf, std::size_t len) noexcept {
+            if (static_cast<std::size_t>(end_ - pos_) < len) {
+                pos_ = end_;
+                return false;
+            }
+            if (len > 0) {
+                std::memcpy(buf, pos_, len);
+                pos_ += len;  // NOLINT(*-pointer-arithmetic)
+            }
+            return true;
+        }
+        // returns the next byte, or -1 at the end
+        int get() noexcept {
+            return pos_ < end_ ? static_cast<unsigned char>(*pos_++) : -1;  // NOLINT(*-pointer-arithmetic)
+        }
+        [[nodiscard]] std::streamoff tell() const noexcept { return pos_ - begin_; }
+        void seek(std::streamoff pos) noexcept {
+            pos_ = pos < end_ - begin_ ? begin_ + pos : end_;  // NOLINT(*-pointer-arithmetic)
+        }
+        [[nodiscard]] std::size_t size() const noexcept { return end_ - begin_; }
+        [[nodiscard]] std::uintmax_t remaining() const noexcept { return end_ - pos_; }
+
+    private:
+        const char* begin_{};
+        const char* pos_{};
+        const char* end_{};
+    };
+
+    bool read_entry_from(buffer_reader& in, read_error& ec) {
+        return read_next(in, ec);
+    }
+
+    void write_version(write_version_type& buf) {
+        memcpy(static_cast<void*>(&buf), value_etc_.data(), sizeof(epoch_id_type) + sizeof(std::uint64_t));
+    }
+    [[nodiscard]] storage_id_type storage() const {
+        storage_id_type storage_id{};
+        memcpy(static_cast<void*>(&storage_id), key_sid_.data(), sizeof(storage_id_type));
+        return storage_id;
+    }
+    void value(std::string& buf) {
+        buf = value_etc_.substr(sizeof(epoch_id_type) + sizeof(std::uint64_t));
+    }
+    void key(std::string& buf) {
+        buf = key_sid_.substr(sizeof(storage_id_type));
+    }
+    [[nodiscard]] entry_type type() const {
+        return entry_type_;
+    }
+    [[nodiscard]] epoch_id_type epoch_id() const {
+        return epoch_id_;
+    }
+    // the length in bytes and the number of the entries following the marker, 0 if not known
+    [[nodiscard]] std::uint64_t snippet_length() const {
+        return snippet_length_;
+    }
+    [[nodiscard]] std::uint64_t snippet_entries() const {
+        return snippet_entries_;
+    }
+
+    // for the purpose of storing key_sid and value_etc into LevelDB
+    std::string& value_etc() {
+        return value_etc_;
+    }
+    std::string& key_sid() {
+        return key_sid_;
+    }
+    static epoch_id_type write_version_epoch_number(std::string_view value_etc) {
+        epoch_id_type epoch_id{};
+        memcpy(static_cast<void*>(&epoch_id), value_etc.data(), sizeof(epoch_id_type));
+        return epoch_id;
+    }
+    static std::uint64_t write_version_minor_write_version(std::string_view value_etc) {
+        std::uint64_t minor_write_version{};
+        memcpy(static_cast<void*>(&minor_write_version), value_etc.data() + sizeof(epoch_id_type), sizeof(std::uint64_t));
+        return minor_write_version;
+    }
+
+private:
+    // type, key_length, value_length and storage_id
+    static constexpr std::size_t normal_entry_header_size = 1 + sizeof(std::uint32_t) * 2 + sizeof(storage_id_type);
+    // type, key_length and storage_id
+    static constexpr std::size_t remove_entry_header_size = 1 + sizeof(std::uint32_t) + sizeof(storage_id_type);
+    static constexpr std::size_t write_version_size = sizeof(epoch_id_type) + sizeof(std::uint64_t);
+    // type, key_length, value_length, storage_id, write_version_major and write_version_minor in varint
+    static constexpr std::size_t max_varint_size = 10;
+    static constexpr std::size_t max_packed_header_size = 1 + 5 + 5 + max_varint_size * 3;
+    // the packed entries up to this size are read without checking the remaining bytes
+    static constexpr std::uint64_t unchecked_entry_size = 64UL * 1024;
+    // the normal entries up to this size are written by one fwrite call
+    static constexpr std::size_t coalesced_entry_size = 512;
+
+    entry_type entry_type_{};
+    epoch_id_type epoch_id_{};  // of the last marker, the entries in the compact form are decoded against
+    std::uint64_t snippet_length_{};
+    std::uint64_t snippet_entries_{};
+    storage_id_type previous_storage_id_{};  // of the last entry in the compact form in the epoch snippet
+    std::uint64_t block_data_size_{};  // size of the entries in the compressed block following the last marker
+    std::uint32_t block_crc_{};
+    std::streamoff block_pos_{-1};  // position of the compressed block not read yet, -1 if none
+    std::string block_buf_{};
+    std::string block_data_{};  // the entries decompressed from the block
+    std::size_t block_offset_{};  // of the next entry in block_data_
+    bool in_block_{};
+    std::string key_sid_{};
+    std::string value_etc_{};
+    // the header before storage_id; storage_id is written by the caller if the header has the room for it
+    template<std::size_t N>
+    static void make_normal_entry_header(std::array<char, N>& header, std::size_t key_len, std::size_t value_len, bool with_checksum) {
+        assert(key_len <= UINT32_MAX);
+        assert(value_len <= UINT32_MAX);
+        header.at(0) = static_cast<char>(with_checksum ? entry_type::normal_with_checksum : entry_type::normal_entry);
+        store_uint32le(&header.at(1), static_cast<std::uint32_t>(key_len));
+        store_uint32le(&header.at(1 + sizeof(std::uint32_t)), static_cast<std::uint32_t>(value_len));
+    }
+    template<std::size_t N>
+    static void make_remove_entry_header(std::array<char, N>& header, std::size_t key_len, bool with_checksum) {
+        assert(key_len <= UINT32_MAX);
+        header.at(0) = static_cast<char>(with_checksum ? entry_type::remove_with_checksum : entry_type::remove_entry);
+        store_uint32le(&header.at(1), static_cast<std::uint32_t>(key_len));
+    }
+    // the checksum covers the whole entry from the type, in the order written in the file
+    template<std::size_t N>
+    static std::uint32_t checksum_of(const std::array<char, N>& header, std::string_view key_sid, std::string_view value_etc) noexcept {
+        std::uint32_t crc = internal::crc32c(header.data(), header.size());
+        crc = internal::crc32c_extend(crc, key_sid.data(), key_sid.length());
+        return internal::crc32c_extend(crc, value_etc.data(), value_etc.length());
+    }
+    // std::istream in the interface of buffer_reader
+    class stream_reader {
+    public:
+        explicit stream_reader(std::istream& strm) noexcept : strm_(strm) {}
+        bool read(void* buf, std::size_t len) {
+            strm_.read(reinterpret_cast<char*>(buf), static_cast<std::streamsize>(len));  // NOLINT(*-reinterpret-cast)
+            return !strm_.eof();
+        }
+        int get() {
+            return strm_.get();
+        }
+        [[nodiscard]] std::streamoff tell() const {
+            return strm_.tellg();
+        }
+        // returns the number of bytes left in the stream, or the maximum if unknown
+        [[nodiscard]] std::uintmax_t remaining() const {
+            auto pos = strm_.tellg();
+            if (pos < 0) {
+                return UINTMAX_MAX;
+            }
+            strm_.seekg(0, std::ios_base::end);
+            auto end = strm_.tellg();
+            strm_.seekg(pos);
+            return end < pos ? 0 : static_cast<std::uintmax_t>(end - pos);
+        }
+    private:
+        std::istream& strm_;
+    };
+
+    template<class In>
+    bool read_next(In& in, read_error& ec) {
+        // the entries of the compressed epoch snippet are read from the block, unless the caller has skipped it
+        if (block_pos_ != -1) {
+            bool skipped = in.tell() != block_pos_;
+            block_pos_ = -1;
+            if (!skipped && !read_block(in, ec)) {
+                return false;
+            }
+        }
+        if (in_block_) {
+            if (block_offset_ < block_data_.size()) {
+                buffer_reader block{block_data_.data(), block_data_.size()};
+                block.seek(static_cast<std::streamoff>(block_offset_));
+                bool rc = read_entry(block, ec);
+                block_offset_ = block.tell();
+                return rc;
+            }
+            in_block_ = false;
+        }
+        return read_entry(in, ec);
+    }
+
+    // read one entry from the file, or from the compressed block
+    template<class In>
+    bool read_entry(In& strm, read_error& ec) {
         ec.value(read_error::ok);
         ec.entry_type(entry_type::this_id_is_not_used);
-        char one_char{};
-        strm.read(&one_char, sizeof(char));
-        entry_type_ = static_cast<entry_type>(one_char);
-        if (strm.eof()) {
+        int one_char = strm.get();
+        entry_type_ = entry_type::this_id_is_not_used;
+        if (one_char < 0) {
             return false;
         }
+        entry_type_ = static_cast<entry_type>(one_char);
+
+        // the entries with checksum are read as the entries without checksum after verification,
+        // so that the readers need not to know which form the entry is stored in
+        bool with_checksum = false;
+        if (entry_type_ == entry_type::normal_with_checksum || entry_type_ == entry_type::remove_with_checksum) {
+            with_checksum = true;
+            entry_type_ = entry_type_ == entry_type::normal_with_checksum ? entry_type::normal_entry : entry_type::remove_entry;
+        }
 
         switch(entry_type_) {
+        // read as normal_entry and remove_entry, decoded against the epoch snippet
+        case entry_type::normal_packed:
+        case entry_type::remove_packed:
+        {
+            auto type = entry_type_;
+            entry_type_ = type == entry_type::normal_packed ? entry_type::normal_entry : entry_type::remove_entry;
+            if (!read_packed_entry(strm, type, ec)) {
+                if (ec.value() == read_error::checksum_mismatch) {
+                    ec.entry_type(type);
+                }
+                return false;
+            }
+            break;
+        }
         case entry_type::normal_entry:
         {
             std::size_t key_len = read_uint32le(strm, ec);
@@ -227,11 +596,22 @@ public:
             if (ec) return false;
 
             key_sid_.resize(key_len + sizeof(storage_id_type));
-            read_bytes(strm, key_sid_.data(), static_cast<std::streamsize>(key_sid_.length()), ec);
+            read_bytes(strm, key_sid_.data(), key_sid_.length(), ec);
             if (ec) return false;
             value_etc_.resize(value_len + sizeof(epoch_id_type) + sizeof(std::uint64_t));
-            read_bytes(strm, value_etc_.data(), static_cast<std::streamsize>(value_etc_.length()), ec);
+            read_bytes(strm, value_etc_.data(), value_etc_.length(), ec);
             if (ec) return false;
+            if (with_checksum) {
+                std::uint32_t crc = read_uint32le(strm, ec);
+                if (ec) return false;
+                std::array<char, normal_entry_header_size - sizeof(storage_id_type)> header{};
+                make_normal_entry_header(header, key_len, value_len, true);
+                if (crc != checksum_of(header, key_sid_, value_etc_)) {
+                    ec.value(read_error::checksum_mismatch);
+                    ec.entry_type(entry_type::normal_with_checksum);
+                    return false;
+                }
+            }
             break;
         }
         case entry_type::remove_entry:
@@ -240,11 +620,22 @@ public:
             if (ec) return false;
 
             key_sid_.resize(key_len + sizeof(storage_id_type));
-            read_bytes(strm, key_sid_.data(), static_cast<std::streamsize>(key_sid_.length()), ec);
+            read_bytes(strm, key_sid_.data(), key_sid_.length(), ec);
             if (ec) return false;
             value_etc_.resize(sizeof(epoch_id_type) + sizeof(std::uint64_t));
-            read_bytes(strm, value_etc_.data(), static_cast<std::streamsize>(value_etc_.length()), ec);
+            read_bytes(strm, value_etc_.data(), value_etc_.length(), ec);
             if (ec) return false;
+            if (with_checksum) {
+                std::uint32_t crc = read_uint32le(strm, ec);
+                if (ec) return false;
+                std::array<char, remove_entry_header_size - sizeof(storage_id_type)> header{};
+                make_remove_entry_header(header, key_len, true);
+                if (crc != checksum_of(header, key_sid_, value_etc_)) {
+                    ec.value(read_error::checksum_mismatch);
+                    ec.entry_type(entry_type::remove_with_checksum);
+                    return false;
+                }
+            }
             break;
         }
         case entry_type::marker_begin:
@@ -253,8 +644,58 @@ public:
         case entry_type::marker_invalidated_begin:
             epoch_id_ = static_cast<epoch_id_type>(read_uint64le(strm, ec));
             if (ec) return false;
+            snippet_length_ = 0;
+            snippet_entries_ = 0;
+            previous_storage_id_ = 0;
             break;
 
+        // read as marker_begin and marker_invalidated_begin, with the length
+        case entry_type::marker_begin_sized:
+        case entry_type::marker_invalidated_begin_sized:
+        {
+            auto type = entry_type_;
+            entry_type_ = type == entry_type::marker_begin_sized ? entry_type::marker_begin : entry_type::marker_invalidated_begin;
+            std::array<char, sized_marker_size> marker{};
+            marker.at(0) = static_cast<char>(type);
+            read_bytes(strm, &marker.at(1), sized_marker_size - 1, ec);
+            if (ec) return false;
+            epoch_id_ = static_cast<epoch_id_type>(load_uint64le(&marker.at(1)));
+            snippet_length_ = load_uint64le(&marker.at(sized_marker_length_offset));
+            snippet_entries_ = load_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t)));
+            previous_storage_id_ = 0;
+            if (make_sized_marker(type, epoch_id_, snippet_length_, snippet_entries_) != marker) {
+                ec.value(read_error::checksum_mismatch);
+                ec.entry_type(type);
+                return false;
+            }
+            break;
+        }
+
+        // read as marker_begin and marker_invalidated_begin, the block is read by the next read_entry_from()
+        case entry_type::marker_begin_compressed:
+        case entry_type::marker_invalidated_begin_compressed:
+        {
+            auto type = entry_type_;
+            entry_type_ = type == entry_type::marker_begin_compressed ? entry_type::marker_begin : entry_type::marker_invalidated_begin;
+            std::array<char, compressed_marker_size> marker{};
+            marker.at(0) = static_cast<char>(type);
+            read_bytes(strm, &marker.at(1), compressed_marker_size - 1, ec);
+            if (ec) return false;
+            epoch_id_ = static_cast<epoch_id_type>(load_uint64le(&marker.at(1)));
+            snippet_length_ = load_uint64le(&marker.at(sized_marker_length_offset));
+            snippet_entries_ = load_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t)));
+            block_data_size_ = load_uint64le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t) * 2));
+            block_crc_ = load_uint32le(&marker.at(sized_marker_length_offset + sizeof(std::uint64_t) * 3));
+            previous_storage_id_ = 0;
+            if (make_compressed_marker(type, epoch_id_, snippet_length_, snippet_entries_, block_data_size_, block_crc_) != marker) {
+                ec.value(read_error::checksum_mismatch);
+                ec.entry_type(type);
+                return false;
+            }
+            block_pos_ = strm.tell();
+            break;
+        }
+
         default:
             ec.value(read_error::unknown_type);
             ec.entry_type(entry_type_);
@@ -264,50 +705,143 @@ public:
         return true;
     }
 
-    void write_version(write_version_type& buf) {
-        memcpy(static_cast<void*>(&buf), value_etc_.data(), sizeof(epoch_id_type) + sizeof(std::uint64_t));
+    // read the compressed block following the marker, and decompress the entries in it
+    template<class In>
+    bool read_block(In& strm, read_error& ec) {
+        ec.value(read_error::ok);
+        entry_type_ = entry_type::normal_entry;  // reported as the entries of the epoch snippet are broken
+        block_buf_.resize(snippet_length_);
+        read_bytes(strm, block_buf_.data(), block_buf_.size(), ec);
+        if (ec) return false;
+        if (internal::crc32c(block_buf_.data(), block_buf_.size()) != block_crc_
+            || !internal::decompress_block(block_buf_, block_data_size_, block_data_)) {
+            ec.value(read_error::checksum_mismatch);
+            ec.entry_type(entry_type::marker_begin_compressed);
+            return false;
+        }
+        block_offset_ = 0;
+        in_block_ = true;
+        return true;
     }
-    [[nodiscard]] storage_id_type storage() const {
-        storage_id_type storage_id{};
-        memcpy(static_cast<void*>(&storage_id), key_sid_.data(), sizeof(storage_id_type));
-        return storage_id;
+    // the differences of storage_id and epoch are zigzag-encoded, as the entries are not sorted by them
+    static std::size_t make_packed_header(std::array<char, max_packed_header_size>& header, entry_type type, std::size_t key_len, std::size_t value_len,
+                                          std::uint64_t storage_id_delta, std::uint64_t epoch_delta, std::uint64_t minor_write_version) noexcept {
+        assert(key_len <= UINT32_MAX);
+        assert(value_len <= UINT32_MAX);
+        std::size_t n = 0;
+        header.at(n++) = static_cast<char>(type);
+        n += store_varint(&header.at(n), key_len);
+        if (type == entry_type::normal_packed) {
+            n += store_varint(&header.at(n), value_len);
+        }
+        n += store_varint(&header.at(n), zigzag_encode(storage_id_delta));
+        n += store_varint(&header.at(n), zigzag_encode(epoch_delta));
+        n += store_varint(&header.at(n), minor_write_version);
+        return n;
     }
-    void value(std::string& buf) {
-        buf = value_etc_.substr(sizeof(epoch_id_type) + sizeof(std::uint64_t));
+    template<class In>
+    bool read_packed_entry(In& strm, entry_type type, read_error& ec) {
+        std::uint64_t key_len = read_varint(strm, ec);
+        if (ec) return false;
+        std::uint64_t value_len = 0;
+        if (type == entry_type::normal_packed) {
+            value_len = read_varint(strm, ec);
+            if (ec) return false;
+        }
+        std::uint64_t storage_id_delta = zigzag_decode(read_varint(strm, ec));
+        if (ec) return false;
+        std::uint64_t epoch_delta = zigzag_decode(read_varint(strm, ec));
+        if (ec) return false;
+        std::uint64_t minor_write_version = read_varint(strm, ec);
+        if (ec) return false;
+        if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+            ec.value(read_error::short_entry);  // never written, the header is broken
+            return false;
+        }
+        // a broken header must not make a huge allocation; the remaining bytes are looked up only for large entries,
+        // as it may seek the stream
+        if (key_len + value_len > unchecked_entry_size && strm.remaining() < key_len + value_len) {
+            ec.value(read_error::short_entry);
+            return false;
+        }
+
+        storage_id_type storage_id = previous_storage_id_ + storage_id_delta;
+        key_sid_.resize(sizeof(storage_id_type) + key_len);
+        char* key = key_sid_.data() + sizeof(storage_id_type);  // NOLINT(*-pointer-arithmetic)
+        store_uint64le(key_sid_.data(), storage_id);
+        read_bytes(strm, key, key_len, ec);
+        if (ec) return false;
+        value_etc_.resize(write_version_size + value_len);
+        char* value = value_etc_.data() + write_version_size;  // NOLINT(*-pointer-arithmetic)
+        store_uint64le(value_etc_.data(), epoch_id_ + epoch_delta);
+        store_uint64le(&value_etc_.at(sizeof(epoch_id_type)), minor_write_version);
+        read_bytes(strm, value, value_len, ec);
+        if (ec) return false;
+        std::uint32_t crc = read_uint32le(strm, ec);
+        if (ec) return false;
+
+        std::array<char, max_packed_header_size> header{};
+        std::size_t header_len = make_packed_header(header, type, key_len, value_len, storage_id_delta, epoch_delta, minor_write_version);
+        std::uint32_t expected = internal::crc32c(header.data(), header_len);
+        expected = internal::crc32c_extend(expected, key, key_len);
+        expected = internal::crc32c_extend(expected, value, value_len);
+        if (crc != expected) {
+            ec.value(read_error::checksum_mismatch);
+            return false;
+        }
+        previous_storage_id_ = storage_id;
+        return true;
     }
-    void key(std::string& buf) {
-        buf = key_sid_.substr(sizeof(storage_id_type));
+    static std::uint64_t zigzag_encode(std::uint64_t value) noexcept {
+        return (value << 1U) ^ (0U - (value >> 63U));
     }
-    [[nodiscard]] entry_type type() const {
-        return entry_type_;
+    static std::uint64_t zigzag_decode(std::uint64_t value) noexcept {
+        return (value >> 1U) ^ (0U - (value & 1U));
     }
-    [[nodiscard]] epoch_id_type epoch_id() const {
-        return epoch_id_;
+    static std::size_t store_varint(char* out, std::uint64_t value) noexcept {
+        std::size_t n = 0;
+        while (value >= 0x80U) {
+            out[n++] = static_cast<char>((value & 0x7fU) | 0x80U);  // NOLINT(*-pointer-arithmetic)
+            value >>= 7U;
+        }
+        out[n++] = static_cast<char>(value);  // NOLINT(*-pointer-arithmetic)
+        return n;
     }
-
-    // for the purpose of storing key_sid and value_etc into LevelDB
-    std::string& value_etc() {
-        return value_etc_;
+    template<class In>
+    static std::uint64_t read_varint(In& in, read_error& ec) {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < max_varint_size; i++) {
+            int c = in.get();
+            if (c < 0) {
+                ec.value(read_error::short_entry);
+                return 0;
+            }
+            value |= static_cast<std::uint64_t>(static_cast<unsigned>(c) & 0x7fU) << (7U * i);
+            if ((static_cast<unsigned>(c) & 0x80U) == 0) {
+                return value;
+            }
+        }
+        ec.value(read_error::checksum_mismatch);  // too long, never written
+        return 0;
     }
-    std::string& key_sid() {
-        return key_sid_;
+    static void store_uint32le(char* out, const std::uint32_t value) noexcept {
+        std::uint32_t buf = htole32(value);
+        std::memcpy(out, &buf, sizeof(std::uint32_t));
     }
-    static epoch_id_type write_version_epoch_number(std::string_view value_etc) {
-        epoch_id_type epoch_id{};
-        memcpy(static_cast<void*>(&epoch_id), value_etc.data(), sizeof(epoch_id_type));
-        return epoch_id;
+    static void store_uint64le(char* out, const std::uint64_t value) noexcept {
+        std::uint64_t buf = htole64(value);
+        std::memcpy(out, &buf, sizeof(std::uint64_t));
     }
-    static std::uint64_t write_version_minor_write_version(std::string_view value_etc) {
-        std::uint64_t minor_write_version{};
-        memcpy(static_cast<void*>(&minor_write_version), value_etc.data() + sizeof(epoch_id_type), sizeof(std::uint64_t));
-        return minor_write_version;
+    static std::uint32_t load_uint32le(const char* in) noexcept {
+        std::uint32_t buf{};
+        std::memcpy(&buf, in, sizeof(std::uint32_t));
+        return le32toh(buf);
+    }
+    static std::uint64_t load_uint64le(const char* in) noexcept {
+        std::uint64_t buf{};
+        std::memcpy(&buf, in, sizeof(std::uint64_t));
+        return le64toh(buf);
     }
-
-private:
-    entry_type entry_type_{};
-    epoch_id_type epoch_id_{};
-    std::string key_sid_{};
-    std::string value_etc_{};
 
     static void write_uint8(FILE* out, const std::uint8_t value) {
         int ret = fputc(value, out);
@@ -320,7 +854,8 @@ private:
         std::uint32_t buf = htole32(value);
         write_bytes(out, &buf, sizeof(std::uint32_t));
     }
-    static std::uint32_t read_uint32le(std::istream& in, read_error& ec) {
+    template<class In>
+    static std::uint32_t read_uint32le(In& in, read_error& ec) {
         std::uint32_t buf{};
         read_bytes(in, &buf, sizeof(std::uint32_t), ec);
         return le32toh(buf);
@@ -329,7 +864,8 @@ private:
         std::uint64_t buf = htole64(value);
         write_bytes(out, &buf, sizeof(std::uint64_t));
     }
-    static std::uint64_t read_uint64le(std::istream& in, read_error& ec) {
+    template<class In>
+    static std::uint64_t read_uint64le(In& in, read_error& ec) {
         std::uint64_t buf{};
         read_bytes(in, &buf, sizeof(std::uint64_t), ec);
         return le64toh(buf);
@@ -342,9 +878,9 @@ private:
             throw std::runtime_error("I/O error");
         }
     }
-    static void read_bytes(std::istream& in, void* buf, std::streamsize len, read_error& ec) {
-        in.read(reinterpret_cast<char*>(buf), len);  // NOLINT(*-reinterpret-cast)
-        if (in.eof()) {
+    template<class In>
+    static void read_bytes(In& in, void* buf, std::size_t len, read_error& ec) {
+        if (!in.read(buf, len)) {
             ec.value(read_error::short_entry);
             return;
         }
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cctype>
+#include <fstream>
+#include <new>
+#include <string>
+
+#include <glog/logging.h>
+#include <limestone/logging.h>
+#include "logging_helper.h"
+
+#include "numa.h"
+
+namespace limestone::internal {
+
+// from <numaif.h>, not to depend on libnuma
+static constexpr int mpol_preferred = 1;
+
+static constexpr const char* sysfs_node_dir = "/sys/devices/system/node";
+
+int numa_node_of_current_cpu() noexcept {
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return -1;
+    }
+    return static_cast<int>(node);
+}
+
+int numa_node_count() noexcept {
+    static const int count = []() {
+        int n = 0;
+        boost::system::error_code error;
+        for (boost::filesystem::directory_iterator it(sysfs_node_dir, error), end; !error && it != end; it.increment(error)) {
+            auto name = it->path().filename().string();
+            if (name.rfind("node", 0) == 0 && name.size() > 4 && std::isdigit(static_cast<unsigned char>(name[4])) != 0) {
+                n++;
+            }
+        }
+        return n > 0 ? n : 1;
+    }();
+    return count;
+}
+
+int numa_node_of_path(const boost::filesystem::path& path) noexcept {
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    // the partition has no device link, try its parent (the disk)
+    std::string dev = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    for (const auto* candidate : {"/device/numa_node", "/../device/numa_node"}) {
+        std::ifstream istrm(dev + candidate);
+        int node = -1;
+        if (istrm >> node) {
+            return node;  // -1 if the device does not belong to any node
+        }
+    }
+    return -1;
+}
+
+void* allocate_on_node(std::size_t size, int node) {
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {  // NOLINT(*-cstyle-cast, performance-no-int-to-ptr)
+        throw std::bad_alloc();
+    }
+    if (node >= 0 && node < static_cast<int>(sizeof(unsigned long) * 8)) {  // NOLINT(google-runtime-int)
+        // set before the pages are touched; "preferred" falls back to other nodes if the node is short of memory
+        unsigned long nodemask = 1UL << static_cast<unsigned int>(node);  // NOLINT(google-runtime-int)
+        if (syscall(SYS_mbind, p, size, mpol_preferred, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+            VLOG_LP(log_debug) << "mbind failed, errno = " << errno << ", the memory is not bound to node " << node;
+        }
+    }
+    return p;
+}
+
+void deallocate_on_node(void* p, std::size_t size) noexcept {
+    if (p) {
+        ::munmap(p, size);
+    }
+}
+
+}
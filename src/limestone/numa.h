@@ -0,0 +1,52 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+
+#include <boost/filesystem.hpp>
+
+namespace limestone::internal {
+
+/**
+ * @returns the NUMA node of the CPU running the calling thread, or -1 if unknown
+ */
+int numa_node_of_current_cpu() noexcept;
+
+/**
+ * @returns the number of NUMA nodes, 1 if unknown
+ */
+int numa_node_count() noexcept;
+
+/**
+ * @returns the NUMA node of the block device which the path is on, or -1 if unknown (e.g. not a PCIe device)
+ */
+int numa_node_of_path(const boost::filesystem::path& path) noexcept;
+
+/**
+ * @brief allocate memory preferably on the NUMA node
+ * @details the memory is mapped by pages, so the objects in different allocations never share a cache line.
+ * @param node the NUMA node, or -1 for no preference
+ * @throws std::bad_alloc if failed
+ */
+void* allocate_on_node(std::size_t size, int node);
+
+/**
+ * @brief free the memory allocated by allocate_on_node()
+ */
+void deallocate_on_node(void* p, std::size_t size) noexcept;
+
+}
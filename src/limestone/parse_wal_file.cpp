@@ -14,8 +14,14 @@
  * limitations under the License.
  */
 
-#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem.hpp>
+#include <chrono>
 #include <cstdlib>
+#include <fcntl.h>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <glog/logging.h>
 #include <limestone/logging.h>
@@ -28,17 +34,92 @@
 namespace limestone::internal {
 using namespace limestone::api;
 
-void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos fpos_head_of_epoch_snippet) {
-    auto pos = strm.tellg();
-    strm.seekp(fpos_head_of_epoch_snippet, std::ios::beg);
-    char buf = static_cast<char>(log_entry::entry_type::marker_invalidated_begin);
-    strm.write(&buf, sizeof(char));
-    strm.flush();
-    // TODO fsync
-    strm.seekg(pos, std::ios::beg);  // restore position
-    if (!strm) {
-        LOG_LP(ERROR) << "I/O error at marking epoch snippet header";
+namespace {
+
+// the whole pwal file mapped read-only, the entries are decoded directly from it
+class mapped_pwal_file {
+public:
+    explicit mapped_pwal_file(const boost::filesystem::path& p) {
+        int fd = ::open(p.c_str(), O_RDONLY);  // NOLINT(*-vararg)
+        if (fd < 0) {
+            LOG_LP(ERROR) << "cannot open pwal file: " << p << ", errno = " << errno;
+            throw std::runtime_error("cannot open pwal file");
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            LOG_LP(ERROR) << "fstat failed: " << p << ", errno = " << errno;
+            ::close(fd);
+            throw std::runtime_error("I/O error");
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {  // NOLINT(*-cstyle-cast, *-int-to-ptr)
+                LOG_LP(ERROR) << "mmap failed: " << p << ", errno = " << errno;
+                ::close(fd);
+                throw std::runtime_error("I/O error");
+            }
+            ::madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(addr);
+        }
+        ::close(fd);
+    }
+    ~mapped_pwal_file() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);  // NOLINT(*-const-cast)
+        }
+    }
+    mapped_pwal_file(const mapped_pwal_file&) = delete;
+    mapped_pwal_file& operator=(const mapped_pwal_file&) = delete;
+    mapped_pwal_file(mapped_pwal_file&&) = delete;
+    mapped_pwal_file& operator=(mapped_pwal_file&&) = delete;
+
+    [[nodiscard]] const char* data() const noexcept { return data_; }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+private:
+    const char* data_{};
+    std::size_t size_{};
+};
+
+// mark the epoch snippets at the given offsets invalid, and make them durable by a single fsync;
+// the current types of the headers are read from data, the mapping of the file
+void invalidate_epoch_snippets(const boost::filesystem::path& p, const char* data, const std::vector<std::streamoff>& heads_of_epoch_snippet) {
+    if (heads_of_epoch_snippet.empty()) {
+        return;
     }
+    int fd = ::open(p.c_str(), O_WRONLY);  // NOLINT(*-vararg)
+    if (fd < 0) {
+        LOG_LP(ERROR) << "cannot open pwal file: " << p << ", errno = " << errno;
+        throw std::runtime_error("cannot open pwal file");
+    }
+    for (auto fpos : heads_of_epoch_snippet) {
+        char buf = data[fpos];  // NOLINT(*-pointer-arithmetic)
+        // the header with the length keeps its form; its checksum does not cover the type
+        switch (static_cast<log_entry::entry_type>(buf)) {
+        case log_entry::entry_type::marker_begin_sized:
+            buf = static_cast<char>(log_entry::entry_type::marker_invalidated_begin_sized);
+            break;
+        case log_entry::entry_type::marker_begin_compressed:
+            buf = static_cast<char>(log_entry::entry_type::marker_invalidated_begin_compressed);
+            break;
+        default:
+            buf = static_cast<char>(log_entry::entry_type::marker_invalidated_begin);
+        }
+        if (::pwrite(fd, &buf, sizeof(char), static_cast<off_t>(fpos)) != sizeof(char)) {
+            LOG_LP(ERROR) << "I/O error at marking epoch snippet header, errno = " << errno;
+            ::close(fd);
+            throw std::runtime_error("I/O error");
+        }
+    }
+    if (::fsync(fd) != 0) {
+        LOG_LP(ERROR) << "fsync failed, errno = " << errno;
+        ::close(fd);
+        throw std::runtime_error("I/O error");
+    }
+    ::close(fd);
+}
+
 }
 
 // LOGFORMAT_v1 pWAL syntax
@@ -57,6 +138,20 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //                                 | remove_entry
 //   snippet_footer                = (empty)
 
+//  LOGFORMAT_v2 (persistent format version 2) adds the entries with checksum,
+//  which are read as normal_entry and remove_entry if the checksum matches, or as BROKEN_entry if not
+
+//  LOGFORMAT_v3 (persistent format version 3) adds the snippet headers with the length of the entries,
+//  which are read as marker_begin and marker_invalidated_begin; the entries of the epoch snippet
+//  not to be processed (valid = false) are skipped by the length without parsing
+
+//  LOGFORMAT_v4 (persistent format version 4) adds the entries in the compact form, which are decoded
+//  against the last marker_begin (epoch) and the previous entry (storage_id) in the same epoch snippet
+
+//  LOGFORMAT_v5 (persistent format version 5) adds the snippet headers followed by the compressed entries,
+//  which are read as marker_begin and marker_invalidated_begin; the entries decompressed from the block are
+//  read as if they follow the header, and the block is skipped like the entries of the sized epoch snippet
+
 //  parser rule (with error-handle)
 //   pwal_file                     = wal_header epoch_snippets (EOF)
 //   wal_header                    = (empty)
@@ -75,13 +170,22 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //                                 | SHORT_normal_entry       { if (valid) error-truncated }  // TAIL
 //                                 | SHORT_remove_entry       { if (valid) error-truncated }  // TAIL
 //                                 | UNKNOWN_TYPE_entry       { if (valid) error-damaged-entry }  // TAIL
+//                                 | BROKEN_entry             { if (valid) error-damaged-entry }  // TAIL
 //   snippet_footer                = (empty)
 
 // lexer rule (see log_entry.h)
 //   marker_begin                  = 0x02 epoch
+//                                 | 0x09 epoch snippet_length snippet_entries header_checksum
+//                                 | 0x0d epoch snippet_length snippet_entries data_size block_checksum header_checksum
 //   marker_invalidated_begin      = 0x06 epoch
+//                                 | 0x0a epoch snippet_length snippet_entries header_checksum
+//                                 | 0x0e epoch snippet_length snippet_entries data_size block_checksum header_checksum
 //   normal_entry                  = 0x01 key_length value_length storage_id key(key_length) write_version_major write_version_minor value(value_length)
+//                                 | 0x07 key_length value_length storage_id key(key_length) write_version_major write_version_minor value(value_length) checksum
+//                                 | 0x0b varint(key_length) varint(value_length) varint(storage_id_delta) varint(epoch_delta) varint(write_version_minor) key(key_length) value(value_length) checksum
 //   remove_entry                  = 0x05 key_length storage_id key(key_length) writer_version_major writer_version_minor
+//                                 | 0x08 key_length storage_id key(key_length) writer_version_major writer_version_minor checksum
+//                                 | 0x0c varint(key_length) varint(storage_id_delta) varint(epoch_delta) varint(write_version_minor) key(key_length) checksum
 //   marker_durable                = 0x04 epoch
 //   marker_end                    = 0x03 epoch
 //   epoch                         = int64le
@@ -90,8 +194,20 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //   storage_id                    = int64le
 //   write_version_major           = int64le
 //   write_version_minor           = int64le
+//   checksum                      = int32le  // CRC32C of the entry from the type byte
+//   snippet_length                = int64le  // bytes of the entries following the header, 0 if not known
+//   snippet_entries               = int64le
+//   header_checksum               = int32le  // CRC32C of epoch, snippet_length and snippet_entries
+//   data_size                     = int64le  // bytes of the entries compressed into the block of snippet_length bytes
+//   block_checksum                = int32le  // CRC32C of the block
+//   storage_id_delta              = zigzag(storage_id - storage_id of the previous entry in the epoch snippet, or 0)
+//   epoch_delta                   = zigzag(write_version_major - epoch of the epoch snippet)
 //   SHORT_marker_begin            = 0x02 byte(0-7)
+//                                 | 0x09 byte(0-27)
+//                                 | 0x0d byte(0-39)
 //   SHORT_marker_inv_begin        = 0x06 byte(0-7)
+//                                 | 0x0a byte(0-27)
+//                                 | 0x0e byte(0-39)
 //   SHORT_normal_entry            = 0x01 key_length value_length storage_id key(key_length) write_version_major write_version_minor value(<value_length)
 //                                 | 0x01 key_length value_length storage_id key(key_length) byte(0-15)
 //                                 | 0x01 key_length value_length storage_id key(<key_length)
@@ -99,10 +215,14 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //   SHORT_remove_entry            = 0x05 key_length storage_id key(key_length) byte(0-15)
 //                                 = 0x05 key_length storage_id key(<key_length)
 //                                 = 0x05 byte(0-11)
+//   (SHORT_normal_entry and SHORT_remove_entry of 0x07, 0x08, 0x0b and 0x0c are alike)
+//   (the compressed block shorter than snippet_length is SHORT_normal_entry)
 //   SHORT_marker_durable          = 0x04 byte(0-7)
 //   SHORT_marker_end              = 0x03 byte(0-7)
 //   UNKNOWN_TYPE_entry            = 0x00 byte(0-)
-//                                 | 0x07-0xff byte(0-)
+//                                 | 0x0f-0xff byte(0-)
+//   BROKEN_entry                  = entry or header with checksum, whose checksum does not match or whose varint is too long
+//                                 | compressed block which does not match its checksum, or cannot be decompressed
 //   // marker_durable and marker_end are not used in pWAL file
 //   // SHORT_*, UNKNOWN_* appears just before EOF
     class lex_token {
@@ -111,7 +231,7 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
             eof,
             normal_entry = 1, marker_begin, marker_end, marker_durable, remove_entry, marker_invalidated_begin,
             SHORT_normal_entry = 101, SHORT_marker_begin, SHORT_marker_end, SHORT_marker_durable, SHORT_remove_entry, SHORT_marker_inv_begin,
-            UNKNOWN_TYPE_entry = 1001,
+            UNKNOWN_TYPE_entry = 1001, BROKEN_entry,
         };
 
         lex_token(log_entry::read_error& ec, bool data_remains, log_entry& e) {
@@ -142,6 +262,8 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
                 }
             } else if (ec.value() == log_entry::read_error::unknown_type) {
                 value_ = token_type::UNKNOWN_TYPE_entry;
+            } else if (ec.value() == log_entry::read_error::checksum_mismatch) {
+                value_ = token_type::BROKEN_entry;
             } else {
                 assert(false);
             }
@@ -160,6 +282,7 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //    SHORT_marker_begin         : { head_pos := ...; error-truncated } -> END
 //    SHORT_marker_inv_begin     : { head_pos := ... } -> END
 //    UNKNOWN_TYPE_entry         : { error-broken-snippet-header } -> END
+//    BROKEN_entry               : { err_unexpected } -> END
 //    else                       : { err_unexpected } -> END
 //  loop:
 //    normal_entry               : { if (valid) process-entry } -> loop
@@ -172,19 +295,101 @@ void invalidate_epoch_snippet(boost::filesystem::fstream& strm, std::streampos f
 //    SHORT_marker_begin         : { head_pos := ...; error-truncated } -> END
 //    SHORT_marker_inv_begin     : { head_pos := ... } -> END
 //    UNKNOWN_TYPE_entry         : { if (valid) error-damaged-entry } -> END
+//    BROKEN_entry               : { if (valid) error-damaged-entry } -> END
 
 
+std::vector<std::pair<std::streamoff, std::streamoff>> dblog_scan::split_pwal_file(const char* data, std::size_t size) const {
+    std::vector<std::pair<std::streamoff, std::streamoff>> ranges{};
+    std::streamoff begin = 0;
+    if (split_size_ > 0 && size > split_size_) {
+        // follow the headers of the epoch snippets by their lengths, until the one without the length
+        log_entry e;
+        log_entry::read_error ec{};
+        log_entry::buffer_reader in{data, size};
+        while (e.read_entry_from(in, ec)
+               && (e.type() == log_entry::entry_type::marker_begin || e.type() == log_entry::entry_type::marker_invalidated_begin)
+               && e.snippet_length() > 0 && e.snippet_length() <= size - static_cast<std::uintmax_t>(in.tell())) {
+            std::streamoff next = in.tell() + static_cast<std::streamoff>(e.snippet_length());
+            if (static_cast<std::uintmax_t>(next - begin) >= split_size_ && static_cast<std::size_t>(next) < size) {
+                ranges.emplace_back(begin, next);
+                begin = next;
+            }
+            in.seek(next);
+        }
+    }
+    ranges.emplace_back(begin, static_cast<std::streamoff>(size));
+    return ranges;
+}
+
 // scan the file, and check max epoch number in this file
-epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-cognitive-complexity)
+epoch_id_type dblog_scan::scan_one_pwal_file(
         const boost::filesystem::path& p, epoch_id_type ld_epoch,
         const std::function<void(log_entry&)>& add_entry,
         const error_report_func_t& report_error,
         parse_error& pe) {
     VLOG_LP(log_info) << "processing pwal file: " << p.filename().string();
+    auto start = std::chrono::steady_clock::now();
+    mapped_pwal_file mapped{p};
+    // the epoch snippets to be marked invalid, written at once after the scan
+    std::vector<std::streamoff> marks{};
+    int fixed = 0;
+    epoch_id_type max_epoch_of_file{0};
+    std::vector<std::pair<std::streamoff, std::streamoff>> ranges{};
+    if (split_files_ && task_pool_ != nullptr && thread_num_ > 1) {
+        ranges = split_pwal_file(mapped.data(), mapped.size());
+    }
+    if (ranges.size() <= 1) {
+        max_epoch_of_file = scan_pwal_range(p, mapped.data(), 0, static_cast<std::streamoff>(mapped.size()), ld_epoch, add_entry, report_error,
+                                            pe, marks, fixed);
+    } else {
+        // every part but the last one ends at an epoch snippet header, and a broken entry in it aborts the scan by report_error,
+        // so the parts have the same result as scanning the whole file at once
+        struct range_result {
+            parse_error pe{};
+            std::vector<std::streamoff> marks{};
+            int fixed{};
+            epoch_id_type max_epoch{};
+        };
+        std::vector<range_result> results(ranges.size());
+        task_pool_->parallel_for(ranges.size(), [&](std::size_t i) {
+            auto& r = results.at(i);
+            r.max_epoch = scan_pwal_range(p, mapped.data(), ranges.at(i).first, ranges.at(i).second, ld_epoch, add_entry, report_error,
+                                          r.pe, r.marks, r.fixed);
+        }, static_cast<std::size_t>(thread_num_));
+        for (auto& r : results) {
+            max_epoch_of_file = std::max(max_epoch_of_file, r.max_epoch);
+            marks.insert(marks.end(), r.marks.begin(), r.marks.end());
+            fixed += r.fixed;
+            if (pe.value() < r.pe.value()) {
+                pe = r.pe;
+            }
+        }
+        VLOG_LP(log_info) << "scanned pwal file in " << ranges.size() << " parts: " << p.filename().string();
+    }
+    invalidate_epoch_snippets(p, mapped.data(), marks);
+    if (pe.value() == parse_error::broken_after_tobe_cut) {
+        // DO trim
+        // TODO: check byte at fpos is 0x02 or 0x06
+        boost::filesystem::resize_file(p, pe.fpos());
+        VLOG_LP(0) << "trimmed " << p << " at offset " << pe.fpos();
+        pe.value(parse_error::repaired);
+        fixed++;
+    }
+    VLOG_LP(30) << "fixed: " << fixed;
+    VLOG_LP(log_info) << "processed pwal file: " << p.filename().string() << " ("
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms, "
+                      << marks.size() << " marked)";
+    pe.modified(fixed > 0);
+    return max_epoch_of_file;
+}
+
+epoch_id_type dblog_scan::scan_pwal_range(  // NOLINT(readability-function-cognitive-complexity)
+        const boost::filesystem::path& p, const char* data, std::streamoff begin, std::streamoff end,
+        epoch_id_type ld_epoch, const std::function<void(log_entry&)>& add_entry, const error_report_func_t& report_error,
+        parse_error& pe, std::vector<std::streamoff>& marks, int& fixed) {
     epoch_id_type current_epoch{UINT64_MAX};
     epoch_id_type max_epoch_of_file{0};
     log_entry::read_error ec{};
-    int fixed = 0;
 
     log_entry e;
     auto err_unexpected = [&](){
@@ -193,12 +398,16 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
         ectmp.entry_type(e.type());
         report_error(ectmp);
     };
-    boost::filesystem::fstream strm;
-    strm.open(p, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
-    if (!strm) {
-        LOG_LP(ERROR) << "cannot open pwal file: " << p;
-        throw std::runtime_error("cannot open pwal file");
-    }
+    log_entry::buffer_reader in{data, static_cast<std::size_t>(begin), static_cast<std::size_t>(end)};
+    // skip the entries of the epoch snippet not to be processed, if the header has the length;
+    // if the snippet looks truncated, it is parsed to find where it is broken
+    auto skip_entries = [&]() {
+        auto length = e.snippet_length();
+        if (length > 0 && static_cast<std::uintmax_t>(in.tell()) + length <= in.size()) {
+            in.seek(in.tell() + static_cast<std::streamoff>(length));
+            VLOG_LP(45) << "skipped " << length << " bytes";
+        }
+    };
     bool valid = true;  // scanning in the normal (not-invalidated) epoch snippet
     [[maybe_unused]]
     bool invalidated_wrote = true;  // invalid mark is wrote, so no need to mark again
@@ -206,9 +415,25 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
     bool first = true;
     ec.value(log_entry::read_error::ok);
     std::streampos fpos_epoch_snippet;
+    // the epoch snippet being scanned, reported to snippet_scanned_ at its end
+    std::optional<std::streamoff> snippet_head{};
+    epoch_id_type snippet_epoch{};
+    auto end_snippet = [&](std::streamoff end) {
+        if (snippet_scanned_ && snippet_head.has_value()) {
+            snippet_scanned_(p, snippet_epoch, *snippet_head, end - *snippet_head, valid);
+        }
+        snippet_head.reset();
+    };
+    auto begin_snippet = [&](std::streamoff head) {
+        end_snippet(head);
+        snippet_head = head;
+        snippet_epoch = e.epoch_id();
+    };
+    std::streamoff scanned_pos{};
     while (true) {
-        auto fpos_before_read_entry = strm.tellg();
-        bool data_remains = e.read_entry_from(strm, ec);
+        std::streampos fpos_before_read_entry = in.tell();
+        scanned_pos = in.tell();
+        bool data_remains = e.read_entry_from(in, ec);
         VLOG_LP(45) << "read: { ec:" << ec.value() << " : " << ec.message() << ", data_remains:" << data_remains << ", e:" << static_cast<int>(e.type()) << "}";
         lex_token tok{ec, data_remains, e};
         VLOG_LP(45) << "token: " << static_cast<int>(tok.value());
@@ -233,6 +458,7 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
         case lex_token::token_type::marker_begin: {
 // marker_begin : { head_pos := ...; max-epoch := max(...); if (epoch <= ld) { valid := true } else { valid := false, error-nondurable } } -> loop
             fpos_epoch_snippet = fpos_before_read_entry;
+            begin_snippet(fpos_before_read_entry);
             current_epoch = e.epoch_id();
             max_epoch_of_file = std::max(max_epoch_of_file, current_epoch);
             marked_before_scan = false;
@@ -247,7 +473,7 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
                     invalidated_wrote = false;
                     break;
                 case process_at_nondurable::repair_by_mark:
-                    invalidate_epoch_snippet(strm, fpos_epoch_snippet);
+                    marks.emplace_back(fpos_epoch_snippet);
                     VLOG_LP(0) << "marked invalid " << p << " at offset " << fpos_epoch_snippet;
                     fixed++;
                     invalidated_wrote = true;
@@ -267,17 +493,20 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
                 }
                 valid = false;
                 VLOG_LP(45) << "valid: false";
+                skip_entries();
             }
             break;
         }
         case lex_token::token_type::marker_invalidated_begin: {
 // marker_invalidated_begin : { head_pos := ...; max-epoch := max(...); valid := false } -> loop
             fpos_epoch_snippet = fpos_before_read_entry;
+            begin_snippet(fpos_before_read_entry);
             max_epoch_of_file = std::max(max_epoch_of_file, e.epoch_id());
             marked_before_scan = true;
             invalidated_wrote = true;
             valid = false;
             VLOG_LP(45) << "valid: false (already marked)";
+            skip_entries();
             break;
         }
         case lex_token::token_type::SHORT_normal_entry:
@@ -291,9 +520,8 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
                 case process_at_truncated::ignore:
                     break;
                 case process_at_truncated::repair_by_mark:
-                    strm.clear();  // reset eof
                     if (valid) {
-                        invalidate_epoch_snippet(strm, fpos_epoch_snippet);
+                        marks.emplace_back(fpos_epoch_snippet);
                         fixed++;
                         VLOG_LP(0) << "marked invalid " << p << " at offset " << fpos_epoch_snippet;
                         // quitting loop just after this, so no need to change 'valid', but...
@@ -328,13 +556,13 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
         case lex_token::token_type::SHORT_marker_begin: {
 // SHORT_marker_begin : { head_pos := ...; error-truncated } -> END
             fpos_epoch_snippet = fpos_before_read_entry;
+            end_snippet(fpos_before_read_entry);
             marked_before_scan = false;
             switch (process_at_truncated_) {
             case process_at_truncated::ignore:
                 break;
             case process_at_truncated::repair_by_mark:
-                strm.clear();  // reset eof
-                invalidate_epoch_snippet(strm, fpos_epoch_snippet);
+                marks.emplace_back(fpos_epoch_snippet);
                 fixed++;
                 VLOG_LP(0) << "marked invalid " << p << " at offset " << fpos_epoch_snippet;
                 pe = parse_error(parse_error::broken_after_marked, fpos_epoch_snippet);
@@ -352,14 +580,14 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
         case lex_token::token_type::SHORT_marker_inv_begin: {
 // SHORT_marker_inv_begin : { head_pos := ... } -> END
             fpos_epoch_snippet = fpos_before_read_entry;
+            end_snippet(fpos_before_read_entry);
             marked_before_scan = true;
             // ignore short in invalidated blocks
             switch (process_at_truncated_) {
             case process_at_truncated::ignore:
                 break;
             case process_at_truncated::repair_by_mark:
-                strm.clear();  // reset eof
-                // invalidate_epoch_snippet(strm, fpos_epoch_snippet);
+                // marks.emplace_back(fpos_epoch_snippet);
                 // fixed++;
                 // VLOG_LP(0) << "marked invalid " << p << " at offset " << fpos_epoch_snippet;
                 pe = parse_error(parse_error::broken_after_marked, fpos_epoch_snippet);
@@ -374,9 +602,10 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
             aborted = true;
             break;
         }
-        case lex_token::token_type::UNKNOWN_TYPE_entry: {
-// UNKNOWN_TYPE_entry : (not 1st) { if (valid) error-damaged-entry } -> END
-// UNKNOWN_TYPE_entry : (1st) { error-broken-snippet-header } -> END
+        case lex_token::token_type::UNKNOWN_TYPE_entry:
+        case lex_token::token_type::BROKEN_entry: {
+// UNKNOWN_TYPE_entry | BROKEN_entry : (not 1st) { if (valid) error-damaged-entry } -> END
+// UNKNOWN_TYPE_entry | BROKEN_entry : (1st) { error-broken-snippet-header } -> END
             if (first) {
                 err_unexpected();  // FIXME: error type
                 pe = parse_error(parse_error::unexpected, fpos_before_read_entry);
@@ -385,9 +614,8 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
                 case process_at_damaged::ignore:
                     break;
                 case process_at_damaged::repair_by_mark:
-                    strm.clear();  // reset eof
                     if (valid) {
-                        invalidate_epoch_snippet(strm, fpos_epoch_snippet);
+                        marks.emplace_back(fpos_epoch_snippet);
                         fixed++;
                         VLOG_LP(0) << "marked invalid " << p << " at offset " << fpos_epoch_snippet;
                         // quitting loop just after this, so no need to change 'valid', but...
@@ -430,17 +658,7 @@ epoch_id_type dblog_scan::scan_one_pwal_file(  // NOLINT(readability-function-co
         if (aborted) break;
         first = false;
     }
-    strm.close();
-    if (pe.value() == parse_error::broken_after_tobe_cut) {
-        // DO trim
-        // TODO: check byte at fpos is 0x02 or 0x06
-        boost::filesystem::resize_file(p, pe.fpos());
-        VLOG_LP(0) << "trimmed " << p << " at offset " << pe.fpos();
-        pe.value(parse_error::repaired);
-        fixed++;
-    }
-    VLOG_LP(30) << "fixed: " << fixed;
-    pe.modified(fixed > 0);
+    end_snippet(scanned_pos);
     return max_epoch_of_file;
 }
 
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+namespace limestone::internal {
+
+// persistent format versions, written in the manifest file
+//  1: the original format
+//  2: the entries in pwal files have CRC32C checksums
+//  3: the epoch snippets in pwal files have the headers with the length and the number of the entries
+//  4: the entries in pwal files are written in the compact (varint-encoded) form
+//  5: the epoch snippets in pwal files may be compressed
+inline constexpr int oldest_persistent_format_version = 1;
+inline constexpr int latest_persistent_format_version = 5;
+
+// the persistent format version from which the pwal entries have checksums
+inline constexpr int checksummed_persistent_format_version = 2;
+
+// the persistent format version from which the epoch snippets have the headers with the length
+inline constexpr int sized_snippet_persistent_format_version = 3;
+
+// the persistent format version from which the pwal entries are written in the compact form
+inline constexpr int packed_entry_persistent_format_version = 4;
+
+// the persistent format version from which the epoch snippets in pwal files can be compressed, if configured
+inline constexpr int compressed_snippet_persistent_format_version = 5;
+
+}
@@ -77,19 +77,22 @@ public:
     sortdb_wrapper(sortdb_wrapper&& other) noexcept = delete;
     sortdb_wrapper& operator=(sortdb_wrapper&& other) noexcept = delete;
 
-    bool put(const std::string& key, const std::string& value) {
+    bool put(std::string_view key, std::string_view value) {
         WriteOptions write_options{};
-        auto status = sortdb_->Put(write_options, key, value);
+        auto status = sortdb_->Put(write_options, Slice(key.data(), key.size()), Slice(value.data(), value.size()));
         return status.ok();
     }
 
-    bool get(const std::string& key, std::string* value) {
+    // value is overwritten, so that the caller can reuse its buffer
+    bool get(std::string_view key, std::string* value) {
         ReadOptions read_options{};
-        auto status = sortdb_->Get(read_options, key, value);
+        auto status = sortdb_->Get(read_options, Slice(key.data(), key.size()), value);
         return status.ok();
     }
 
-    void each(const std::function<void(std::string_view, std::string_view)>& fun) {
+    // fun(std::string_view key, std::string_view value) is called for each entry in the order of the keys
+    template<class F>
+    void each(F&& fun) {
         Iterator* it = sortdb_->NewIterator(ReadOptions());  // NOLINT (typical usage of API)
         for (it->SeekToFirst(); it->Valid(); it->Next()) {
             Slice key = it->key();
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <system_error>
+
+#include <glog/logging.h>
+#include <limestone/logging.h>
+#include "logging_helper.h"
+
+#include "task_pool.h"
+
+namespace limestone::internal {
+
+// the pool whose task the current thread is running, if any
+static thread_local task_pool* current_pool = nullptr;
+
+task_pool::task_pool(std::size_t size) noexcept : size_(std::max(size, static_cast<std::size_t>(1))) {
+}
+
+task_pool::~task_pool() {
+    {
+        std::lock_guard<std::mutex> lock{mtx_};
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) {
+        w.join();
+    }
+}
+
+bool task_pool::claim(batch& b, std::size_t& i) {
+    if (b.next >= b.n || b.running >= b.max_parallelism) {
+        return false;
+    }
+    i = b.next++;
+    b.running++;
+    if (b.next >= b.n) {
+        batches_.erase(std::find(batches_.begin(), batches_.end(), &b));
+    }
+    return true;
+}
+
+void task_pool::run(std::unique_lock<std::mutex>& lock, batch& b, std::size_t i) {
+    lock.unlock();
+    std::exception_ptr ex{};
+    try {
+        (*b.fn)(i);
+    } catch (...) {
+        ex = std::current_exception();
+    }
+    lock.lock();
+    b.running--;
+    if (ex) {
+        if (!b.ex) {  // only save one
+            b.ex = ex;
+        }
+        if (b.next < b.n) {  // skip the rest
+            b.next = b.n;
+            batches_.erase(std::find(batches_.begin(), batches_.end(), &b));
+        }
+    }
+    // the caller may be waiting for the batch, and another call of the batch may be taken now
+    cv_.notify_all();
+}
+
+void task_pool::worker_main() {
+    current_pool = this;
+    std::unique_lock<std::mutex> lock{mtx_};
+    while (true) {
+        batch* b = nullptr;
+        std::size_t i{};
+        cv_.wait(lock, [this, &b, &i]() {
+            for (auto* e : batches_) {
+                if (claim(*e, i)) {
+                    b = e;
+                    return true;
+                }
+            }
+            return stopping_;
+        });
+        if (b == nullptr) {
+            return;
+        }
+        idle_--;
+        run(lock, *b, i);
+        idle_++;
+    }
+}
+
+void task_pool::parallel_for(std::size_t n, const std::function<void(std::size_t)>& fn, std::size_t max_parallelism) {
+    if (n == 0) {
+        return;
+    }
+    batch b{n, &fn, std::max(max_parallelism, static_cast<std::size_t>(1))};
+    bool nested = current_pool == this;
+    std::unique_lock<std::mutex> lock{mtx_};
+    batches_.push_back(&b);
+    // the thread running a nested call counts as one
+    std::size_t wanted = std::min(n, b.max_parallelism) - (nested ? 1 : 0);
+    while (workers_.size() < size_ && idle_ < wanted) {
+        try {
+            workers_.emplace_back(&task_pool::worker_main, this);
+        } catch (std::system_error& ex) {
+            if (workers_.empty() && !nested) {
+                LOG_LP(ERROR) << "cannot start a thread: " << ex.what();
+                batches_.erase(std::find(batches_.begin(), batches_.end(), &b));
+                throw;
+            }
+            LOG_LP(WARNING) << "cannot start a thread, continue with " << workers_.size() << " threads: " << ex.what();
+            break;
+        }
+        idle_++;
+    }
+    cv_.notify_all();
+    while (b.next < b.n || b.running > 0) {
+        std::size_t i{};
+        if (nested && claim(b, i)) {
+            run(lock, b, i);
+            continue;
+        }
+        cv_.wait(lock);
+    }
+    lock.unlock();
+    if (b.ex) {
+        std::rethrow_exception(b.ex);
+    }
+}
+
+}
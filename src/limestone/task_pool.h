@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024-2024 Project Tsurugi.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace limestone::internal {
+
+/**
+ * @brief the threads shared by the parallel phases, i.e. scanning pwal files, sorting them,
+ * writing compacted pwal files and restoring files
+ * @details the threads are started on demand up to the size of the pool, and kept until the pool is destroyed.
+ * the tasks of parallel_for(), even of nested or concurrent calls, are run only by the threads of the pool,
+ * so the number of the threads running the tasks never exceeds the size of the pool.
+ * an idle thread takes the next task from the oldest call which has one.
+ */
+class task_pool {
+public:
+    /**
+     * @brief create an object, no thread is started yet
+     * @param size the maximum number of the threads, at least 1
+     */
+    explicit task_pool(std::size_t size) noexcept;
+
+    /**
+     * @brief stop and join the threads
+     * @attention no parallel_for() can be running
+     */
+    ~task_pool();
+
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+    task_pool(task_pool&&) = delete;
+    task_pool& operator=(task_pool&&) = delete;
+
+    /**
+     * @brief call fn(0) ... fn(n - 1) by the threads of the pool, and wait for them
+     * @param max_parallelism the number of the calls running at a time, up to the size of the pool
+     * @details if called from a task of this pool (nested), the calling thread runs the calls by itself while waiting,
+     * so that it does not hold its thread idle.
+     * if fn throws, the rest of the calls are skipped and the first exception is rethrown.
+     */
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)>& fn, std::size_t max_parallelism = SIZE_MAX);
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+private:
+    // the calls of one parallel_for(), guarded by mtx_
+    struct batch {
+        std::size_t n;
+        const std::function<void(std::size_t)>* fn;
+        std::size_t max_parallelism;
+        std::size_t next{};
+        std::size_t running{};
+        std::exception_ptr ex{};
+    };
+
+    // takes the next call of the batch, removing the batch from batches_ if it has no more call
+    bool claim(batch& b, std::size_t& i);
+
+    // runs the call without holding mtx_
+    void run(std::unique_lock<std::mutex>& lock, batch& b, std::size_t i);
+
+    void worker_main();
+
+    std::size_t size_;
+    std::mutex mtx_{};
+    std::condition_variable cv_{};  // notified when a batch is added, or a call finishes
+    std::deque<batch*> batches_{};  // the batches having the calls not yet taken, oldest first
+    std::vector<std::thread> workers_{};
+    std::size_t idle_{};
+    bool stopping_{};
+};
+
+}
@@ -92,4 +92,277 @@ TEST_F(datastore_test, add_persistent_callback_test) { // NOLINT
 
 }
 
+TEST_F(datastore_test, striped_data_locations) { // NOLINT
+    if (system("rm -rf /tmp/datastore_test") != 0) {
+        std::cerr << "cannot remove directory" << std::endl;
+    }
+    if (system("mkdir -p /tmp/datastore_test/data_location /tmp/datastore_test/metadata_location") != 0) {
+        std::cerr << "cannot make directory" << std::endl;
+    }
+    boost::filesystem::path data_location2{"/tmp/datastore_test/data_location2"};  // created by datastore
+
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(data_location);
+    data_locations.emplace_back(data_location2);
+    boost::filesystem::path metadata_location_path{metadata_location};
+    limestone::api::configuration conf(data_locations, metadata_location_path);
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    std::vector<limestone::api::log_channel*> channels{};
+    for (int i = 0; i < 4; i++) {
+        channels.emplace_back(&datastore_->create_channel(boost::filesystem::path(data_location)));
+    }
+    // placed on the data locations alternately
+    EXPECT_EQ(channels.at(0)->file_path().parent_path(), boost::filesystem::path(data_location));
+    EXPECT_EQ(channels.at(1)->file_path().parent_path(), data_location2);
+    EXPECT_EQ(channels.at(2)->file_path().parent_path(), boost::filesystem::path(data_location));
+    EXPECT_EQ(channels.at(3)->file_path().parent_path(), data_location2);
+
+    datastore_->switch_epoch(1);
+    datastore_->ready();
+    for (std::size_t i = 0; i < channels.size(); i++) {
+        channels.at(i)->begin_session();
+        channels.at(i)->add_entry(2, "k" + std::to_string(i), "v" + std::to_string(i), {1, i});
+        channels.at(i)->end_session();
+    }
+    datastore_->switch_epoch(2);
+    datastore_->shutdown();
+    EXPECT_TRUE(boost::filesystem::exists(data_location2 / "pwal_0001"));
+    EXPECT_TRUE(boost::filesystem::exists(data_location2 / "pwal_0003"));
+
+    // recover from both of the data locations
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    auto ss = datastore_->get_snapshot();
+    auto cursor = ss->get_cursor();
+    for (std::size_t i = 0; i < channels.size(); i++) {
+        ASSERT_TRUE(cursor->next());
+        std::string buf{};
+        cursor->key(buf);
+        EXPECT_EQ(buf, "k" + std::to_string(i));
+    }
+    EXPECT_FALSE(cursor->next());
+    datastore_->shutdown();
+}
+
+TEST_F(datastore_test, striped_data_locations_backup_restore) { // NOLINT
+    if (system("rm -rf /tmp/datastore_test") != 0) {
+        std::cerr << "cannot remove directory" << std::endl;
+    }
+    if (system("mkdir -p /tmp/datastore_test/data_location /tmp/datastore_test/metadata_location /tmp/datastore_test/bk") != 0) {
+        std::cerr << "cannot make directory" << std::endl;
+    }
+    boost::filesystem::path data_location_path{data_location};
+    boost::filesystem::path data_location2{"/tmp/datastore_test/data_location2"};  // created by datastore
+    boost::filesystem::path metadata_location_path{metadata_location};
+    boost::filesystem::path bk_path{"/tmp/datastore_test/bk"};
+
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(data_location);
+    data_locations.emplace_back(data_location2);
+    limestone::api::configuration conf(data_locations, metadata_location_path);
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    std::vector<limestone::api::log_channel*> channels{};
+    for (int i = 0; i < 4; i++) {
+        channels.emplace_back(&datastore_->create_channel(data_location_path));
+    }
+    datastore_->switch_epoch(1);
+    datastore_->ready();
+    for (std::size_t i = 0; i < channels.size(); i++) {
+        channels.at(i)->begin_session();
+        channels.at(i)->add_entry(2, "k" + std::to_string(i), "v" + std::to_string(i), {1, i});
+        channels.at(i)->end_session();
+    }
+    datastore_->switch_epoch(2);
+    {
+        auto backup = datastore_->begin_backup(limestone::api::backup_type::standard);
+        for (const auto& e : backup->entries()) {
+            boost::filesystem::copy_file(e.source_path(), bk_path / e.destination_path());
+        }
+    }
+    // the active epoch file is not a backup entry, the durable epoch is in the rotated one
+    boost::filesystem::copy_file(metadata_location_path / "epoch", bk_path / "epoch");
+    datastore_->shutdown();
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    ASSERT_EQ(datastore_->restore(bk_path.string(), true), limestone::status::ok);
+
+    // the pwal files are placed by the channel id as create_channel() does, the others as before
+    int pwal_files = 0;
+    for (const boost::filesystem::path& p : boost::filesystem::directory_iterator(bk_path)) {
+        auto name = p.filename().string();
+        boost::filesystem::path expected = metadata_location_path;
+        if (name.rfind("pwal_", 0) == 0) {
+            int id = std::stoi(name.substr(5, 4));
+            expected = id % 2 == 0 ? data_location_path : data_location2;
+            pwal_files++;
+        }
+        EXPECT_TRUE(boost::filesystem::exists(expected / name)) << name;
+        for (const auto& dir : {data_location_path, data_location2, metadata_location_path}) {
+            if (dir != expected) {
+                EXPECT_FALSE(boost::filesystem::exists(dir / name)) << name << " in " << dir;
+            }
+        }
+    }
+    EXPECT_EQ(pwal_files, 4);
+
+    // the channels made after the restore append to the files of the same ids
+    channels.clear();
+    for (int i = 0; i < 4; i++) {
+        channels.emplace_back(&datastore_->create_channel(data_location_path));
+    }
+    EXPECT_EQ(channels.at(1)->file_path().parent_path(), data_location2);
+    EXPECT_EQ(channels.at(2)->file_path().parent_path(), data_location_path);
+    datastore_->ready();
+    auto ss = datastore_->get_snapshot();
+    auto cursor = ss->get_cursor();
+    for (std::size_t i = 0; i < channels.size(); i++) {
+        ASSERT_TRUE(cursor->next());
+        std::string buf{};
+        cursor->key(buf);
+        EXPECT_EQ(buf, "k" + std::to_string(i));
+    }
+    EXPECT_FALSE(cursor->next());
+    datastore_->shutdown();
+}
+
+TEST_F(datastore_test, separate_metadata_location) { // NOLINT
+    if (system("rm -rf /tmp/datastore_test") != 0) {
+        std::cerr << "cannot remove directory" << std::endl;
+    }
+    if (system("mkdir -p /tmp/datastore_test/data_location") != 0) {
+        std::cerr << "cannot make directory" << std::endl;
+    }
+    boost::filesystem::path data_location_path{data_location};
+    boost::filesystem::path metadata_location_path{metadata_location};  // created by datastore
+
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(data_location);
+    limestone::api::configuration conf(data_locations, metadata_location_path);
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    auto& channel = datastore_->create_channel(data_location_path);
+    datastore_->switch_epoch(1);
+    datastore_->ready();
+    channel.begin_session();
+    channel.add_entry(2, "k", "v", {1, 0});
+    channel.end_session();
+    datastore_->switch_epoch(2);
+
+    EXPECT_TRUE(boost::filesystem::exists(metadata_location_path / "epoch"));
+    EXPECT_TRUE(boost::filesystem::exists(metadata_location_path / "limestone-manifest.json"));
+    EXPECT_FALSE(boost::filesystem::exists(data_location_path / "epoch"));
+    EXPECT_FALSE(boost::filesystem::exists(data_location_path / "limestone-manifest.json"));
+    EXPECT_TRUE(boost::filesystem::exists(data_location_path / "pwal_0000"));
+
+    // rotated epoch files are placed on the metadata location, and backed up
+    auto backup = datastore_->begin_backup(limestone::api::backup_type::standard);
+    int epoch_files = 0;
+    for (const auto& e : backup->entries()) {
+        if (e.destination_path().string().rfind("epoch.", 0) == 0) {
+            EXPECT_EQ(e.source_path().parent_path(), metadata_location_path);
+            epoch_files++;
+        }
+    }
+    EXPECT_EQ(epoch_files, 1);
+    datastore_->shutdown();
+
+    // recover with the durable epoch in the metadata location
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    auto ss = datastore_->get_snapshot();
+    auto cursor = ss->get_cursor();
+    ASSERT_TRUE(cursor->next());
+    std::string buf{};
+    cursor->value(buf);
+    EXPECT_EQ(buf, "v");
+    EXPECT_FALSE(cursor->next());
+    datastore_->shutdown();
+}
+
+TEST_F(datastore_test, metadata_location_ignored_for_old_log_dir) { // NOLINT
+    if (system("rm -rf /tmp/datastore_test") != 0) {
+        std::cerr << "cannot remove directory" << std::endl;
+    }
+    if (system("mkdir -p /tmp/datastore_test/data_location /tmp/datastore_test/metadata_location") != 0) {
+        std::cerr << "cannot make directory" << std::endl;
+    }
+    boost::filesystem::path data_location_path{data_location};
+    boost::filesystem::path metadata_location_path{metadata_location};
+
+    // made without metadata_location
+    {
+        std::vector<boost::filesystem::path> data_locations{};
+        data_locations.emplace_back(data_location);
+        limestone::api::configuration conf(data_locations, boost::filesystem::path{});
+        datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    }
+    EXPECT_TRUE(boost::filesystem::exists(data_location_path / "epoch"));
+    EXPECT_TRUE(boost::filesystem::exists(data_location_path / "limestone-manifest.json"));
+
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(data_location);
+    limestone::api::configuration conf(data_locations, metadata_location_path);
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    EXPECT_TRUE(boost::filesystem::is_empty(metadata_location_path));
+    datastore_->shutdown();
+}
+
+TEST_F(datastore_test, storage_statistics) { // NOLINT
+    if (system("rm -rf /tmp/datastore_test") != 0) {
+        std::cerr << "cannot remove directory" << std::endl;
+    }
+    if (system("mkdir -p /tmp/datastore_test/data_location /tmp/datastore_test/metadata_location") != 0) {
+        std::cerr << "cannot make directory" << std::endl;
+    }
+    boost::filesystem::path data_location_path{data_location};
+    boost::filesystem::path metadata_location_path{metadata_location};
+
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(data_location);
+    limestone::api::configuration conf(data_locations, metadata_location_path);
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    auto& channel = datastore_->create_channel(data_location_path);
+    datastore_->switch_epoch(1);
+    datastore_->ready();
+    EXPECT_TRUE(datastore_->storage_statistics().empty());  // no log files
+    channel.begin_session();
+    channel.add_entry(2, "k1", "v1", {1, 0});
+    channel.add_entry(2, "k2", "v2", {1, 0});
+    channel.add_entry(3, "key3", "value3", {1, 0});
+    channel.end_session();
+    datastore_->switch_epoch(2);
+    channel.begin_session();
+    channel.add_entry(2, "k1", "v1-2", {2, 0});  // supersedes k1 of epoch 1
+    channel.remove_entry(2, "k2", {2, 0});  // supersedes k2 of epoch 1
+    channel.remove_entry(4, "k4", {2, 0});  // storage with tombstone only
+    channel.end_session();
+    datastore_->switch_epoch(3);
+    datastore_->shutdown();
+
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    const auto& stats = datastore_->storage_statistics();
+    ASSERT_EQ(stats.size(), 3);
+    const auto& st2 = stats.at(2);
+    EXPECT_EQ(st2.entries(), 1);
+    EXPECT_EQ(st2.key_bytes(), 2);
+    EXPECT_EQ(st2.value_bytes(), 4);
+    EXPECT_EQ(st2.tombstones(), 1);
+    EXPECT_EQ(st2.superseded_versions(), 2);
+    const auto& st3 = stats.at(3);
+    EXPECT_EQ(st3.entries(), 1);
+    EXPECT_EQ(st3.key_bytes(), 4);
+    EXPECT_EQ(st3.value_bytes(), 6);
+    EXPECT_EQ(st3.tombstones(), 0);
+    EXPECT_EQ(st3.superseded_versions(), 0);
+    const auto& st4 = stats.at(4);
+    EXPECT_EQ(st4.entries(), 0);
+    EXPECT_EQ(st4.tombstones(), 1);
+    datastore_->shutdown();
+}
+
 }  // namespace limestone::testing
@@ -1,5 +1,6 @@
 
 #include <algorithm>
+#include <mutex>
 #include <sstream>
 #include <limestone/logging.h>
 
@@ -8,6 +9,7 @@
 #include "dblog_scan.h"
 #include "internal.h"
 #include "log_entry.h"
+#include "task_pool.h"
 
 #include "test_root.h"
 
@@ -402,7 +404,309 @@ TEST_F(dblog_scan_test, scan_one_pwal_file_repairc_truncated_invalidated_epoch_h
     });
 }
 
+// unit-test scan_one_pwal_file
+// inspect the file having the entry with checksum damaged in the value
+TEST_F(dblog_scan_test, scan_one_pwal_file_inspect_checksum_mismatch) {
+    auto p = boost::filesystem::path(location) / "entries";
+    FILE* f = fopen(p.c_str(), "w");
+    log_entry::begin_session(f, 0xff);
+    log_entry::write(f, 1, "k1", "v1", {0xff, 1}, true);
+    log_entry::write(f, 1, "k2", "v2", {0xff, 2}, true);
+    fclose(f);
+    std::string data = read_entire_file(p);
+    std::size_t entry_size = 17 + 2 + 16 + 2 + 4;
+    data.at(9 + entry_size + 17 + 2 + 16) ^= 0x01;  // "v2" -> "w2"
+    scan_one_pwal_file_inspect(data,
+                               [](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0xff);
+        ASSERT_EQ(errors.size(), 1);
+        EXPECT_EQ(errors[0].value(), log_entry::read_error::checksum_mismatch);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::broken_after);
+        EXPECT_EQ(pe.fpos(), 0);
+    });
+}
+
+// make the file of a durable epoch snippet and a nondurable one whose body is broken (zero-filled),
+// both of them have the sized epoch snippet header
+static std::string make_data_sized_nondurable_zerofill() {
+    auto p = boost::filesystem::path(dblog_scan_test::location) / "entries";
+    FILE* f = fopen(p.c_str(), "w");
+    log_entry::write(f, 1, "k1", "v1", {0xff, 1}, true);
+    fclose(f);
+    std::string entry = read_entire_file(p);
+    auto m1 = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, 0xff, entry.size(), 1);
+    auto m2 = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, 0x101, 100, 2);
+    std::string data{};
+    data.append(m1.data(), m1.size()).append(entry);
+    data.append(m2.data(), m2.size()).append(100, '\0');
+    return data;
+}
+
+// unit-test scan_one_pwal_file
+// inspect the file including nondurable epoch snippet with length; the body is skipped without reading
+TEST_F(dblog_scan_test, scan_one_pwal_file_inspect_sized_nondurable) {
+    std::string data = make_data_sized_nondurable_zerofill();
+    scan_one_pwal_file_inspect(data,
+                               [](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0x101);
+        EXPECT_EQ(errors.size(), 1);  // nondurable
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::nondurable_entries);
+    });
+}
+
+// unit-test scan_one_pwal_file
+// repair(mark) the file including nondurable epoch snippet with length; only the type of the header is changed
+TEST_F(dblog_scan_test, scan_one_pwal_file_repairm_sized_nondurable) {
+    std::string orig_data = make_data_sized_nondurable_zerofill();
+    std::size_t pos = orig_data.size() - 100 - log_entry::sized_marker_size;
+    scan_one_pwal_file_repairm(orig_data,
+                               [&orig_data, pos](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0x101);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::repaired);
+        auto data = read_entire_file(p);
+        ASSERT_EQ(orig_data.at(pos), '\x09');
+        EXPECT_EQ(data.at(pos), '\x0a');  // marked
+        EXPECT_EQ(data.substr(0, pos), orig_data.substr(0, pos));  // no change before mark
+        EXPECT_EQ(data.substr(pos + 1), orig_data.substr(pos + 1));  // length and checksum are kept
+    });
+    // the marked snippet is skipped as well
+    auto p = boost::filesystem::path(location) / "pwal_0000";
+    std::string repaired = read_entire_file(p);
+    boost::filesystem::remove(p);
+    scan_one_pwal_file_inspect(repaired,
+                               [](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0x101);
+        EXPECT_EQ(errors.size(), 0);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::ok);
+    });
+}
+
+// unit-test scan_one_pwal_file
+// repair(mark) the file having several nondurable epoch snippets; all of them are marked
+TEST_F(dblog_scan_test, scan_one_pwal_file_repairm_multiple_nondurable) {
+    auto p = boost::filesystem::path(location) / "entries";
+    FILE* f = fopen(p.c_str(), "w");
+    std::vector<long> heads{};
+    for (epoch_id_type epoch = 0x100; epoch <= 0x103; epoch++) {
+        heads.emplace_back(ftell(f));
+        log_entry::begin_session(f, epoch);
+        log_entry::write(f, 1, "k", "v", {epoch, 1});
+    }
+    fclose(f);
+    std::string orig_data = read_entire_file(p);
+    scan_one_pwal_file_repairm(orig_data,
+                               [&orig_data, &heads](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0x103);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::repaired);
+        auto data = read_entire_file(p);
+        EXPECT_EQ(data.at(heads[0]), '\x02');  // durable
+        for (std::size_t i = 1; i < heads.size(); i++) {
+            EXPECT_EQ(data.at(heads[i]), '\x06');  // marked
+            data.at(heads[i]) = orig_data.at(heads[i]);
+        }
+        EXPECT_EQ(data, orig_data);  // no change except the marks
+    });
+}
+
+// make the epoch snippet with the compressed entries
+static std::string make_data_compressed(epoch_id_type epoch) {
+    auto p = boost::filesystem::path(dblog_scan_test::location) / "entries";
+    FILE* f = fopen(p.c_str(), "w");
+    storage_id_type previous_storage_id = 0;
+    log_entry::write_packed(f, epoch, previous_storage_id, 1, "k1", "v1", {epoch, 1});
+    log_entry::write_packed(f, epoch, previous_storage_id, 1, "k2", "v2", {epoch, 2});
+    fclose(f);
+    std::string entries = read_entire_file(p);
+    f = fopen(p.c_str(), "w");
+    std::string block{};
+    log_entry::write_compressed_session(f, epoch, 2, entries, block);
+    fclose(f);
+    return read_entire_file(p);
+}
+
+// unit-test scan_one_pwal_file
+// inspect the file including compressed epoch snippets, durable and nondurable
+TEST_F(dblog_scan_test, scan_one_pwal_file_inspect_compressed) {
+    std::string data = make_data_compressed(0xff) + make_data_compressed(0x101);
+    auto p = boost::filesystem::path(location) / "pwal_0000";
+    create_file(p, data);
+    dblog_scan ds{boost::filesystem::path(location)};
+    ds.set_thread_num(1);
+    set_inspect_mode(ds);
+    dblog_scan::parse_error pe;
+    std::vector<std::string> keys;
+    std::vector<log_entry::read_error> errors;
+    epoch_id_type max_epoch = ds.scan_one_pwal_file(p, 0x100, [&keys](log_entry& e){
+        std::string key;
+        e.key(key);
+        keys.emplace_back(key);
+    }, [&errors](const log_entry::read_error& re){
+        errors.emplace_back(re);
+        return false;
+    }, pe);
+    EXPECT_EQ(max_epoch, 0x101);
+    EXPECT_EQ(keys, (std::vector<std::string>{"k1", "k2"}));  // of the durable snippet only
+    EXPECT_EQ(errors.size(), 1);  // nondurable
+    EXPECT_EQ(pe.value(), dblog_scan::parse_error::nondurable_entries);
+}
+
+// unit-test scan_one_pwal_file
+// repair(mark) the file including nondurable compressed epoch snippet; only the type of the header is changed
+TEST_F(dblog_scan_test, scan_one_pwal_file_repairm_compressed_nondurable) {
+    std::string first = make_data_compressed(0xff);
+    std::string orig_data = first + make_data_compressed(0x101);
+    std::size_t pos = first.size();
+    scan_one_pwal_file_repairm(orig_data,
+                               [&orig_data, pos](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0x101);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::repaired);
+        auto data = read_entire_file(p);
+        ASSERT_EQ(orig_data.at(pos), '\x0d');
+        EXPECT_EQ(data.at(pos), '\x0e');  // marked
+        EXPECT_EQ(data.substr(0, pos), orig_data.substr(0, pos));
+        EXPECT_EQ(data.substr(pos + 1), orig_data.substr(pos + 1));
+    });
+}
+
+// unit-test scan_one_pwal_file
+// inspect the file having the compressed block damaged
+TEST_F(dblog_scan_test, scan_one_pwal_file_inspect_compressed_block_damaged) {
+    std::string data = make_data_compressed(0xff);
+    data.back() ^= 0x01;
+    scan_one_pwal_file_inspect(data,
+                               [](const boost::filesystem::path& p, epoch_id_type max_epoch, const std::vector<log_entry::read_error>& errors, const dblog_scan::parse_error& pe) {
+        EXPECT_EQ(max_epoch, 0xff);
+        ASSERT_EQ(errors.size(), 1);
+        EXPECT_EQ(errors[0].value(), log_entry::read_error::checksum_mismatch);
+        EXPECT_EQ(pe.value(), dblog_scan::parse_error::broken_after);
+        EXPECT_EQ(pe.fpos(), 0);
+    });
+}
+
+// make the epoch snippets with the lengths, of the epochs from first, one entry in each
+static std::string make_data_sized(epoch_id_type first, int snippets) {
+    std::string data{};
+    for (epoch_id_type epoch = first; epoch < first + snippets; epoch++) {
+        auto p = boost::filesystem::path(dblog_scan_test::location) / "entries";
+        FILE* f = fopen(p.c_str(), "w");
+        log_entry::write(f, 1, "k" + std::to_string(epoch), "v", {epoch, 1}, true);
+        fclose(f);
+        std::string entry = read_entire_file(p);
+        auto m = log_entry::make_sized_marker(log_entry::entry_type::marker_begin_sized, epoch, entry.size(), 1);
+        data.append(m.data(), m.size()).append(entry);
+    }
+    return data;
+}
+
+// unit-test split_pwal_file; the file is divided at the epoch snippet headers
+TEST_F(dblog_scan_test, split_pwal_file_at_sized_headers) {
+    std::string data = make_data_sized(0x100, 10);
+    std::size_t snippet_size = data.size() / 10;
+    dblog_scan ds{boost::filesystem::path(location)};
+    ds.set_split_size(3 * snippet_size);
+    auto ranges = ds.split_pwal_file(data.data(), data.size());
+    using range = std::pair<std::streamoff, std::streamoff>;
+    auto s = static_cast<std::streamoff>(snippet_size);
+    EXPECT_EQ(ranges, (std::vector<range>{{0, 3 * s}, {3 * s, 6 * s}, {6 * s, 9 * s}, {9 * s, 10 * s}}));
+
+    ds.set_split_size(0);  // not to divide
+    EXPECT_EQ(ds.split_pwal_file(data.data(), data.size()), (std::vector<range>{{0, 10 * s}}));
+    ds.set_split_size(data.size());  // not larger than the split size
+    EXPECT_EQ(ds.split_pwal_file(data.data(), data.size()), (std::vector<range>{{0, 10 * s}}));
+}
+
+// unit-test split_pwal_file; the file is not divided after the epoch snippet without the length
+TEST_F(dblog_scan_test, split_pwal_file_stops_at_unsized_header) {
+    std::string data = make_data_sized(0x100, 4);
+    std::size_t snippet_size = data.size() / 4;
+    auto p = boost::filesystem::path(location) / "entries";
+    FILE* f = fopen(p.c_str(), "w");
+    log_entry::begin_session(f, 0x104);  // the length is not written yet
+    log_entry::write(f, 1, "k", "v", {0x104, 1}, true);
+    fclose(f);
+    data += read_entire_file(p) + make_data_sized(0x105, 4);
+    dblog_scan ds{boost::filesystem::path(location)};
+    ds.set_split_size(snippet_size);
+    auto ranges = ds.split_pwal_file(data.data(), data.size());
+    using range = std::pair<std::streamoff, std::streamoff>;
+    auto s = static_cast<std::streamoff>(snippet_size);
+    EXPECT_EQ(ranges, (std::vector<range>{{0, s}, {s, 2 * s}, {2 * s, 3 * s}, {3 * s, 4 * s},
+                                          {4 * s, static_cast<std::streamoff>(data.size())}}));
+}
+
+// scan_pwal_files_throws scans the parts of the large pwal file in parallel, with the same result as scanning the whole file
+TEST_F(dblog_scan_test, scan_pwal_files_throws_divided) {
+    std::string data = make_data_sized(0x100, 40);
+    create_file(boost::filesystem::path(location) / "pwal_0000", data);
+    create_file(boost::filesystem::path(location) / "pwal_0001", make_data_sized(0x200, 3));
+    auto scan = [](dblog_scan& ds, std::vector<std::string>& keys) {
+        std::mutex mtx{};
+        auto max_epoch = ds.scan_pwal_files_throws(0x202, [&](log_entry& e) {
+            std::string key;
+            e.key(key);
+            std::lock_guard<std::mutex> lock{mtx};
+            keys.emplace_back(key);
+        });
+        std::sort(keys.begin(), keys.end());
+        return max_epoch;
+    };
+    std::vector<std::string> whole_keys{};
+    dblog_scan whole{boost::filesystem::path(location)};
+    whole.set_thread_num(1);
+    EXPECT_EQ(scan(whole, whole_keys), 0x202);
+    EXPECT_EQ(whole_keys.size(), 43);
+
+    task_pool pool{4};
+    std::vector<std::string> divided_keys{};
+    dblog_scan divided{boost::filesystem::path(location)};
+    divided.set_thread_num(4);
+    divided.set_task_pool(&pool);
+    divided.set_split_size(data.size() / 8);
+    ASSERT_EQ(divided.split_pwal_file(data.data(), data.size()).size(), 8);
+    EXPECT_EQ(scan(divided, divided_keys), 0x202);
+    EXPECT_EQ(divided_keys, whole_keys);
+    EXPECT_EQ(read_entire_file(boost::filesystem::path(location) / "pwal_0000"), data);  // no change
+}
+
+// scan_pwal_files_throws throws at the damaged entry in any part of the file
+TEST_F(dblog_scan_test, scan_pwal_files_throws_divided_damaged) {
+    std::string data = make_data_sized(0x100, 40);
+    data.at(data.size() / 2 + 1) ^= 0x01;  // somewhere in a middle part
+    create_file(boost::filesystem::path(location) / "pwal_0000", data);
+    task_pool pool{4};
+    dblog_scan ds{boost::filesystem::path(location)};
+    ds.set_thread_num(4);
+    ds.set_task_pool(&pool);
+    ds.set_split_size(data.size() / 8);
+    EXPECT_THROW(ds.scan_pwal_files_throws(0x300, [](log_entry&) {}), std::runtime_error);
+}
+
 // unit-test detach_wal_files; normal non-detached pwal files are renamed (rotated)
+// the files are taken from each directory in turn, larger first in each directory
+TEST_F(dblog_scan_test, files_in_dirs_larger_first) {
+    auto extra = boost::filesystem::path(location) / "extra";
+    boost::filesystem::create_directory(extra);
+    auto p0 = boost::filesystem::path(location) / "pwal_0000";
+    auto p1 = boost::filesystem::path(location) / "pwal_0001";
+    auto p2 = extra / "pwal_0002";
+    auto p3 = extra / "pwal_0003";
+    create_file(p0, "0"sv);
+    create_file(p1, "111"sv);
+    create_file(p2, "22"sv);
+    create_file(p3, "3333"sv);
+
+    dblog_scan ds{boost::filesystem::path(location)};
+    ds.set_extra_wal_dirs({extra});
+    auto files = ds.files_in_dirs(true);
+    // the directory "extra" itself is listed in the first directory, as the smallest
+    ASSERT_EQ(files.size(), 5);
+    EXPECT_EQ(files.at(0), p1);
+    EXPECT_EQ(files.at(1), p3);
+    EXPECT_EQ(files.at(2), p0);
+    EXPECT_EQ(files.at(3), p2);
+    EXPECT_EQ(files.at(4), extra);
+}
+
 TEST_F(dblog_scan_test, detach_wal_files_renamne_pwal_0000) {
     auto p0_attached = boost::filesystem::path(location) / "pwal_0000";
     create_file(p0_attached,
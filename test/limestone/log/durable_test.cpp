@@ -5,6 +5,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "dblog_scan.h"
 #include "internal.h"
 #include "log_entry.h"
 
@@ -342,4 +343,104 @@ TEST_F(durable_test, ut_last_durable_epoch_broken_entry_type1) {
     }, std::exception);
 }
 
+TEST_F(durable_test, ut_last_durable_epoch_from_tail) {
+    using namespace limestone::api;
+
+    boost::filesystem::path epoch_file(location);
+    epoch_file /= "epoch";
+    {  // make pwal file for test
+        FILE *f = fopen(epoch_file.c_str(), "w");
+        fclose(f);
+    }
+    EXPECT_FALSE(limestone::internal::last_durable_epoch_from_tail(epoch_file).has_value());
+    {
+        FILE *f = fopen(epoch_file.c_str(), "w");
+        log_entry::durable_epoch(f, 1);
+        log_entry::durable_epoch(f, 0x0102030405060708ULL);
+        fclose(f);
+    }
+    EXPECT_EQ(limestone::internal::last_durable_epoch_from_tail(epoch_file), 0x0102030405060708ULL);
+}
+
+TEST_F(durable_test, ut_last_durable_epoch_from_tail_broken) {
+    using namespace limestone::api;
+
+    boost::filesystem::path epoch_file(location);
+    epoch_file /= "epoch";
+    {  // make pwal file for test
+        FILE *f = fopen(epoch_file.c_str(), "w");
+        log_entry::durable_epoch(f, 1);
+        // make broken entry, of the same size as durable marker
+        fputc(static_cast<int>(log_entry::entry_type::this_id_is_not_used), f);
+        for (int i = 0; i < 8; i++) {
+            fputc(0, f);
+        }
+        fclose(f);
+    }
+
+    // falls back to read whole the file
+    EXPECT_THROW({
+        limestone::internal::last_durable_epoch_from_tail(epoch_file);
+    }, std::exception);
+}
+
+TEST_F(durable_test, ut_durable_epoch_of_rotated_epoch_file) {
+    using limestone::internal::durable_epoch_of_rotated_epoch_file;
+
+    EXPECT_EQ(durable_epoch_of_rotated_epoch_file("epoch.00001700000000000.43.42"), 42);
+    EXPECT_FALSE(durable_epoch_of_rotated_epoch_file("epoch.00001700000000000.43").has_value());  // made by the older version, or empty
+    EXPECT_FALSE(durable_epoch_of_rotated_epoch_file("epoch.00001700000000000.43.").has_value());
+    EXPECT_FALSE(durable_epoch_of_rotated_epoch_file("epoch.00001700000000000.43.4x").has_value());
+    EXPECT_FALSE(durable_epoch_of_rotated_epoch_file("epoch").has_value());
+    EXPECT_FALSE(durable_epoch_of_rotated_epoch_file("pwal_0000.0.1.2").has_value());
+}
+
+TEST_F(durable_test, epoch_file_is_compacted) {
+    using namespace limestone::api;
+
+    boost::filesystem::path epoch_file(location);
+    epoch_file /= "epoch";
+    boost::filesystem::path tmp_file(location);
+    tmp_file /= "epoch.tmp";
+    {  // leftover of the crash while compacting
+        FILE *f = fopen(tmp_file.c_str(), "w");
+        log_entry::durable_epoch(f, 1);
+        fclose(f);
+    }
+    regen_datastore();
+    EXPECT_FALSE(boost::filesystem::exists(tmp_file));
+
+    datastore_->ready();
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    for (epoch_id_type e = 1; e <= 2000; e++) {
+        datastore_->switch_epoch(e);
+        channel.begin_session();
+        channel.end_session();
+    }
+
+    // 2000 durable markers are written, but only a part of them remains
+    EXPECT_LT(boost::filesystem::file_size(epoch_file), 9 * 1024);
+    EXPECT_FALSE(boost::filesystem::exists(tmp_file));
+    EXPECT_EQ(limestone::internal::last_durable_epoch(epoch_file), datastore_->epoch_id_recorded());
+    EXPECT_GE(datastore_->epoch_id_recorded(), 1999);
+    datastore_->shutdown();
+}
+
+TEST_F(durable_test, epoch_tmp_file_is_not_rotated_one) {
+    using namespace limestone::api;
+
+    boost::filesystem::path dir(location);
+    FILE *f = fopen((dir / "epoch").c_str(), "w");  // main epoch file is empty
+    fclose(f);
+    f = fopen((dir / "epoch.00001700000000000.43.42").c_str(), "w");
+    log_entry::durable_epoch(f, 42);
+    fclose(f);
+    f = fopen((dir / "epoch.tmp").c_str(), "w");  // leftover of the crash while compacting
+    log_entry::durable_epoch(f, 99);
+    fclose(f);
+
+    limestone::internal::dblog_scan ds{dir};
+    EXPECT_EQ(ds.last_durable_epoch_in_dir(), 42);
+}
+
 }  // namespace limestone::testing
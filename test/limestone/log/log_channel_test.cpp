@@ -13,8 +13,14 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <csignal>
+#include <random>
+#include <sys/resource.h>
 #include <unistd.h>
+#include <boost/filesystem/fstream.hpp>
 #include "internal.h"
+#include "log_entry.h"
+#include "numa.h"
 #include "test_root.h"
 
 #define LOGFORMAT_V1
@@ -57,6 +63,25 @@ TEST_F(log_channel_test, name) {
     EXPECT_EQ(channel.file_path().string(), std::string(location) + "/pwal_0000");
 }
 
+TEST_F(log_channel_test, numa_node) {
+    limestone::api::log_channel& channel1 = datastore_->create_channel(boost::filesystem::path(location), 0);
+    limestone::api::log_channel& channel2 = datastore_->create_channel(boost::filesystem::path(location), -1);
+    limestone::api::log_channel& channel3 = datastore_->create_channel(boost::filesystem::path(location));  // inferred
+    EXPECT_EQ(channel1.numa_node(), 0);
+    EXPECT_EQ(channel2.numa_node(), -1);
+    EXPECT_GE(channel3.numa_node(), -1);
+    EXPECT_LT(channel3.numa_node(), limestone::internal::numa_node_count());
+
+    datastore_->ready();
+    datastore_->switch_epoch(1);
+    for (auto* channel : {&channel1, &channel2, &channel3}) {
+        channel->begin_session();
+        channel->add_entry(2, "k", std::string(200000, 'v'), {1, 0});  // larger than the write buffer
+        channel->end_session();
+        EXPECT_GT(boost::filesystem::file_size(channel->file_path()), 200000);
+    }
+}
+
 TEST_F(log_channel_test, number_and_backup) {
     limestone::api::log_channel& channel1 = datastore_->create_channel(boost::filesystem::path(location));
     limestone::api::log_channel& channel2 = datastore_->create_channel(boost::filesystem::path(location));
@@ -128,4 +153,170 @@ TEST_F(log_channel_test, remove) {
     EXPECT_EQ(m["k3"], "v3");
 }
 
+TEST_F(log_channel_test, snippet_header_has_length) {
+    datastore_ = nullptr;
+    boost::filesystem::remove_all(location);  // made by SetUp, of the default version
+    boost::filesystem::create_directory(location);
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(location);
+    limestone::api::configuration conf(data_locations, boost::filesystem::path(location));
+    conf.set_persistent_format_version(limestone::internal::sized_snippet_persistent_format_version);
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+
+    limestone::api::log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.add_entry(42, "k2", std::string(200000, 'x'), {42, 4});  // larger than the write buffer
+    channel.remove_entry(42, "k3", {42, 4});
+    channel.end_session();
+    auto first_size = boost::filesystem::file_size(channel.file_path());
+    datastore_->switch_epoch(43);
+    channel.begin_session();
+    channel.add_entry(42, "k4", "v4", {43, 4});
+    channel.end_session();
+    auto file_size = boost::filesystem::file_size(channel.file_path());
+
+    boost::filesystem::ifstream istrm(channel.file_path(), std::ios_base::in | std::ios_base::binary);
+    limestone::api::log_entry e;
+    ASSERT_TRUE(e.read(istrm));
+    EXPECT_EQ(e.type(), limestone::api::log_entry::entry_type::marker_begin);
+    EXPECT_EQ(e.epoch_id(), 42);
+    EXPECT_EQ(e.snippet_entries(), 3);
+    EXPECT_EQ(e.snippet_length(), first_size - limestone::api::log_entry::sized_marker_size);
+
+    // the next snippet starts right after the length
+    istrm.seekg(static_cast<std::streamoff>(first_size));
+    ASSERT_TRUE(e.read(istrm));
+    EXPECT_EQ(e.type(), limestone::api::log_entry::entry_type::marker_begin);
+    EXPECT_EQ(e.epoch_id(), 43);
+    EXPECT_EQ(e.snippet_entries(), 1);
+    EXPECT_EQ(e.snippet_length(), file_size - first_size - limestone::api::log_entry::sized_marker_size);
+}
+
+TEST_F(log_channel_test, compressed_snippet) {
+    datastore_ = nullptr;
+    boost::filesystem::remove_all(location);  // made by SetUp, of the default version
+    boost::filesystem::create_directory(location);
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(location);
+    limestone::api::configuration conf(data_locations, boost::filesystem::path(location));
+    conf.set_pwal_compression(true);
+    conf.set_persistent_format_version(limestone::internal::compressed_snippet_persistent_format_version);
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+
+    limestone::api::log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    for (int i = 0; i < 100; i++) {
+        channel.add_entry(42, "k" + std::to_string(i), std::string(1000, 'v'), {42, 4});  // repetitive
+    }
+    channel.remove_entry(42, "k3", {42, 5});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+    channel.begin_session();
+    channel.add_entry(43, "k", "v", {43, 4});
+    channel.end_session();
+    datastore_->switch_epoch(44);
+    EXPECT_LT(boost::filesystem::file_size(channel.file_path()), 10000);
+
+    boost::filesystem::ifstream istrm(channel.file_path(), std::ios_base::in | std::ios_base::binary);
+    limestone::api::log_entry e;
+    ASSERT_TRUE(e.read(istrm));
+    EXPECT_EQ(e.type(), limestone::api::log_entry::entry_type::marker_begin);
+    EXPECT_EQ(e.epoch_id(), 42);
+    EXPECT_EQ(e.snippet_entries(), 101);
+    int entries = 0;
+    while (e.read(istrm) && e.type() != limestone::api::log_entry::entry_type::marker_begin) {
+        entries++;
+    }
+    EXPECT_EQ(entries, 101);
+    EXPECT_EQ(e.epoch_id(), 43);
+    EXPECT_TRUE(e.read(istrm));
+    EXPECT_EQ(e.storage(), 43);
+    EXPECT_FALSE(e.read(istrm));
+    istrm.close();
+
+    // recover from the compressed epoch snippets
+    datastore_ = nullptr;
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    auto ss = datastore_->get_snapshot();
+    auto cursor = ss->get_cursor();
+    std::map<std::string, std::string> m;
+    while (cursor->next()) {
+        std::string key;
+        std::string value;
+        cursor->key(key);
+        cursor->value(value);
+        m[key] = value;
+    }
+    EXPECT_EQ(m.size(), 100);
+    EXPECT_EQ(m.count("k3"), 0);
+    EXPECT_EQ(m["k99"], std::string(1000, 'v'));
+    EXPECT_EQ(m["k"], "v");
+}
+
+TEST_F(log_channel_test, compressed_snippet_after_failed_session) {
+    datastore_ = nullptr;
+    boost::filesystem::remove_all(location);  // made by SetUp, of the default version
+    boost::filesystem::create_directory(location);
+    std::vector<boost::filesystem::path> data_locations{};
+    data_locations.emplace_back(location);
+    limestone::api::configuration conf(data_locations, boost::filesystem::path(location));
+    conf.set_pwal_compression(true);
+    conf.set_persistent_format_version(limestone::internal::compressed_snippet_persistent_format_version);
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+
+    limestone::api::log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+
+    std::mt19937 rng{42};
+    std::string incompressible(300000, '\0');
+    for (auto& c : incompressible) {
+        c = static_cast<char>(rng());
+    }
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", incompressible, {42, 4});
+    {  // the compressed block, larger than the write buffer, cannot be written
+        struct rlimit orig{};
+        ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &orig), 0);
+        struct rlimit limit = orig;
+        limit.rlim_cur = 0;
+        auto* orig_handler = signal(SIGXFSZ, SIG_IGN);
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+        EXPECT_THROW(channel.end_session(), std::runtime_error);
+        setrlimit(RLIMIT_FSIZE, &orig);
+        signal(SIGXFSZ, orig_handler);
+    }
+    EXPECT_EQ(boost::filesystem::file_size(channel.file_path()), 0);
+
+    datastore_->switch_epoch(43);
+    channel.begin_session();
+    channel.add_entry(42, "k2", "v2", {43, 4});
+    channel.end_session();
+    datastore_->switch_epoch(44);
+
+    // only the entries of the succeeded session are recovered
+    datastore_ = nullptr;
+    datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
+    datastore_->ready();
+    auto ss = datastore_->get_snapshot();
+    auto cursor = ss->get_cursor();
+    std::map<std::string, std::string> m;
+    while (cursor->next()) {
+        std::string key;
+        std::string value;
+        cursor->key(key);
+        cursor->value(value);
+        m[key] = value;
+    }
+    EXPECT_EQ(m.size(), 1);
+    EXPECT_EQ(m.count("k1"), 0);
+    EXPECT_EQ(m["k2"], "v2");
+}
+
 }  // namespace limestone::testing
@@ -1,4 +1,5 @@
 
+#include <optional>
 #include <boost/filesystem.hpp>
 
 #include <limestone/logging.h>
@@ -18,6 +19,7 @@ extern void create_file(const boost::filesystem::path& path, std::string_view co
 extern const std::string_view epoch_0_str;
 extern const std::string_view epoch_0x100_str;
 extern std::string data_manifest(int persistent_format_version = 1);
+extern std::string read_entire_file(const boost::filesystem::path& path);
 extern const std::string_view data_normal;
 extern const std::string_view data_nondurable;
 
@@ -33,11 +35,14 @@ const boost::filesystem::path manifest_path = boost::filesystem::path(location)
         }
     }
 
-    void gen_datastore() {
+    void gen_datastore(std::optional<int> persistent_format_version = std::nullopt) {
         std::vector<boost::filesystem::path> data_locations{};
         data_locations.emplace_back(location);
         boost::filesystem::path metadata_location{location};
         limestone::api::configuration conf(data_locations, metadata_location);
+        if (persistent_format_version.has_value()) {
+            conf.set_persistent_format_version(persistent_format_version.value());
+        }
 
         datastore_ = std::make_unique<limestone::api::datastore_test>(conf);
     }
@@ -111,6 +116,35 @@ TEST_F(log_dir_test, accept_directory_only_correct_manifest_file) {
     limestone::internal::check_logdir_format(location);  // success
 }
 
+TEST_F(log_dir_test, newly_created_directory_is_version_1) {
+    gen_datastore();
+    EXPECT_EQ(limestone::internal::check_logdir_format(location), 1);
+}
+
+TEST_F(log_dir_test, newly_created_directory_is_configured_version) {
+    gen_datastore(limestone::internal::latest_persistent_format_version);
+    EXPECT_EQ(limestone::internal::check_logdir_format(location), limestone::internal::latest_persistent_format_version);
+}
+
+TEST_F(log_dir_test, existing_directory_keeps_version) {
+    create_mainfest_file(1);
+
+    gen_datastore(limestone::internal::latest_persistent_format_version);
+    EXPECT_EQ(limestone::internal::check_logdir_format(location), 1);
+}
+
+TEST_F(log_dir_test, reject_unsupported_version_for_new_directory) {
+    EXPECT_THROW(gen_datastore(limestone::internal::latest_persistent_format_version + 1), std::runtime_error);
+    EXPECT_THROW(gen_datastore(0), std::runtime_error);
+}
+
+TEST_F(log_dir_test, accept_directory_of_version_1) {
+    create_mainfest_file(1);
+
+    gen_datastore();
+    EXPECT_EQ(limestone::internal::check_logdir_format(location), 1);
+}
+
 TEST_F(log_dir_test, reject_directory_of_different_version) {
     create_mainfest_file(222);
 
@@ -132,6 +166,73 @@ TEST_F(log_dir_test, rotate_old_ok_v1_dir) {
     EXPECT_EQ(datastore_->restore(bk_path.string(), true), limestone::status::ok);
 }
 
+TEST_F(log_dir_test, restore_reports_progress) {
+    // setup backups
+    boost::filesystem::path bk_path = boost::filesystem::path(location) / "bk";
+    if (!boost::filesystem::create_directory(bk_path)) {
+        LOG(FATAL) << "cannot make directory";
+    }
+    create_file(bk_path / "epoch", epoch_0_str);
+    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(1));
+    std::string large(3 * 1024 * 1024 + 5, 'x');  // larger than the copy chunk
+    create_file(bk_path / "pwal_0000.1.1", large);
+
+    gen_datastore();
+
+    EXPECT_EQ(datastore_->restore(bk_path.string(), true), limestone::status::ok);
+    auto progress = datastore_->restore_status();
+    EXPECT_EQ(progress.kind(), limestone::api::restore_progress::status_kind::completed);
+    EXPECT_EQ(progress.result(), limestone::status::ok);
+    EXPECT_EQ(progress.source(), bk_path.string());
+    EXPECT_EQ(progress.bytes_total(), epoch_0_str.size() + data_manifest(1).size() + large.size());
+    EXPECT_EQ(progress.bytes_done(), progress.bytes_total());
+    EXPECT_FLOAT_EQ(progress.progress(), 1.0F);
+    EXPECT_EQ(read_entire_file(boost::filesystem::path(location) / "pwal_0000.1.1"), large);
+
+    // failure is reported
+    boost::filesystem::remove(bk_path / std::string(limestone::internal::manifest_file_name));
+    EXPECT_EQ(datastore_->restore(bk_path.string(), true), limestone::status::err_broken_data);
+    auto failed = datastore_->restore_status();
+    EXPECT_EQ(failed.kind(), limestone::api::restore_progress::status_kind::failed);
+    EXPECT_EQ(failed.result(), limestone::status::err_broken_data);
+}
+
+TEST_F(log_dir_test, restore_entries_reports_progress) {
+    // setup backups
+    boost::filesystem::path bk_path = boost::filesystem::path(location) / "bk";
+    if (!boost::filesystem::create_directory(bk_path)) {
+        LOG(FATAL) << "cannot make directory";
+    }
+    create_file(bk_path / "epoch", epoch_0_str);
+    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(1));
+    std::vector<limestone::api::file_set_entry> entries{};
+    entries.emplace_back("epoch", "epoch", false);
+    entries.emplace_back(std::string(limestone::internal::manifest_file_name), std::string(limestone::internal::manifest_file_name), false);
+
+    gen_datastore();
+
+    // progress is reset by each restore
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(datastore_->restore(bk_path.string(), entries), limestone::status::ok);
+        auto progress = datastore_->restore_status();
+        EXPECT_EQ(progress.kind(), limestone::api::restore_progress::status_kind::completed);
+        EXPECT_EQ(progress.source(), bk_path.string());
+        EXPECT_EQ(progress.bytes_total(), epoch_0_str.size() + data_manifest(1).size());
+        EXPECT_EQ(progress.bytes_done(), progress.bytes_total());
+    }
+
+    // failure before copying is reported
+    entries.emplace_back("pwal_0000.1.1", "pwal_0000.1.1", false);  // not found
+    EXPECT_EQ(datastore_->restore(bk_path.string(), entries), limestone::status::err_not_found);
+    auto failed = datastore_->restore_status();
+    EXPECT_EQ(failed.kind(), limestone::api::restore_progress::status_kind::failed);
+    EXPECT_EQ(failed.result(), limestone::status::err_not_found);
+    boost::filesystem::remove(bk_path / std::string(limestone::internal::manifest_file_name));
+    entries.pop_back();
+    EXPECT_EQ(datastore_->restore(bk_path.string(), entries), limestone::status::err_not_found);
+    EXPECT_EQ(datastore_->restore_status().kind(), limestone::api::restore_progress::status_kind::failed);
+}
+
 TEST_F(log_dir_test, rotate_old_rejects_unsupported_data) {
     // setup backups
     boost::filesystem::path bk_path = boost::filesystem::path(location) / "bk";
@@ -139,7 +240,7 @@ TEST_F(log_dir_test, rotate_old_rejects_unsupported_data) {
         LOG(FATAL) << "cannot make directory";
     }
     create_file(bk_path / "epoch", epoch_0_str);
-    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(2));
+    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(222));
 
     gen_datastore();
 
@@ -199,7 +300,7 @@ TEST_F(log_dir_test, rotate_prusik_rejects_unsupported_data) {
         LOG(FATAL) << "cannot make directory";
     }
     create_file(bk_path / "epoch", epoch_0_str);
-    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(2));
+    create_file(bk_path / std::string(limestone::internal::manifest_file_name), data_manifest(222));
     // setup entries
     std::vector<limestone::api::file_set_entry> entries;
     entries.emplace_back("epoch", "epoch", false);
@@ -13,6 +13,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <fstream>
+#include <sys/resource.h>
 #include <unistd.h>
 #include "test_root.h"
 
@@ -116,4 +118,226 @@ TEST_F(log_entry_test, write_and_read_and_write_and_read) {
     EXPECT_TRUE(buf_version == write_version);
 }
 
+TEST_F(log_entry_test, write_and_read_with_checksum) {
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    limestone::api::log_entry::write(ostrm, storage_id, key, value, write_version, true);
+    limestone::api::log_entry::write_remove(ostrm, storage_id, key, write_version, true);
+    fclose(ostrm);
+    EXPECT_EQ(boost::filesystem::file_size(file1_), (17 + key.size() + 16 + value.size() + 4) + (13 + key.size() + 16 + 4));
+
+    boost::filesystem::ifstream istrm;
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), limestone::api::log_entry::entry_type::normal_entry);
+    EXPECT_EQ(log_entry_.storage(), storage_id);
+    std::string buf_key;
+    log_entry_.key(buf_key);
+    EXPECT_EQ(buf_key, key);
+    std::string buf_value;
+    log_entry_.value(buf_value);
+    EXPECT_EQ(buf_value, value);
+
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), limestone::api::log_entry::entry_type::remove_entry);
+    limestone::api::write_version_type buf_version;
+    log_entry_.write_version(buf_version);
+    EXPECT_TRUE(buf_version == write_version);
+    EXPECT_FALSE(log_entry2_.read(istrm));
+    istrm.close();
+}
+
+TEST_F(log_entry_test, read_detects_checksum_mismatch) {
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    limestone::api::log_entry::write(ostrm, storage_id, key, value, write_version, true);
+    fclose(ostrm);
+    {
+        // flip a bit in the value
+        boost::filesystem::fstream strm(file1_, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        std::streamoff pos = 17 + key.size() + 16 + 3;
+        strm.seekg(pos);
+        char c = static_cast<char>(strm.get());
+        strm.seekp(pos);
+        strm.put(static_cast<char>(c ^ 0x01));
+    }
+
+    boost::filesystem::ifstream istrm;
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    limestone::api::log_entry::read_error ec{};
+    EXPECT_FALSE(log_entry_.read_entry_from(istrm, ec));
+    EXPECT_EQ(ec.value(), limestone::api::log_entry::read_error::checksum_mismatch);
+    istrm.close();
+
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    EXPECT_THROW(log_entry_.read(istrm), std::runtime_error);
+    istrm.close();
+}
+
+TEST_F(log_entry_test, write_and_read_packed) {
+    using limestone::api::log_entry;
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    limestone::api::storage_id_type previous_storage_id = 0;
+    log_entry::begin_session(ostrm, 67898);
+    log_entry::write_packed(ostrm, 67898, previous_storage_id, storage_id, key, value, write_version);
+    log_entry::write_remove_packed(ostrm, 67898, previous_storage_id, storage_id - 5, key, {67890, 1});  // older storage and epoch
+    log_entry::write_packed(ostrm, 67898, previous_storage_id, storage_id, "", "", {67900, 0});
+    fclose(ostrm);
+    EXPECT_EQ(previous_storage_id, storage_id);
+    // 1 + 1 + 1 + 3 (storage_id) + 1 (same epoch) + 3 (minor) header, instead of 17 + 16
+    EXPECT_EQ(boost::filesystem::file_size(file1_), 9 + (10 + key.size() + value.size() + 4) + (5 + key.size() + 4) + (6 + 4));
+
+    boost::filesystem::ifstream istrm;
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::marker_begin);
+
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::normal_entry);
+    EXPECT_EQ(log_entry_.storage(), storage_id);
+    std::string buf_key;
+    log_entry_.key(buf_key);
+    EXPECT_EQ(buf_key, key);
+    std::string buf_value;
+    log_entry_.value(buf_value);
+    EXPECT_EQ(buf_value, value);
+    limestone::api::write_version_type buf_version;
+    log_entry_.write_version(buf_version);
+    EXPECT_TRUE(buf_version == write_version);
+
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::remove_entry);
+    EXPECT_EQ(log_entry_.storage(), storage_id - 5);
+    log_entry_.write_version(buf_version);
+    EXPECT_TRUE(buf_version == limestone::api::write_version_type(67890, 1));
+
+    EXPECT_TRUE(log_entry_.read(istrm));
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::normal_entry);
+    EXPECT_EQ(log_entry_.storage(), storage_id);
+    log_entry_.key(buf_key);
+    EXPECT_EQ(buf_key, "");
+    log_entry_.value(buf_value);
+    EXPECT_EQ(buf_value, "");
+    log_entry_.write_version(buf_version);
+    EXPECT_TRUE(buf_version == limestone::api::write_version_type(67900, 0));
+    EXPECT_FALSE(log_entry_.read(istrm));
+    istrm.close();
+}
+
+TEST_F(log_entry_test, read_detects_packed_checksum_mismatch) {
+    using limestone::api::log_entry;
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    limestone::api::storage_id_type previous_storage_id = 0;
+    log_entry::begin_session(ostrm, 67898);
+    log_entry::write_packed(ostrm, 67898, previous_storage_id, storage_id, key, value, write_version);
+    fclose(ostrm);
+    {
+        // flip a bit in the storage_id, which changes the decoded entry without breaking its form
+        boost::filesystem::fstream strm(file1_, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        std::streamoff pos = 9 + 3;
+        strm.seekg(pos);
+        char c = static_cast<char>(strm.get());
+        strm.seekp(pos);
+        strm.put(static_cast<char>(c ^ 0x02));
+    }
+
+    boost::filesystem::ifstream istrm;
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    log_entry::read_error ec{};
+    EXPECT_TRUE(log_entry_.read_entry_from(istrm, ec));
+    EXPECT_FALSE(log_entry_.read_entry_from(istrm, ec));
+    EXPECT_EQ(ec.value(), log_entry::read_error::checksum_mismatch);
+    EXPECT_EQ(ec.entry_type(), log_entry::entry_type::normal_packed);
+    istrm.close();
+}
+
+TEST_F(log_entry_test, read_rejects_packed_entry_of_oversized_length) {
+    using limestone::api::log_entry;
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    log_entry::begin_session(ostrm, 67898);
+    fclose(ostrm);
+    {
+        // the lengths in the broken header are 4 GiB - 1, much longer than the file
+        boost::filesystem::ofstream strm(file1_, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+        strm.put(static_cast<char>(log_entry::entry_type::normal_packed));
+        strm.write("\xff\xff\xff\xff\x0f", 5);  // key_len
+        strm.write("\xff\xff\xff\xff\x0f", 5);  // value_len
+        strm.write("\x00\x00\x00", 3);  // storage_id, epoch and minor write version
+        strm.write("key and value", 13);
+    }
+    std::string data{};
+    {
+        boost::filesystem::ifstream istrm(file1_, std::ios_base::in | std::ios_base::binary);
+        data.assign(std::istreambuf_iterator<char>(istrm), std::istreambuf_iterator<char>());
+    }
+
+    // the lengths must not be allocated; limit the address space to 1 GiB more than now
+    struct rlimit orig{};
+    ASSERT_EQ(getrlimit(RLIMIT_AS, &orig), 0);
+    std::size_t pages{};
+    {
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages;
+    }
+    struct rlimit limit = orig;
+    limit.rlim_cur = pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) + (1UL << 30U);
+    ASSERT_EQ(setrlimit(RLIMIT_AS, &limit), 0);
+
+    boost::filesystem::ifstream istrm;
+    istrm.open(file1_, std::ios_base::in | std::ios_base::binary);
+    log_entry::read_error ec{};
+    EXPECT_TRUE(log_entry_.read_entry_from(istrm, ec));
+    EXPECT_NO_THROW(EXPECT_FALSE(log_entry_.read_entry_from(istrm, ec)));
+    EXPECT_EQ(ec.value(), log_entry::read_error::short_entry);
+    istrm.close();
+
+    log_entry::buffer_reader in{data.data(), data.size()};
+    EXPECT_TRUE(log_entry_.read_entry_from(in, ec));
+    EXPECT_NO_THROW(EXPECT_FALSE(log_entry_.read_entry_from(in, ec)));
+    EXPECT_EQ(ec.value(), log_entry::read_error::short_entry);
+    setrlimit(RLIMIT_AS, &orig);
+}
+
+TEST_F(log_entry_test, read_from_buffer) {
+    using limestone::api::log_entry;
+    FILE* ostrm = fopen(file1_.c_str(), "a");
+    limestone::api::storage_id_type previous_storage_id = 0;
+    log_entry::begin_session(ostrm, 67898);
+    log_entry::write(ostrm, storage_id, key, value, write_version, true);
+    log_entry::write_packed(ostrm, 67898, previous_storage_id, storage_id, key, value, write_version);
+    fclose(ostrm);
+    std::string data{};
+    {
+        boost::filesystem::ifstream istrm(file1_, std::ios_base::in | std::ios_base::binary);
+        data.assign(std::istreambuf_iterator<char>(istrm), std::istreambuf_iterator<char>());
+    }
+
+    log_entry::buffer_reader in{data.data(), data.size()};
+    log_entry::read_error ec{};
+    EXPECT_TRUE(log_entry_.read_entry_from(in, ec));
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::marker_begin);
+    EXPECT_EQ(log_entry_.epoch_id(), 67898);
+    EXPECT_EQ(in.tell(), 9);
+    std::streamoff last_pos{};
+    for (int i = 0; i < 2; i++) {
+        last_pos = in.tell();
+        EXPECT_TRUE(log_entry_.read_entry_from(in, ec));
+        EXPECT_EQ(log_entry_.type(), log_entry::entry_type::normal_entry);
+        EXPECT_EQ(log_entry_.storage(), storage_id);
+        std::string buf_key;
+        log_entry_.key(buf_key);
+        EXPECT_EQ(buf_key, key);
+        std::string buf_value;
+        log_entry_.value(buf_value);
+        EXPECT_EQ(buf_value, value);
+    }
+    EXPECT_FALSE(log_entry_.read_entry_from(in, ec));
+    EXPECT_FALSE(ec);
+
+    // the truncated entry is reported as the stream does
+    log_entry::buffer_reader truncated{data.data(), data.size() - 1};
+    truncated.seek(last_pos);
+    EXPECT_FALSE(log_entry_.read_entry_from(truncated, ec));
+    EXPECT_EQ(ec.value(), log_entry::read_error::short_entry);
+    EXPECT_EQ(log_entry_.type(), log_entry::entry_type::normal_entry);
+}
+
 }  // namespace limestone::testing
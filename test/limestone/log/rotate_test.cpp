@@ -1,10 +1,13 @@
 
+#include <algorithm>
+#include <set>
 #include <sstream>
 #include <limestone/logging.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include "crc32c.h"
 #include "internal.h"
 
 #include "test_root.h"
@@ -97,7 +100,7 @@ TEST_F(rotate_test, log_is_rotated) { // NOLINT
         int i = 0;
         EXPECT_TRUE(starts_with(v[i].destination_path().string(), "epoch"));  // relative
         EXPECT_TRUE(starts_with(v[i].source_path().string(), location));  // absolute
-        //EXPECT_EQ(v[i].is_detached(), false);
+        EXPECT_EQ(v[i].is_detached(), false);  // the last rotated epoch file
         EXPECT_EQ(v[i].is_mutable(), false);
         i++;
 #ifdef LOGFORMAT_V1
@@ -109,7 +112,7 @@ TEST_F(rotate_test, log_is_rotated) { // NOLINT
 #endif
         EXPECT_TRUE(starts_with(v[i].destination_path().string(), "pwal"));  // relative
         EXPECT_TRUE(starts_with(v[i].source_path().string(), location));  // absolute
-        EXPECT_EQ(v[i].is_detached(), false);
+        EXPECT_EQ(v[i].is_detached(), true);
         EXPECT_EQ(v[i].is_mutable(), false);
     }
 
@@ -198,7 +201,7 @@ TEST_F(rotate_test, inactive_files_are_also_backed_up) { // NOLINT
         int i = 0;
         EXPECT_TRUE(starts_with(v[i].destination_path().string(), "epoch."));  // relative
         EXPECT_TRUE(starts_with(v[i].source_path().string(), location));  // absolute
-        //EXPECT_EQ(v[i].is_detached(), false);
+        EXPECT_EQ(v[i].is_detached(), false);  // the last rotated epoch file
         EXPECT_EQ(v[i].is_mutable(), false);
         i++;
 #ifdef LOGFORMAT_V1
@@ -210,17 +213,290 @@ TEST_F(rotate_test, inactive_files_are_also_backed_up) { // NOLINT
 #endif
         EXPECT_TRUE(starts_with(v[i].destination_path().string(), "pwal_0000."));  // relative
         EXPECT_TRUE(starts_with(v[i].source_path().string(), location));  // absolute
-        EXPECT_EQ(v[i].is_detached(), false);
+        EXPECT_EQ(v[i].is_detached(), true);
         EXPECT_EQ(v[i].is_mutable(), false);
         i++;
         EXPECT_TRUE(starts_with(v[i].destination_path().string(), "pwal_0001."));  // relative
         EXPECT_TRUE(starts_with(v[i].source_path().string(), location));  // absolute
-        EXPECT_EQ(v[i].is_detached(), false);
+        EXPECT_EQ(v[i].is_detached(), true);
         EXPECT_EQ(v[i].is_mutable(), false);
     }
 
 }
 
+TEST_F(rotate_test, incremental_backup) { // NOLINT
+    using namespace limestone::api;
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+
+    // no previous backup, so all files are selected
+    std::unique_ptr<backup_detail> bd1 = datastore_->begin_backup(backup_type::transaction);
+    EXPECT_EQ(bd1->log_start(), 0);
+    EXPECT_EQ(bd1->log_finish(), 43);
+    std::uintmax_t total = 0;
+    std::set<std::string> names1;
+    for (auto& e : bd1->entries()) {
+        EXPECT_EQ(e.size(), boost::filesystem::file_size(e.source_path()));
+        total += e.size();
+        names1.emplace(e.destination_path().string());
+    }
+    EXPECT_EQ(bd1->total_size(), total);
+    EXPECT_EQ(std::count_if(names1.begin(), names1.end(), [this](auto& n){ return starts_with(n, "pwal_0000."); }), 1);
+    EXPECT_EQ(std::count_if(names1.begin(), names1.end(), [this](auto& n){ return starts_with(n, "epoch."); }), 1);
+    bd1->end_backup();
+
+    channel.begin_session();
+    channel.add_entry(42, "k2", "v2", {43, 4});
+    channel.end_session();
+    datastore_->switch_epoch(44);
+
+    // only the files made after the previous backup, and the mutable files
+    std::unique_ptr<backup_detail> bd2 = datastore_->begin_backup(backup_type::transaction);
+    EXPECT_EQ(bd2->log_start(), 44);
+    EXPECT_EQ(bd2->log_finish(), 44);
+    auto v(bd2->entries());
+    std::sort(v.begin(), v.end(), [](auto& a, auto& b){
+        return a.destination_path().string() < b.destination_path().string();
+    });
+    ASSERT_EQ(v.size(), 3);
+    int i = 0;
+    EXPECT_TRUE(starts_with(v[i].destination_path().string(), "epoch."));
+    EXPECT_EQ(names1.count(v[i].destination_path().string()), 0);
+    EXPECT_EQ(v[i].is_detached(), false);
+    i++;
+    EXPECT_EQ(v[i].destination_path().string(), limestone::internal::manifest_file_name);
+    EXPECT_EQ(v[i].is_mutable(), true);
+    i++;
+    EXPECT_TRUE(starts_with(v[i].destination_path().string(), "pwal_0000."));
+    EXPECT_EQ(names1.count(v[i].destination_path().string()), 0);
+    EXPECT_EQ(v[i].is_detached(), true);
+    EXPECT_EQ(v[i].size(), boost::filesystem::file_size(v[i].source_path()));
+
+    // standard backup selects all files
+    datastore_->switch_epoch(45);
+    std::unique_ptr<backup_detail> bd3 = datastore_->begin_backup(backup_type::standard);
+    EXPECT_EQ(bd3->log_start(), 0);
+    EXPECT_EQ(bd3->entries().size(), 6);  // 2 pwal, 3 epoch, manifest
+    datastore_->shutdown();
+}
+
+TEST_F(rotate_test, incremental_backup_after_incomplete_backup) { // NOLINT
+    using namespace limestone::api;
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+
+    // listed, but not completed (e.g. failed to copy the files)
+    std::unique_ptr<backup_detail> bd1 = datastore_->begin_backup(backup_type::transaction);
+    EXPECT_EQ(bd1->log_start(), 0);
+    EXPECT_FALSE(bd1->entries().empty());
+
+    channel.begin_session();
+    channel.add_entry(42, "k2", "v2", {43, 4});
+    channel.end_session();
+    datastore_->switch_epoch(44);
+
+    // the files listed by the incomplete backup are selected again
+    std::unique_ptr<backup_detail> bd2 = datastore_->begin_backup(backup_type::transaction);
+    EXPECT_EQ(bd2->log_start(), 0);
+    auto count_pwal = [this](const std::vector<backup_detail::entry>& entries) {
+        return std::count_if(entries.begin(), entries.end(), [this](auto& e){ return starts_with(e.destination_path().string(), "pwal_0000."); });
+    };
+    EXPECT_EQ(count_pwal(bd2->entries()), 2);
+    bd2->end_backup();
+    bd2->end_backup();  // no effect
+
+    datastore_->switch_epoch(45);
+    std::unique_ptr<backup_detail> bd3 = datastore_->begin_backup(backup_type::transaction);
+    EXPECT_EQ(bd3->log_start(), bd2->log_finish() + 1);
+    EXPECT_EQ(count_pwal(bd3->entries()), 0);
+    datastore_->shutdown();
+}
+
+TEST_F(rotate_test, staged_backup) { // NOLINT
+    using namespace limestone::api;
+    boost::filesystem::path staging_dir = std::string(location) + "_staging";
+    boost::filesystem::remove_all(staging_dir);
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+
+    std::unique_ptr<backup_detail> bd = datastore_->begin_backup(backup_type::standard, staging_dir);
+    auto v(bd->entries());
+    std::sort(v.begin(), v.end(), [](auto& a, auto& b){
+        return a.destination_path().string() < b.destination_path().string();
+    });
+    ASSERT_EQ(v.size(), 3);
+    for (auto& e : v) {
+        EXPECT_EQ(e.source_path(), staging_dir / e.destination_path());
+        EXPECT_EQ(e.size(), boost::filesystem::file_size(e.source_path()));
+        EXPECT_EQ(e.is_mutable(), false);
+    }
+    EXPECT_TRUE(starts_with(v[0].destination_path().string(), "epoch."));
+    EXPECT_EQ(boost::filesystem::hard_link_count(v[0].source_path()), 2);
+    EXPECT_EQ(v[1].destination_path().string(), limestone::internal::manifest_file_name);
+    EXPECT_EQ(boost::filesystem::hard_link_count(v[1].source_path()), 1);  // copied
+    EXPECT_TRUE(starts_with(v[2].destination_path().string(), "pwal_0000."));
+    EXPECT_EQ(boost::filesystem::hard_link_count(v[2].source_path()), 2);
+    EXPECT_EQ(v[2].is_detached(), true);
+
+    // the completed backup covers the original files
+    bd->end_backup();
+    std::unique_ptr<backup_detail> bd2 = datastore_->begin_backup(backup_type::transaction);
+    for (auto& e : bd2->entries()) {
+        EXPECT_FALSE(starts_with(e.destination_path().string(), "pwal_0000."));
+    }
+
+    // staged files survive the removal of the log files
+    datastore_->shutdown();
+    boost::filesystem::remove(boost::filesystem::path(location) / v[2].destination_path());
+    EXPECT_TRUE(boost::filesystem::exists(v[2].source_path()));
+    boost::filesystem::remove_all(staging_dir);
+}
+
+TEST_F(rotate_test, backup_waits_for_session) { // NOLINT
+    using namespace limestone::api;
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+
+    // rotated at the end of the session
+    std::unique_ptr<backup_detail> bd = datastore_->begin_backup(backup_type::standard);
+    EXPECT_FALSE(bd->is_ready());
+    EXPECT_FALSE(bd->wait_for_ready(10));
+    auto& old_backup = datastore_->begin_backup();
+    EXPECT_FALSE(old_backup.is_ready());
+    channel.add_entry(42, "k2", "v2", {42, 5});
+    channel.end_session();
+    EXPECT_TRUE(bd->is_ready());
+    EXPECT_TRUE(bd->wait_for_ready(0));
+    EXPECT_TRUE(old_backup.is_ready());
+
+    EXPECT_EQ(bd->log_finish(), 42);
+    auto v(bd->entries());
+    std::sort(v.begin(), v.end(), [](auto& a, auto& b){
+        return a.destination_path().string() < b.destination_path().string();
+    });
+    ASSERT_EQ(v.size(), 3);
+    EXPECT_TRUE(starts_with(v[0].destination_path().string(), "epoch."));
+    EXPECT_EQ(v[1].destination_path().string(), limestone::internal::manifest_file_name);
+    EXPECT_TRUE(starts_with(v[2].destination_path().string(), "pwal_0000."));
+    EXPECT_FALSE(boost::filesystem::exists(channel.file_path()));  // both entries are in the rotated file
+
+    // the rotated files are listed by the old backup
+    auto files = old_backup.files();
+    EXPECT_EQ(std::count_if(files.begin(), files.end(), [this](auto& f){ return starts_with(f.filename().string(), "pwal_0000."); }), 1);
+
+    // not in session, ready immediately
+    channel.begin_session();
+    channel.add_entry(42, "k3", "v3", {43, 4});
+    channel.end_session();
+    datastore_->switch_epoch(44);
+    std::unique_ptr<backup_detail> bd2 = datastore_->begin_backup(backup_type::standard);
+    EXPECT_TRUE(bd2->is_ready());
+    EXPECT_TRUE(datastore_->begin_backup().is_ready());
+}
+
+TEST_F(rotate_test, backup_requested_just_after_begin_session) { // NOLINT
+    using namespace limestone::api;
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+
+    // the file opened by the session is not rotated until the end of the session
+    channel.begin_session();
+    std::unique_ptr<backup_detail> bd = datastore_->begin_backup(backup_type::standard);
+    EXPECT_FALSE(bd->is_ready());
+    EXPECT_TRUE(boost::filesystem::exists(channel.file_path()));
+    channel.add_entry(42, "k2", "v2", {43, 4});
+    channel.end_session();
+    EXPECT_TRUE(bd->is_ready());
+    EXPECT_FALSE(boost::filesystem::exists(channel.file_path()));  // all entries are in the rotated file
+
+    // the checksum covers the entries of the session
+    int pwal_files = 0;
+    for (auto& e : bd->entries()) {
+        if (starts_with(e.destination_path().string(), "pwal_0000.")) {
+            pwal_files++;
+            ASSERT_TRUE(e.crc32c().has_value());
+            EXPECT_EQ(e.crc32c().value(), limestone::internal::crc32c_of_file(e.source_path()));
+        }
+    }
+    EXPECT_EQ(pwal_files, 1);
+}
+
+TEST_F(rotate_test, backup_checksums) { // NOLINT
+    using namespace limestone::api;
+    boost::filesystem::path backup_dir = std::string(location) + "_bk";
+    boost::filesystem::remove_all(backup_dir);
+    boost::filesystem::create_directories(backup_dir);
+
+    log_channel& channel = datastore_->create_channel(boost::filesystem::path(location));
+    datastore_->ready();
+    datastore_->switch_epoch(42);
+    channel.begin_session();
+    channel.add_entry(42, "k1", "v1", {42, 4});
+    channel.end_session();
+    datastore_->switch_epoch(43);
+    channel.begin_session();
+    channel.add_entry(42, "k2", std::string(200000, 'x'), {43, 4});  // larger than the stream buffer
+    channel.end_session();
+    datastore_->switch_epoch(44);
+
+    std::unique_ptr<backup_detail> bd = datastore_->begin_backup(backup_type::standard);
+    auto v(bd->entries());
+    ASSERT_EQ(v.size(), 3);
+    std::vector<file_set_entry> data{};
+    for (auto& e : v) {
+        if (e.is_mutable()) {
+            EXPECT_FALSE(e.crc32c().has_value());
+        } else {
+            // computed while written, equals to the checksum of the file
+            ASSERT_TRUE(e.crc32c().has_value()) << e.destination_path();
+            EXPECT_EQ(e.crc32c().value(), limestone::internal::crc32c_of_file(e.source_path())) << e.destination_path();
+        }
+        boost::filesystem::copy_file(e.source_path(), backup_dir / e.destination_path());
+        data.emplace_back(backup_dir / e.destination_path(), e.destination_path(), e.is_detached(), e.crc32c());
+    }
+    datastore_->shutdown();
+
+    EXPECT_EQ(datastore_->restore(location, data), status::ok);
+
+    // broken copy is detected
+    for (auto& e : data) {
+        if (e.crc32c()) {
+            create_file(e.source_path(), "broken");
+            break;
+        }
+    }
+    EXPECT_EQ(datastore_->restore(location, data), status::err_broken_data);
+    boost::filesystem::remove_all(backup_dir);
+}
+
 // why in this file??
 TEST_F(rotate_test, restore_prusik_all_abs) { // NOLINT
     using namespace limestone::api;
@@ -0,0 +1,82 @@
+#include <random>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "crc32c.h"
+
+#include "test_root.h"
+
+namespace limestone::testing {
+
+using namespace limestone::internal;
+
+class crc32c_test : public ::testing::Test {
+};
+
+TEST_F(crc32c_test, known_values) { // NOLINT
+    // from RFC 3720, B.4
+    EXPECT_EQ(crc32c("123456789", 9), 0xE3069283U);
+    EXPECT_EQ(crc32c(std::string(32, '\0').data(), 32), 0x8A9136AAU);
+    EXPECT_EQ(crc32c(std::string(32, '\xff').data(), 32), 0x62A8AB43U);
+    EXPECT_EQ(crc32c("", 0), 0U);
+}
+
+TEST_F(crc32c_test, same_as_portable) { // NOLINT
+    std::mt19937 rng(1);
+    std::string data(10000, '\0');
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    for (std::size_t len : {0, 1, 7, 8, 9, 63, 64, 383, 384, 385, 775, 1000, 10000}) {
+        EXPECT_EQ(crc32c_extend(0, data.data(), len), crc32c_extend_portable(0, data.data(), len)) << len;
+        // not aligned, and extending a non-zero checksum
+        EXPECT_EQ(crc32c_extend(0x12345678U, data.data() + 3, len), crc32c_extend_portable(0x12345678U, data.data() + 3, len)) << len;
+    }
+}
+
+TEST_F(crc32c_test, extend) { // NOLINT
+    std::string data = "the quick brown fox jumps over the lazy dog";
+    std::uint32_t whole = crc32c(data.data(), data.size());
+    for (std::size_t i = 0; i <= data.size(); i++) {
+        std::uint32_t c = crc32c_extend(0, data.data(), i);
+        EXPECT_EQ(crc32c_extend(c, data.data() + i, data.size() - i), whole) << i;
+    }
+}
+
+TEST_F(crc32c_test, overwrite) { // NOLINT
+    std::mt19937 rng(2);
+    std::string data(5000, '\0');
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    std::uint32_t crc = crc32c(data.data(), data.size());
+    for (std::size_t offset : {0, 1, 100, 4980, 4999}) {
+        for (std::size_t len : {1, 20}) {
+            if (offset + len > data.size()) {
+                continue;
+            }
+            std::string updated = data;
+            for (std::size_t i = offset; i < offset + len; i++) {
+                updated[i] = static_cast<char>(rng());
+            }
+            EXPECT_EQ(crc32c_overwrite(crc, data.size(), offset, data.data() + offset, updated.data() + offset, len),
+                      crc32c(updated.data(), updated.size())) << offset << " " << len;
+        }
+    }
+}
+
+TEST_F(crc32c_test, file) { // NOLINT
+    boost::filesystem::path file{"/tmp/crc32c_test"};
+    std::string data(3 * 1024 * 1024 + 5, 'a');
+    {
+        FILE* f = fopen(file.c_str(), "w");
+        ASSERT_EQ(fwrite(data.data(), data.size(), 1, f), 1);
+        fclose(f);
+    }
+    EXPECT_EQ(crc32c_of_file(file), crc32c(data.data(), data.size()));
+    boost::filesystem::remove(file);
+    EXPECT_THROW(crc32c_of_file(file), std::runtime_error);
+}
+
+}  // namespace limestone::testing
@@ -1,5 +1,6 @@
 
 #include <algorithm>
+#include <map>
 #include <sstream>
 #include <limestone/logging.h>
 
@@ -123,6 +124,27 @@ TEST_F(dblogutil_compaction_test, case1force) {
     EXPECT_EQ(read_entire_file(dir / "epoch"), data_case1_epochcompact);
 }
 
+TEST_F(dblogutil_compaction_test, metadata_location) {
+    boost::filesystem::path dir{location};
+    auto metadata_dir = dir / "metadata";
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    boost::filesystem::create_directory(metadata_dir);
+    create_file(metadata_dir / "epoch", data_case1_epoch);
+    create_file(metadata_dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " compaction --force --metadata_location=" + metadata_dir.string() + " " + dir.string() + " 2>&1", out);
+    EXPECT_EQ(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_EQ(read_entire_file(list_dir(dir)[0]), data_case1_pwalcompact);
+    // the metadata files are kept in the metadata location
+    EXPECT_FALSE(boost::filesystem::exists(dir / "epoch"));
+    EXPECT_FALSE(boost::filesystem::exists(dir / std::string(manifest_file_name)));
+    EXPECT_EQ(read_entire_file(metadata_dir / "epoch"), data_case1_epoch);
+}
+
 TEST_F(dblogutil_compaction_test, case1prompt) {
     boost::filesystem::path dir{location};
     dir /= "log";
@@ -142,6 +164,223 @@ TEST_F(dblogutil_compaction_test, case1prompt) {
     EXPECT_EQ(read_entire_file(dir / "epoch"), data_case1_epochcompact);
 }
 
+extern constexpr const std::string_view data_case2_epoch =
+    "\x04\x01\x01\x00\x00\x00\x00\x00\x00"  // epoch 0x101
+    ""sv;
+
+extern constexpr const std::string_view data_case2_pwal0 =
+    "\x02\x01\x01\x00\x00\x00\x00\x00\x00"  // marker_begin 0x101
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "A" "\x01\x01\0\0\0\0\0\0" "verminor" "2"  // normal_entry
+    "\x05\x01\x00\x00\x00"                 "storage1" "B" "\x01\x01\0\0\0\0\0\0" "verminor"  // remove_entry
+    // XXX: epoch footer...
+    ""sv;
+
+// newer generation keeps write versions and tombstones to shadow the older one
+extern constexpr const std::string_view data_case2_pwalcompact =
+    "\x02\x01\x01\x00\x00\x00\x00\x00\x00"
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "A" "\x01\x01\0\0\0\0\0\0" "verminor" "2"  // normal_entry
+    "\x05\x01\x00\x00\x00"                 "storage1" "B" "\x01\x01\0\0\0\0\0\0" "verminor"  // remove_entry
+    // XXX: epoch footer...
+    ""sv;
+
+// merged into the oldest generation
+extern constexpr const std::string_view data_case2_pwalmerged =
+    "\x02\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "A" "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "2"  // normal_entry
+    // XXX: epoch footer...
+    ""sv;
+
+TEST_F(dblogutil_compaction_test, leveled) {
+    boost::filesystem::path dir{location};
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+
+    // 1st: no generation yet, so the delta is the oldest
+    int rc = invoke(UTIL_COMMAND " compaction --force --leveled " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_TRUE(contains(out, "compacted-generations: 1"));
+    EXPECT_TRUE(contains(out, "tombstones-retained: 0"));
+    EXPECT_TRUE(contains(out, "tombstones-dropped: 1"));
+    ASSERT_EQ(list_dir(dir).size(), 1);
+    EXPECT_EQ(read_entire_file(dir / "pwal_0000.compacted.1"), data_case1_pwalcompact);
+    EXPECT_TRUE(boost::filesystem::exists(dir / std::string(compaction_catalog::file_name)));
+
+    // 2nd: only the delta is compacted, older generation is kept as is
+    create_file(dir / "epoch", data_case2_epoch);
+    create_file(dir / "pwal_0000", data_case2_pwal0);
+    rc = invoke(UTIL_COMMAND " compaction --force --leveled " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compacted-generations: 2"));
+    EXPECT_TRUE(contains(out, "tombstones-retained: 1"));
+    EXPECT_TRUE(contains(out, "tombstones-dropped: 0"));
+    ASSERT_EQ(list_dir(dir).size(), 2);
+    EXPECT_EQ(read_entire_file(dir / "pwal_0000.compacted.1"), data_case1_pwalcompact);
+    EXPECT_EQ(read_entire_file(dir / "pwal_0000.compacted.2"), data_case2_pwalcompact);
+
+    // 3rd: level is full, merged into one generation
+    rc = invoke(UTIL_COMMAND " compaction --force --leveled --level_fanout=2 " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compacted-generations: 1"));
+    EXPECT_TRUE(contains(out, "tombstones-retained: 0"));
+    EXPECT_TRUE(contains(out, "tombstones-dropped: 1"));
+    ASSERT_EQ(list_dir(dir).size(), 1);
+    EXPECT_EQ(read_entire_file(dir / "pwal_0000.compacted.3"), data_case2_pwalmerged);
+
+    auto catalog = compaction_catalog::from_dir(dir);
+    ASSERT_EQ(catalog.generations().size(), 1);
+    EXPECT_EQ(catalog.generations()[0].files, (std::vector<std::string>{"pwal_0000.compacted.3"}));
+    EXPECT_EQ(catalog.generations()[0].sources, (std::vector<std::string>{"pwal_0000.compacted.1", "pwal_0000.compacted.2"}));
+}
+
+extern constexpr const std::string_view data_case1_pwalcompact_tombstones =
+    "\x02\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "A" "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "1"  // normal_entry
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "B" "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "0"  // normal_entry
+    "\x05\x01\x00\x00\x00"                 "storage1" "C" "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0"  // remove_entry
+    // XXX: epoch footer...
+    ""sv;
+
+TEST_F(dblogutil_compaction_test, retain_tombstones) {
+    boost::filesystem::path dir{location};
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " compaction --force --tombstones=retain " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_TRUE(contains(out, "tombstones-retained: 1"));
+    EXPECT_TRUE(contains(out, "tombstones-dropped: 0"));
+    EXPECT_EQ(read_entire_file(list_dir(dir)[0]), data_case1_pwalcompact_tombstones);
+    auto catalog = compaction_catalog::from_dir(dir);
+    ASSERT_EQ(catalog.generations().size(), 1);
+    EXPECT_EQ(catalog.generations()[0].entries, 3);
+    EXPECT_EQ(catalog.generations()[0].tombstones, 1);
+
+    rc = invoke(UTIL_COMMAND " compaction --force --tombstones=keep " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 64 << 8);
+    EXPECT_TRUE(contains(out, "invalid value for --tombstones option"));
+}
+
+// write versions are kept, and the snippet is of the durable epoch
+extern constexpr const std::string_view data_case1_pwalcompact_preserved =
+    "\x02\x00\x01\x00\x00\x00\x00\x00\x00"  // marker_begin 0x100
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "A" "\xf1\0\0\0\0\0\0\0" "verminor" "1"  // normal_entry
+    "\x01\x01\x00\x00\x00\x01\x00\x00\x00" "storage1" "B" "\xf0\0\0\0\0\0\0\0" "verminor" "0"  // normal_entry
+    // XXX: epoch footer...
+    ""sv;
+
+TEST_F(dblogutil_compaction_test, preserve_write_versions) {
+    boost::filesystem::path dir{location};
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " compaction --force --preserve_write_versions " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_EQ(read_entire_file(list_dir(dir)[0]), data_case1_pwalcompact_preserved);
+    EXPECT_EQ(read_entire_file(dir / "epoch"), data_case1_epochcompact);
+    auto catalog = compaction_catalog::from_dir(dir);
+    ASSERT_EQ(catalog.generations().size(), 1);
+    EXPECT_FALSE(catalog.generations()[0].rewound);
+    EXPECT_EQ(catalog.generations()[0].min_epoch, 0xf0);
+    EXPECT_EQ(catalog.generations()[0].max_epoch, 0xf1);
+
+    // newer pwal file is merged with the compacted one by write versions
+    create_file(dir / "epoch", data_case2_epoch);
+    create_file(dir / "pwal_0000", data_case2_pwal0);
+    rc = invoke(UTIL_COMMAND " compaction --force --preserve_write_versions " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "tombstones-dropped: 1"));
+    std::map<std::string, std::string> entries;
+    dblog_scan ds{dir};
+    ds.scan_pwal_files_throws(0x101, [&entries](log_entry& e){ entries.emplace(e.key_sid(), e.value_etc()); });
+    EXPECT_EQ(entries, (std::map<std::string, std::string>{
+        {"storage1A"s, "\x01\x01\0\0\0\0\0\0" "verminor" "2"s},
+    }));
+}
+
+TEST_F(dblogutil_compaction_test, segments) {
+    boost::filesystem::path dir{location};
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " compaction --force --segments=3 --thread_num=2 " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_TRUE(contains(out, "compaction-progress: scanned 2/2 pwal files"));
+    EXPECT_TRUE(contains(out, "compaction-progress: written 3/3 compacted files"));
+    ASSERT_EQ(list_dir(dir).size(), 3);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(boost::filesystem::exists(dir / ("pwal_000" + std::to_string(i) + ".compacted")));
+    }
+    auto catalog = compaction_catalog::from_dir(dir);
+    ASSERT_EQ(catalog.generations().size(), 1);
+    EXPECT_EQ(catalog.generations()[0].files.size(), 3);
+    EXPECT_EQ(catalog.generations()[0].entries, 2);
+
+    // the segments have the same entries as data_case1_pwalcompact
+    std::map<std::string, std::string> entries;
+    dblog_scan ds{dir};
+    ds.scan_pwal_files_throws(0x100, [&entries](log_entry& e){ entries.emplace(e.key_sid(), e.value_etc()); });
+    EXPECT_EQ(entries, (std::map<std::string, std::string>{
+        {"storage1A"s, "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "1"s},
+        {"storage1B"s, "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "0"s},
+    }));
+}
+
+TEST_F(dblogutil_compaction_test, temp_space_limit) {
+    boost::filesystem::path dir{location};
+    dir /= "log";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " compaction --force --temp_space_limit=16 " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 64 << 8);
+    EXPECT_TRUE(contains(out, "temporary space limit exceeded"));
+    EXPECT_EQ(read_entire_file(dir / "pwal_0000"), data_case1_pwal0);  // not modified
+
+    rc = invoke(UTIL_COMMAND " compaction --force --temp_space_limit=1K " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 0 << 8);
+    EXPECT_TRUE(contains(out, "compaction was successfully completed: "));
+    EXPECT_EQ(read_entire_file(list_dir(dir)[0]), data_case1_pwalcompact);
+
+    rc = invoke(UTIL_COMMAND " compaction --force --temp_space_limit=1X " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 64 << 8);
+    EXPECT_TRUE(contains(out, "invalid value for --temp_space_limit option"));
+
+    // 129 bytes of entries are sorted, and 52 bytes of them are written; the compacted file is not counted
+    dir = boost::filesystem::path(location) / "log2";
+    boost::filesystem::create_directory(dir);
+    create_file(dir / "epoch", data_case1_epoch);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    create_file(dir / "pwal_0000", data_case1_pwal0);
+    create_file(dir / "pwal_0001", data_case1_pwal1);
+    rc = invoke(UTIL_COMMAND " compaction --force --temp_space_limit=150 " + dir.string() + " 2>&1", out);
+    EXPECT_EQ(rc, 0 << 8);
+    EXPECT_EQ(read_entire_file(list_dir(dir)[0]), data_case1_pwalcompact);
+}
+
 TEST_F(dblogutil_compaction_test, unreadable) {
     // root can read directories w/o permissions
     if (geteuid() == 0) { GTEST_SKIP() << "skip when run by root"; }
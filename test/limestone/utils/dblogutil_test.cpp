@@ -79,14 +79,14 @@ static constexpr const char* location = "/tmp/dblogutil_test";
         return ret;
     }
 
-    std::pair<int, std::string> inspect(std::string pwal_fname, std::string_view data) {
+    std::pair<int, std::string> inspect(std::string pwal_fname, std::string_view data, const std::string& options = "", int persistent_format_version = 1) {
         boost::filesystem::path dir{location};
         create_file(dir / "epoch", epoch_0x100_str);
-        create_file(dir / std::string(manifest_file_name), data_manifest());
+        create_file(dir / std::string(manifest_file_name), data_manifest(persistent_format_version));
         auto pwal = dir / pwal_fname;
         create_file(pwal, data);
         std::string command;
-        command = UTIL_COMMAND " inspect " + dir.string() + " 2>&1";
+        command = UTIL_COMMAND " inspect " + options + dir.string() + " 2>&1";
         std::string out;
         int rc = invoke(command, out);
         return make_pair(rc, out);
@@ -203,6 +203,14 @@ static constexpr const char* location = "/tmp/dblogutil_test";
 TEST_F(dblogutil_test, inspect_normal) {
     auto [rc, out] = inspect("pwal_0000", data_normal);
     EXPECT_EQ(rc, 0);
+    EXPECT_TRUE(contains_line_starts_with(out, "persistent-format-version: 1\n"));
+    EXPECT_NE(out.find("\n" "status: OK"), out.npos);
+}
+
+TEST_F(dblogutil_test, inspect_persistent_format_version) {
+    auto [rc, out] = inspect("pwal_0000", data_normal, "", latest_persistent_format_version);
+    EXPECT_EQ(rc, 0);
+    EXPECT_TRUE(contains_line_starts_with(out, "persistent-format-version: " + std::to_string(latest_persistent_format_version) + "\n"));
     EXPECT_NE(out.find("\n" "status: OK"), out.npos);
 }
 
@@ -213,6 +221,24 @@ TEST_F(dblogutil_test, inspect_normal2) {
     EXPECT_NE(out.find("\n" "count-durable-wal-entries: 3"), out.npos);
 }
 
+TEST_F(dblogutil_test, inspect_normal2_machine_readable) {
+    auto [rc, out] = inspect("pwal_0000", data_normal2, "--output_format=machine-readable ");
+    EXPECT_EQ(rc, 0 << 8);
+    EXPECT_NE(out.find("\n" "count-durable-wal-entries: 3"), out.npos);
+    // JSON Lines of each epoch snippet and pwal file
+    EXPECT_TRUE(contains_line_starts_with(out, R"({"epoch":240,"file":"pwal_0000","key_bytes":4,)"));
+    EXPECT_TRUE(contains(out, R"("length":50,"normal_entries":1,"offset":50,"remove_entries":0,)"));
+    EXPECT_TRUE(contains_line_starts_with(out, R"({"file":"pwal_0000","invalid_snippets":0,"key_bytes":12,"key_size_histogram":[0,0,0,3],"normal_entries":3,)"));
+    EXPECT_TRUE(contains(out, R"("size":150,"snippets":3,)"));
+}
+
+TEST_F(dblogutil_test, inspect_nondurable_machine_readable) {
+    auto [rc, out] = inspect("pwal_0000", data_nondurable, "--output_format=machine-readable ");
+    EXPECT_EQ(rc, 1 << 8);
+    EXPECT_TRUE(contains(out, R"("normal_entries":0,"offset":9,"remove_entries":0,"storages":{},"type":"snippet","valid":false,)"));
+    EXPECT_TRUE(contains(out, R"("invalid_snippets":1,)"));
+}
+
 TEST_F(dblogutil_test, inspect_nondurable) {
     auto [rc, out] = inspect("pwal_0000", data_nondurable);
     EXPECT_EQ(rc, 1 << 8);
@@ -448,6 +474,31 @@ TEST_F(dblogutil_test, repairc_allzero) {
     expect_no_change(orig_data);
 }
 
+TEST_F(dblogutil_test, repair_metadata_location) {
+    boost::filesystem::path dir{location};
+    boost::filesystem::path metadata_dir = dir / "metadata";
+    boost::filesystem::create_directory(metadata_dir);
+    create_file(metadata_dir / "epoch", epoch_0x100_str);
+    create_file(metadata_dir / std::string(manifest_file_name), data_manifest());
+    auto orig_data = data_nondurable;
+    create_file(dir / "pwal_0000", orig_data);
+
+    // the epoch file and the manifest file are not in dblogdir
+    std::string out;
+    int rc = invoke(UTIL_COMMAND " repair --cut=false " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 64 << 8);
+    expect_no_change(orig_data);
+
+    rc = invoke(UTIL_COMMAND " repair --cut=false --metadata_location=" + metadata_dir.string() + " " + dir.string() + " 2>&1", out);
+    EXPECT_EQ(rc, 0);
+    EXPECT_NE(out.find("\n" "status: repaired"), out.npos);
+    expect_mark_at(9, orig_data);
+
+    rc = invoke(UTIL_COMMAND " repair --metadata_location=" + (dir / "nonexistent").string() + " " + dir.string() + " 2>&1", out);
+    EXPECT_GE(rc, 64 << 8);
+    EXPECT_TRUE(contains(out, "not exist"));
+}
+
 TEST_F(dblogutil_test, repair_nonexistent) {
     boost::filesystem::path dir{location};
     dir /= "nonexistent";
@@ -565,4 +616,18 @@ TEST_F(dblogutil_test, invalid_epoch_option3) {
     EXPECT_TRUE(contains(out, "invalid"));
 }
 
+TEST_F(dblogutil_test, invalid_temp_space_limit_option) {
+    boost::filesystem::path dir{location};
+    create_file(dir / "epoch", epoch_0x100_str);
+    create_file(dir / std::string(manifest_file_name), data_manifest());
+    for (const std::string limit : {"-1G", "99999999999T", "18446744073709551616", "+1G"}) {
+        std::string command;
+        command = UTIL_COMMAND " compaction --force --temp_space_limit=" + limit + " " + dir.string() + " 2>&1";
+        std::string out;
+        int rc = invoke(command, out);
+        EXPECT_GE(rc, 64 << 8) << limit;
+        EXPECT_TRUE(contains(out, "invalid value for --temp_space_limit option")) << limit;
+    }
+}
+
 }  // namespace limestone::testing
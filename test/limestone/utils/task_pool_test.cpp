@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "task_pool.h"
+
+#include "test_root.h"
+
+namespace limestone::testing {
+
+using namespace std::literals;
+using namespace limestone::internal;
+
+class task_pool_test : public ::testing::Test {
+public:
+    // counts the calls running at a time, and remembers the maximum
+    void enter() {
+        auto n = ++running_;
+        auto m = max_running_.load();
+        while (m < n && !max_running_.compare_exchange_weak(m, n)) {
+            /* nop */
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    void leave() { running_--; }
+
+    std::atomic_int running_{0};
+    std::atomic_int max_running_{0};
+};
+
+TEST_F(task_pool_test, calls_all) { // NOLINT
+    task_pool pool{4};
+    std::vector<int> called(100);  // each element is written by one call only
+    pool.parallel_for(called.size(), [&](std::size_t i) { called.at(i)++; });
+    EXPECT_EQ(called, std::vector<int>(100, 1));
+    pool.parallel_for(0, [](std::size_t) { FAIL(); });
+}
+
+TEST_F(task_pool_test, bounded_by_max_parallelism) { // NOLINT
+    task_pool pool{4};
+    pool.parallel_for(20, [&](std::size_t) { enter(); leave(); }, 2);
+    EXPECT_LE(max_running_.load(), 2);
+}
+
+TEST_F(task_pool_test, threads_are_reused) { // NOLINT
+    task_pool pool{3};
+    std::mutex mtx{};
+    std::set<std::thread::id> ids{};
+    for (int k = 0; k < 3; k++) {
+        pool.parallel_for(10, [&](std::size_t) {
+            std::this_thread::sleep_for(1ms);
+            std::lock_guard<std::mutex> lock{mtx};
+            ids.emplace(std::this_thread::get_id());
+        });
+    }
+    EXPECT_LE(ids.size(), 3);
+    EXPECT_EQ(ids.count(std::this_thread::get_id()), 0);  // the caller only waits
+}
+
+// the nested and the concurrent calls share the threads of the pool, without deadlock
+TEST_F(task_pool_test, nested_and_concurrent_calls_are_bounded_together) { // NOLINT
+    task_pool pool{3};
+    std::atomic_int inner_calls{0};
+    auto outer = [&]() {
+        pool.parallel_for(6, [&](std::size_t) {
+            pool.parallel_for(5, [&](std::size_t) {
+                enter();
+                inner_calls++;
+                leave();
+            });
+        });
+    };
+    std::thread t1{outer};
+    std::thread t2{outer};
+    t1.join();
+    t2.join();
+    EXPECT_EQ(inner_calls.load(), 2 * 6 * 5);
+    EXPECT_LE(max_running_.load(), 3);
+}
+
+TEST_F(task_pool_test, rethrows_first_exception) { // NOLINT
+    task_pool pool{2};
+    std::atomic_int called{0};
+    EXPECT_THROW(pool.parallel_for(1000, [&](std::size_t i) {
+        called++;
+        if (i == 3) {
+            throw std::runtime_error("task failed");
+        }
+        std::this_thread::sleep_for(100us);
+    }), std::runtime_error);
+    EXPECT_LT(called.load(), 1000);  // the rest are skipped
+    // still usable
+    called = 0;
+    pool.parallel_for(10, [&](std::size_t) { called++; });
+    EXPECT_EQ(called.load(), 10);
+}
+
+TEST_F(task_pool_test, nested_exception) { // NOLINT
+    task_pool pool{2};
+    EXPECT_THROW(pool.parallel_for(4, [&](std::size_t) {
+        pool.parallel_for(4, [](std::size_t j) {
+            if (j == 1) {
+                throw std::runtime_error("inner task failed");
+            }
+        });
+    }), std::runtime_error);
+}
+
+}  // namespace limestone::testing